@@ -0,0 +1,100 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs a batch of jobs on a few worker threads. The calling thread takes jobs as well and Run returns
+// once all of them are done.
+class CallbackPool
+{
+public:
+	~CallbackPool()
+	{
+		Resize(0);
+	}
+
+	size_t size() const
+	{
+		return _workers.size();
+	}
+
+	void Resize(size_t numThreads)
+	{
+		if (numThreads == _workers.size())
+			return;
+		{
+			std::lock_guard lock(_mutex);
+			_quit = true;
+		}
+		_wakeUp.notify_all();
+		for (auto &worker : _workers)
+		{
+			worker.join();
+		}
+		_workers.clear();
+		_quit = false;
+		for (size_t i = 0; i < numThreads; ++i)
+		{
+			_workers.emplace_back(&CallbackPool::WorkerLoop, this);
+		}
+	}
+
+	void Run(const std::vector<int> &jobs, std::function<void(int)> task)
+	{
+		std::unique_lock lock(_mutex);
+		_jobs = jobs;
+		_task = std::move(task);
+		_nextJob = 0;
+		_pending = jobs.size();
+		++_batch;
+		_wakeUp.notify_all();
+		DoJobs(lock);
+		_batchDone.wait(lock, [this] { return _pending == 0; });
+	}
+
+private:
+	void WorkerLoop()
+	{
+		std::unique_lock lock(_mutex);
+		uint64_t lastBatch = _batch;
+		while (true)
+		{
+			_wakeUp.wait(lock, [this, &lastBatch] { return _quit || _batch != lastBatch; });
+			if (_quit)
+				return;
+			lastBatch = _batch;
+			DoJobs(lock);
+		}
+	}
+
+	// Called with the lock held
+	void DoJobs(std::unique_lock<std::mutex> &lock)
+	{
+		while (_nextJob < _jobs.size())
+		{
+			int job = _jobs[_nextJob++];
+			lock.unlock();
+			_task(job);
+			lock.lock();
+			if (--_pending == 0)
+			{
+				_batchDone.notify_all();
+			}
+		}
+	}
+
+	std::vector<std::thread> _workers;
+	std::mutex _mutex;
+	std::condition_variable _wakeUp;
+	std::condition_variable _batchDone;
+	std::vector<int> _jobs;
+	std::function<void(int)> _task;
+	size_t _nextJob = 0;
+	size_t _pending = 0;
+	uint64_t _batch = 0;
+	bool _quit = false;
+};
@@ -2,10 +2,14 @@
 
 #include "JoyShockMapper.h"
 
+#include <any>
+#include <cstdint>
 #include <functional>
+#include <iosfwd>
 #include <map>
 #include <memory>
 #include <string_view>
+#include <vector>
 
 // This is a base class for any Command line operation. It binds a command name to a parser function
 // Derivatives from this class have a default parser function and performs specific operations.
@@ -21,6 +25,10 @@ public:
 	// themselves from their host variable when assigned NONE
 	typedef function<void(JSMCommand& me)> TaskOnDestruction;
 
+	// Commands that add or remove other commands tell which ones from the value they validated, so that the lines
+	// after them in a file can be checked. A name maps to true if its command will be there, false otherwise.
+	typedef function<void(in_string arguments, const any& value, map<string, bool>& commands)> RegistryChangeDelegate;
+
 protected:
 	// Parse functor to be assigned by derived class or overwritten
 	// Use setter to assign
@@ -32,6 +40,9 @@ protected:
 	// Some task to perform when this object is destroyed
 	TaskOnDestruction _taskOnDestruction;
 
+	// How processing these arguments changes the registry
+	RegistryChangeDelegate _registryChange;
+
 public:
 	// Name of the command. Cannot be changed after construction.
 	// I don't mind leaving this public since it can't be changed.
@@ -65,8 +76,26 @@ public:
 		return this;
 	}
 
+	// Tell what processing arguments that passed Validate will change in the registry
+	inline JSMCommand* SetRegistryChange(const RegistryChangeDelegate& registryChange)
+	{
+		_registryChange = registryChange;
+		return this;
+	}
+
+	void StageRegistryChange(in_string arguments, const any& value, map<string, bool>& commands) const;
+
 	// Request this command to parse the command arguments. Returns true if the command was processed.
 	virtual bool ParseData(in_string arguments);
+
+	// Check the command arguments without processing them, so that a file can be rejected before any of it is
+	// applied. Commands that can only tell by running accept anything. Commands that read a value to check it
+	// hand it over in value, so that Apply doesn't read it again.
+	virtual bool Validate(in_string arguments, any& value);
+
+	// Process arguments that passed Validate, along with the value it read if any. Returns true if the command
+	// was processed.
+	virtual bool Apply(in_string arguments, const any& value);
 };
 
 // The command registry holds all JSMCommands object and should not care what the derived type is.
@@ -83,13 +112,85 @@ private:
 	// multimap allows multiple entries with the same keys
 	CmdMap _registry;
 
+	// Bumped whenever a command is added or removed
+	unsigned int _version = 0;
+
+	// A command found for a line when it was validated, with the value it read from the line
+	struct LineCommand
+	{
+		JSMCommand* command;
+		any value;
+	};
+
+	// A command line broken up in its parts
+	struct ParsedLine
+	{
+		string text;
+		string combo;
+		char op = '\0';
+		string name;
+		string arguments;
+		string label;
+		// Filled by validateLine, and only used while the registry is at the same version
+		vector<LineCommand> commands;
+		unsigned int registryVersion = 0;
+	};
+
+	// What a config file amounts to, along with the files it includes
+	struct StagedFile
+	{
+		vector<ParsedLine> lines;
+		// The file and every file it includes
+		vector<string> sources;
+		vector<string> diagnostics;
+		// Commands that the lines staged so far add (true) or remove (false) from the registry
+		map<string, bool> registryChanges;
+		// Registry version the lines were checked against
+		unsigned int registryVersion = 0;
+
+		// Modification time and content hash of a source, when it was staged
+		struct SourceStamp
+		{
+			string path;
+			int64_t modified = 0;
+			uint64_t hash = 0;
+		};
+		vector<SourceStamp> stamps;
+	};
+
+	// Files that loaded without error, keyed by absolute path. They are applied again without being read, parsed
+	// and checked as long as none of their sources changed and the registry is the same.
+	map<string, shared_ptr<const StagedFile>> _stagedFiles;
+
 	static string_view strtrim(std::string_view str);
 
 	static bool findCommandWithName(in_string name, CmdMap::value_type& pair);
 
+	static ParsedLine parseLine(in_string line);
+
+	// Strips the comment and quotation marks from the file name, and looks in the config folder too
+	static bool openConfigFile(string& fileName, ifstream& file);
+
+	// Read the lines of the file and of the files it includes, and report the lines that can't be applied
+	void stageConfigFile(ifstream& file, in_string fileName, StagedFile& staged, vector<string>& including);
+
+	// Whether a file staged before can be applied as it is
+	bool isStagedFileCurrent(const StagedFile& staged) const;
+
+	// Remember the state of the sources of a file that was staged. False if one can't be read.
+	static bool stampStagedFile(StagedFile& staged);
+
+	// Empty if the line can be applied after the registry changes of the lines before it, otherwise what is wrong
+	// with it. Keeps the commands of the line in it.
+	string validateLine(ParsedLine& line, const map<string, bool>& registryChanges);
+
+	void applyLine(const ParsedLine& line);
+
 public:
 	CmdRegistry();
 
+	// The whole file, along with the files it includes, is read and checked before any of it is applied. Nothing
+	// is applied if a line is invalid. Returns false if the file can't be opened.
 	// Not in_string because the string is modified inside
 	bool loadConfigFile(string fileName);
 
@@ -4,15 +4,112 @@
 #include "JoyShockMapper.h"
 #include "Gamepad.h"
 #include "MotionIf.h"
+#include <array>
+#include <bitset>
 #include <chrono>
 #include <deque>
+#include <iterator>
 #include <mutex>
 
 // Forward declarations
-class JSMButton;
+struct ButtonMappings;
 class DigitalButton;      // Finite State Machine
 struct DigitalButtonImpl; // Button implementation
 
+// The buttons currently acting as chords, from the most recent to the oldest, always followed by NONE to handle
+// modeshifts and chords. The order lives in an inline array and a mask of the buttons tells whether one is in
+// there, so nothing allocates and membership is a bit test.
+class ChordStack
+{
+public:
+	using const_iterator = reverse_iterator<const ButtonID *>;
+
+	static constexpr size_t CAPACITY = size_t(int(ButtonID::T25) - int(ButtonID::NONE) + 1);
+	static_assert(CAPACITY <= 128, "The mask of the chord stack is too small for the buttons");
+
+	ChordStack()
+	{
+		push(ButtonID::NONE);
+	}
+
+	bool contains(ButtonID id) const
+	{
+		return id >= ButtonID::NONE && id <= ButtonID::T25 && _mask.test(bit(id));
+	}
+
+	// Put the button on top of the stack. Returns false if it is already in.
+	bool push(ButtonID id)
+	{
+		if (contains(id) || id < ButtonID::NONE || id > ButtonID::T25)
+		{
+			return false;
+		}
+		_buttons[_size++] = id;
+		_mask.set(bit(id));
+		++_version;
+		return true;
+	}
+
+	bool erase(ButtonID id)
+	{
+		return eraseIf([id](ButtonID button) { return button == id; }) > 0;
+	}
+
+	// Returns the number of buttons removed
+	template<typename Predicate>
+	size_t eraseIf(Predicate predicate)
+	{
+		size_t kept = 0;
+		for (size_t i = 0; i < _size; ++i)
+		{
+			if (predicate(_buttons[i]))
+			{
+				_mask.reset(bit(_buttons[i]));
+			}
+			else
+			{
+				_buttons[kept++] = _buttons[i];
+			}
+		}
+		size_t removed = _size - kept;
+		_size = kept;
+		if (removed > 0)
+		{
+			++_version;
+		}
+		return removed;
+	}
+
+	// From the most recent button, so that the latest chord takes precedence
+	const_iterator begin() const
+	{
+		return const_iterator(_buttons.data() + _size);
+	}
+
+	const_iterator end() const
+	{
+		return const_iterator(_buttons.data());
+	}
+
+	// Incremented on every change, for what is derived from the chords to tell when it is out of date
+	unsigned int version() const
+	{
+		return _version;
+	}
+
+private:
+	static size_t bit(ButtonID id)
+	{
+		return size_t(int(id) - int(ButtonID::NONE));
+	}
+
+	// Stored from the oldest to the most recent so that pushing doesn't move the others
+	array<ButtonID, CAPACITY> _buttons;
+	size_t _size = 0;
+	bitset<128> _mask;
+	unsigned int _version = 0;
+};
+
 // The enum values match the concrete class names
 enum class BtnState
 {
@@ -109,19 +206,20 @@ public:
 		Context(Gamepad::Callback virtualControllerCallback, shared_ptr<MotionIf> mainMotion);
 		deque<pair<ButtonID, KeyCode>> gyroActionQueue; // Queue of gyro control actions currently in effect
 		deque<pair<ButtonID, KeyCode>> activeTogglesQueue;
-		deque<ButtonID> chordStack; // Represents the current active buttons in order from most recent to latest
+		ChordStack chordStack; // Represents the current active buttons in order from most recent to latest
 		unique_ptr<Gamepad> _vigemController;
 		function<DigitalButton *(ButtonID)> _getMatchingSimBtn; // A functor to JoyShock::GetMatchingSimBtn
 		function<void(int small, int big)> _rumble;             // A functor to JoyShock::Rumble
 		mutex callback_lock;                                    // Needs to be in the common struct for both joycons to use the same
 		shared_ptr<MotionIf> rightMainMotion = nullptr;
 		shared_ptr<MotionIf> leftMotion = nullptr;
+		shared_ptr<const vector<ButtonMappings>> mappings; // Of the current settings snapshot, by ButtonID
 		int nn = 0;
 
 		void updateChordStack(bool isPressed, ButtonID index);
 	};
 
-	DigitalButton(shared_ptr<DigitalButton::Context> _context, JSMButton &mapping);
+	DigitalButton(shared_ptr<DigitalButton::Context> _context, ButtonID id);
 
 	const ButtonID _id;
 
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "JslWrapper.h"
+
+// A Linux backend that reads DualShock 4 and DualSense controllers straight from /dev/hidraw*. It waits on
+// all devices at once with epoll and calls back as soon as a report arrives, instead of polling at tick_time.
+// Controllers plugged in later are picked up as their device node appears.
+JslWrapper *NewHidrawWrapper();
@@ -25,6 +25,9 @@ void moveMouse(float x, float y);
 
 void setMouseNorm(float x, float y);
 
+// Set up the devices the output goes through. Throws if that fails, unless the output is optional.
+void initVirtualOutput(bool optional);
+
 // delta time will apply to shaped movement, but the extra (velocity parameters after deltaTime) is
 // applied as given
 inline void shapedSensitivityMoveMouse(float x, float y, float deltaTime, float extraVelocityX, float extraVelocityY)
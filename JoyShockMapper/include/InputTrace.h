@@ -0,0 +1,126 @@
+#pragma once
+
+#include "JslWrapper.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Binary capture of what the poll callback reads from each device. The file is a TraceHeader followed by
+// records of fixed layout, so it can be walked in place from a buffer or a memory mapping. The IMU samples
+// of a tick are written before the frame record of that tick.
+namespace InputTraceFormat
+{
+	static constexpr char MAGIC[4] = { 'J', 'S', 'M', 'T' };
+	static constexpr uint32_t VERSION = 1;
+
+	enum RecordType : uint16_t
+	{
+		FRAME = 1,
+		IMU_SAMPLE = 2,
+	};
+
+	struct TraceHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t frameRecordSize;
+		uint32_t imuRecordSize;
+	};
+
+	struct RecordHeader
+	{
+		uint16_t type;
+		uint16_t size; // of the whole record, which must match its type
+		int32_t handle;
+		uint64_t time; // microseconds since the recording started
+	};
+
+	struct FrameRecord
+	{
+		RecordHeader header;
+		float deltaTime; // seconds since the previous callback of the device
+		int32_t controllerType;
+		int32_t splitType;
+		int32_t touchpadSizeX;
+		int32_t touchpadSizeY;
+		uint64_t imuTimestamp;
+		JOY_SHOCK_STATE state;
+		IMU_STATE imu;
+		TOUCH_STATE touch;
+	};
+
+	struct ImuRecord
+	{
+		RecordHeader header;
+		IMU_STATE imu;
+		float deltaTime;
+		uint64_t timestamp;
+	};
+}
+
+class InputTraceWriter
+{
+public:
+	bool Open(const std::string &path);
+	void Close();
+
+	bool IsOpen() const
+	{
+		return _isOpen;
+	}
+
+	// Record one callback of a device. Safe to call from several poll threads.
+	void Write(int handle, float deltaTime, const DeviceFrame &frame, const ImuSample *samples, int numSamples);
+
+	size_t GetNumFrames();
+
+private:
+	std::mutex _lock;
+	std::atomic_bool _isOpen = false; // Checked without the lock so that not recording costs nothing
+	std::ofstream _file;
+	std::chrono::steady_clock::time_point _start;
+	size_t _numFrames = 0;
+};
+
+class InputTrace
+{
+public:
+	// Returns null and fills error if the file can't be used
+	static std::unique_ptr<InputTrace> Load(const std::string &path, std::string &error);
+
+	// Walk the records in order. Returns null at the end.
+	const InputTraceFormat::RecordHeader *Next(size_t &offset) const;
+
+	size_t GetNumFrames() const
+	{
+		return _numFrames;
+	}
+
+	// Handles as recorded, in order of first appearance
+	const std::vector<int> &GetHandles() const
+	{
+		return _handles;
+	}
+
+	// The first frame recorded for each handle, in the same order
+	const std::vector<InputTraceFormat::FrameRecord> &GetFirstFrames() const
+	{
+		return _firstFrames;
+	}
+
+private:
+	std::vector<char> _data;
+	size_t _numFrames = 0;
+	std::vector<int> _handles;
+	std::vector<InputTraceFormat::FrameRecord> _firstFrames;
+};
+
+// A backend that plays a trace back instead of reading hardware. The callbacks are given the recorded delta
+// time, and are called either as fast as possible or at the recorded pace.
+JslWrapper *NewTraceReplayer(std::unique_ptr<InputTrace> trace, bool realTime);
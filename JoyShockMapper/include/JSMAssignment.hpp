@@ -90,25 +90,68 @@ protected:
 		T value(inst->ReadValue(ss));
 		if (!ss.fail())
 		{
-			T oldVal = inst->_var;
-			inst->_var = value;
-
-			// The assignment won't trigger my listener DisplayNewValue if
-			// the new value after filtering is the same as the old.
-			if (oldVal == inst->_var.get())
-			{
-				// So I want to do it myself.
-				inst->DisplayNewValue(inst->_var);
-			}
-
-			// Command succeeded if the value requested was the current one
-			// or if the new value is different from the old.
-			return value == oldVal || inst->_var.get() != oldVal; // Command processed successfully
+			return inst->Assign(value);
 		}
 		// Couldn't read the value
 		return false;
 	}
 
+	// Returns whether the variable took the value
+	bool Assign(const T& value)
+	{
+		T oldVal = _var;
+		_var = value;
+
+		// The assignment won't trigger my listener DisplayNewValue if
+		// the new value after filtering is the same as the old.
+		// Files only report what they change though.
+		if (oldVal == _var.get() && !NotificationBatch::IsActive())
+		{
+			// So I want to do it myself.
+			DisplayNewValue(_var);
+		}
+
+		// Command succeeded if the value requested was the current one
+		// or if the new value is different from the old.
+		return value == oldVal || _var.get() != oldVal; // Command processed successfully
+	}
+
+	// Only the values read by the default parser can be checked without assigning them
+	virtual bool Validate(in_string arguments, any& value) override
+	{
+		smatch results;
+		if (!regex_match(arguments, results, regex(R"(\s*=\s*(.*))")))
+		{
+			// Displays the value or the help
+			return arguments.empty() || arguments.compare(0, 4, "HELP") == 0;
+		}
+		string assignment(results[1].str());
+		auto parser = _parse.target<bool (*)(JSMCommand*, in_string)>();
+		if (assignment.rfind("DEFAULT", 0) == 0 || !parser || *parser != &JSMAssignment::DefaultParser)
+		{
+			return true;
+		}
+		stringstream ss(assignment);
+		T read(ReadValue(ss));
+		if (ss.fail())
+		{
+			return false;
+		}
+		value = move(read);
+		return true;
+	}
+
+	virtual bool Apply(in_string arguments, const any& value) override
+	{
+		auto read = any_cast<T>(&value);
+		if (read && Assign(*read))
+		{
+			return true; // Command is completely processed
+		}
+		// Reports the error, if any
+		return ParseData(arguments);
+	}
+
 	virtual void DisplayNewValue(const T& newValue)
 	{
 		// See Specialization for T=Mapping at the end of this file
@@ -191,7 +234,7 @@ public:
 		SetParser(&JSMAssignment::DefaultParser);
 		if (!inNoListener)
 		{
-			_listenerId = _var.AddOnChangeListener(bind(&JSMAssignment::DisplayNewValue, this, placeholders::_1));
+			_listenerId = _var.AddDisplayListener(bind(&JSMAssignment::DisplayNewValue, this, placeholders::_1));
 		}
 	}
 
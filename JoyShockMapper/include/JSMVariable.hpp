@@ -2,11 +2,100 @@
 
 #include "JoyShockMapper.h"
 #include "Mapping.h"
+#include <algorithm>
+#include <memory>
 #include <sstream>
+#include <atomic>
+#include <bitset>
+#include <optional>
+#include <tuple>
+#include <vector>
 
 // Global ID generator
 static unsigned int _delegateID = 1;
 
+// Incremented whenever the value of any variable or chord changes, so that what is derived from them can tell
+// when it is out of date
+inline atomic<unsigned int> _variablesVersion{ 0 };
+
+// While a batch is alive, the variables changed by this thread hold off notifying their display listeners. When
+// the outermost batch ends, each variable whose value differs from the one before the batch notifies them once,
+// with its final value. Loading a file then doesn't report every intermediate value, nor the values it sets back
+// to what they were. The other listeners keep firing on every change, in order, since later lines may depend on
+// what they do.
+class NotificationBatch
+{
+public:
+	// A variable changed during the batch
+	struct Change
+	{
+		void *variable;
+
+		Change(void *changedVariable)
+		  : variable(changedVariable)
+		{
+		}
+
+		virtual ~Change() = default;
+
+		virtual void Notify() = 0;
+	};
+
+	NotificationBatch()
+	{
+		++_depth;
+	}
+
+	~NotificationBatch()
+	{
+		if (_depth == 1)
+		{
+			// Variables changed by the listeners are added to the end and notified in turn
+			for (size_t i = 0; i < _pending.size(); ++i)
+			{
+				auto change = move(_pending[i]);
+				if (change->variable)
+				{
+					change->Notify();
+				}
+			}
+			_pending.clear();
+		}
+		--_depth;
+	}
+
+	static bool IsActive()
+	{
+		return _depth > 0;
+	}
+
+	static bool IsDeferred(const void *variable)
+	{
+		return any_of(_pending.begin(), _pending.end(), [variable](const auto &change) { return change && change->variable == variable; });
+	}
+
+	static void Defer(unique_ptr<Change> change)
+	{
+		_pending.push_back(move(change));
+	}
+
+	// The variable is going away
+	static void Cancel(const void *variable)
+	{
+		for (auto &change : _pending)
+		{
+			if (change && change->variable == variable)
+			{
+				change->variable = nullptr;
+			}
+		}
+	}
+
+private:
+	static inline thread_local int _depth = 0;
+	static inline thread_local vector<unique_ptr<Change>> _pending;
+};
+
 // JSMVariable is a wrapper class for an underlying variable of type T.
 // This class allows other parts of the code be notified of when it changes value.
 // It also has a default value defined at construction that can be assigned on Reset.
@@ -27,8 +116,14 @@ protected:
 	// The variable value itself
 	T _value;
 
+	struct Listener
+	{
+		OnChangeDelegate function;
+		bool display; // Only reports the value, so it can wait for the end of a NotificationBatch
+	};
+
 	// Parts of the code can be notified of when _value changes.
-	map<unsigned int, OnChangeDelegate> _onChangeListeners;
+	map<unsigned int, Listener> _onChangeListeners;
 
 	// The filtering function of the variable.
 	FilterDelegate _filter;
@@ -39,6 +134,36 @@ protected:
 		return nu;
 	}
 
+	void NotifyListeners(bool display, bool others)
+	{
+		for (auto &listener : _onChangeListeners)
+		{
+			if (listener.second.display ? display : others)
+				listener.second.function(_value);
+		}
+	}
+
+	// Holds on to the value before the batch
+	struct DeferredChange : public NotificationBatch::Change
+	{
+		T before;
+
+		DeferredChange(JSMVariable *variable, const T &valueBefore)
+		  : Change(variable)
+		  , before(valueBefore)
+		{
+		}
+
+		virtual void Notify() override
+		{
+			auto changed = static_cast<JSMVariable *>(variable);
+			if (changed->_value != before)
+			{
+				changed->NotifyListeners(true, false);
+			}
+		}
+	};
+
 public:
 	// Default value of the variable. Cannot be changed after construction.
 	const T _defVal;
@@ -62,6 +187,7 @@ public:
 
 	virtual ~JSMVariable()
 	{
+		NotificationBatch::Cancel(this);
 		_onChangeListeners.clear();
 	}
 
@@ -77,14 +203,21 @@ public:
 	// Remember to call this listener when the value changes.
 	virtual unsigned int AddOnChangeListener(OnChangeDelegate listener, bool callListener = false)
 	{
-		_onChangeListeners[_delegateID] = listener;
+		_onChangeListeners[_delegateID] = { listener, false };
 		if (callListener)
 		{
-			_onChangeListeners[_delegateID](_value);
+			listener(_value);
 		}
 		return _delegateID++;
 	}
 
+	// Same for a listener that only displays the new value
+	virtual unsigned int AddDisplayListener(OnChangeDelegate listener)
+	{
+		_onChangeListeners[_delegateID] = { listener, true };
+		return _delegateID++;
+	}
+
 	// Remove the listener from list
 	virtual bool RemoveOnChangeListener(unsigned int id)
 	{
@@ -126,14 +259,113 @@ public:
 		_value = _filter(oldValue, newValue); // Pass new value through filtering
 		if (_value != oldValue)
 		{
+			++_variablesVersion;
 			// Notify listeners of the change if there's a change
-			for (auto listener : _onChangeListeners)
-				listener.second(_value);
+			if (!NotificationBatch::IsActive())
+			{
+				NotifyListeners(true, true);
+			}
+			else
+			{
+				if (!NotificationBatch::IsDeferred(this))
+					NotificationBatch::Defer(make_unique<DeferredChange>(this, oldValue));
+				NotifyListeners(false, true);
+			}
 		}
 		return _value; // Return actual value assign. Can be different from newValue because of filtering.
 	}
 };
 
+// Variables keyed by the ButtonID of a chord or a sim press, stored at the index of the button. The storage is
+// allocated along with the first variable, and lookups of absent buttons only test the presence bits.
+template<typename T>
+class ButtonVariableMap
+{
+public:
+	using Entry = pair<const ButtonID, JSMVariable<T>>;
+
+	// Every button from the first one to the last touch button
+	static constexpr size_t SIZE = size_t(ButtonID::T25) + 1;
+
+	bool contains(ButtonID id) const
+	{
+		return id > ButtonID::NONE && size_t(id) < SIZE && _present.test(size_t(id));
+	}
+
+	Entry *find(ButtonID id)
+	{
+		return contains(id) ? &*_entries[size_t(id)] : nullptr;
+	}
+
+	const Entry *find(ButtonID id) const
+	{
+		return contains(id) ? &*_entries[size_t(id)] : nullptr;
+	}
+
+	// The ID must be a button. Constructs the variable in place with the given arguments.
+	template<typename... Args>
+	Entry &emplace(ButtonID id, Args &&...args)
+	{
+		if (_entries.empty())
+		{
+			_entries.resize(SIZE);
+		}
+		_entries[size_t(id)].emplace(piecewise_construct, forward_as_tuple(id), forward_as_tuple(std::forward<Args>(args)...));
+		_present.set(size_t(id));
+		return *_entries[size_t(id)];
+	}
+
+	bool erase(ButtonID id)
+	{
+		if (!contains(id))
+		{
+			return false;
+		}
+		_entries[size_t(id)].reset();
+		_present.reset(size_t(id));
+		return true;
+	}
+
+	void clear()
+	{
+		_entries.clear();
+		_present.reset();
+	}
+
+	bool empty() const
+	{
+		return _present.none();
+	}
+
+	template<typename F>
+	void forEach(F function)
+	{
+		for (size_t i = 0; i < _entries.size(); ++i)
+		{
+			if (_present.test(i))
+			{
+				function(*_entries[i]);
+			}
+		}
+	}
+
+	template<typename F>
+	void forEach(F function) const
+	{
+		for (size_t i = 0; i < _entries.size(); ++i)
+		{
+			if (_present.test(i))
+			{
+				function(*_entries[i]);
+			}
+		}
+	}
+
+private:
+	vector<optional<Entry>> _entries;
+	bitset<SIZE> _present;
+};
+
 // A chorded variable alternate values depending on buttons enabling the chorded value
 template<typename T>
 class ChordedVariable : public JSMVariable<T>
@@ -142,7 +374,7 @@ class ChordedVariable : public JSMVariable<T>
 
 protected:
 	// Each chord is a separate variable with its own listeners, but will use the same filtering and parsing.
-	map<ButtonID, JSMVariable<T>> _chordedVariables;
+	ButtonVariableMap<T> _chordedVariables;
 
 public:
 	ChordedVariable(T defval)
@@ -155,29 +387,39 @@ public:
 	JSMVariable<T> *AtChord(ButtonID chord)
 	{
 		auto existingChord = _chordedVariables.find(chord);
-		if (existingChord == _chordedVariables.end())
+		if (!existingChord)
 		{
 			// Create the chord when requested, using the copy constructor.
-			_chordedVariables.emplace(chord, JSMVariable<T>(*this, Base::_defVal));
+			existingChord = &_chordedVariables.emplace(chord, *this, Base::_defVal);
+			++_variablesVersion;
 		}
-		return &_chordedVariables[chord];
+		return &existingChord->second;
 	}
 
 	const JSMVariable<T> *AtChord(ButtonID chord) const
 	{
 		auto existingChord = _chordedVariables.find(chord);
-		return existingChord != _chordedVariables.end() ? &existingChord->second : nullptr;
+		return existingChord ? &existingChord->second : nullptr;
 	}
 
-	// Obtain the value with provided chord if any.
-	optional<T> get(ButtonID chord = ButtonID::NONE) const
+	// Obtain the value with provided chord if any, without copying it
+	const T *get(ButtonID chord = ButtonID::NONE) const
 	{
 		if (chord > ButtonID::NONE)
 		{
 			auto existingChord = _chordedVariables.find(chord);
-			return existingChord != _chordedVariables.end() ? optional<T>(T(existingChord->second)) : nullopt;
+			return existingChord ? &existingChord->second.get() : nullptr;
 		}
-		return chord != ButtonID::INVALID ? optional(Base::_value) : nullopt;
+		return chord != ButtonID::INVALID ? &this->_value : nullptr;
+	}
+
+	// Call the function with the ButtonID and value of every chord
+	template<typename F>
+	void forEachChord(F function) const
+	{
+		_chordedVariables.forEach([&function](const auto &entry) {
+			function(entry.first, entry.second.get());
+		});
 	}
 
 	// Resetting a chorded var always clears all chords.
@@ -185,6 +427,7 @@ public:
 	{
 		JSMVariable<T>::Reset();
 		_chordedVariables.clear();
+		++_variablesVersion;
 		return this;
 	}
 };
@@ -223,11 +466,10 @@ public:
 	{
 		if (_chordToRemove == modeshift)
 		{
-			auto modeshiftVar = Base::_chordedVariables.find(modeshift);
-			if (modeshiftVar != Base::_chordedVariables.end())
+			if (Base::_chordedVariables.erase(modeshift))
 			{
-				Base::_chordedVariables.erase(modeshiftVar);
 				_chordToRemove = ButtonID::NONE;
+				++_variablesVersion;
 			}
 		}
 	}
@@ -244,10 +486,10 @@ public:
 	const ButtonID _id;
 
 protected:
-	map<ButtonID, JSMVariable<Mapping>> _simMappings;
+	ButtonVariableMap<Mapping> _simMappings;
 
-	// Store listener IDs for its sim presses. This is required for Cross updates
-	map<ButtonID, unsigned int> _simListeners;
+	// Store listener IDs for its sim presses, by ButtonID. This is required for Cross updates
+	array<unsigned int, ButtonVariableMap<Mapping>::SIZE> _simListeners;
 
 public:
 	JSMButton(ButtonID id, Mapping def)
@@ -260,28 +502,37 @@ public:
 
 	virtual ~JSMButton()
 	{
-		for (auto id : _simListeners)
-		{
-			_simMappings[id.first].RemoveOnChangeListener(id.second);
-		}
+		RemoveSimListeners();
 	}
 
 	// Obtain the Variable for a sim press if any.
 	const ComboMap *getSimMap(ButtonID simBtn) const
 	{
-		if (simBtn > ButtonID::NONE)
-		{
-			auto existingSim = _simMappings.find(simBtn);
-			return existingSim != _simMappings.cend() ? &*existingSim : nullptr;
-		}
-		return nullptr;
+		return _simMappings.find(simBtn);
 	}
 
 	// Double Press mappings are stored in the chorded variables
 	const ComboMap *getDblPressMap() const
 	{
-		auto existingChord = _chordedVariables.find(_id);
-		return existingChord != _chordedVariables.end() ? &*existingChord : nullptr;
+		return _chordedVariables.find(_id);
+	}
+
+	// Call the function with the ButtonID of the other button and the mapping of every sim press
+	template<typename F>
+	void forEachSimPress(F function) const
+	{
+		_simMappings.forEach([&function](const ComboMap &entry) {
+			function(entry.first, entry.second.get());
+		});
+	}
+
+	// Call the function with the base mapping, then the ButtonID and mapping of every chord and sim press
+	template<typename F>
+	void forEachMapping(F function) const
+	{
+		function(ButtonID::NONE, _value);
+		forEachChord(function);
+		forEachSimPress(function);
 	}
 
 	// Indicate whether any sim press mappings are present
@@ -297,49 +548,56 @@ public:
 		return JSMVariable<Mapping>::operator=(baseValue);
 	}
 
-	// Returns the display name of the chorded press if provided, or itself
-	string getName(ButtonID chord = ButtonID::NONE) const
+	// Returns the display name of the chorded press of the button if provided, or the button itself
+	static string GetName(ButtonID id, ButtonID chord = ButtonID::NONE)
 	{
 		stringstream ss;
 		if (chord > ButtonID::NONE)
 		{
-			ss << chord << ',' << _id;
+			ss << chord << ',' << id;
 			return ss.str();
 		}
 		else if (chord != ButtonID::INVALID)
 		{
-			ss << _id;
+			ss << id;
 			return ss.str();
 		}
 		else
 			return string();
 	}
 
-	// Returns the sim press name of itself with simBtn.
-	string getSimPressName(ButtonID simBtn) const
+	string getName(ButtonID chord = ButtonID::NONE) const
+	{
+		return GetName(_id, chord);
+	}
+
+	// Returns the sim press name of the button with simBtn.
+	static string GetSimPressName(ButtonID id, ButtonID simBtn)
 	{
-		if (simBtn == _id)
+		if (simBtn == id)
 		{
 			// It's actually a double press, not a sim press
-			return getName(simBtn);
+			return GetName(id, simBtn);
 		}
 		if (simBtn > ButtonID::NONE)
 		{
 			stringstream ss;
-			ss << simBtn << '+' << _id;
+			ss << simBtn << '+' << id;
 			return ss.str();
 		}
 		return string();
 	}
 
+	string getSimPressName(ButtonID simBtn) const
+	{
+		return GetSimPressName(_id, simBtn);
+	}
+
 	// Resetting a button also clears all assigned sim presses
 	virtual JSMButton *Reset() override
 	{
 		ChordedVariable<Mapping>::Reset();
-		for (auto id : _simListeners)
-		{
-			_simMappings[id.first].RemoveOnChangeListener(id.second);
-		}
+		RemoveSimListeners();
 		_simMappings.clear();
 		return this;
 	}
@@ -349,15 +607,14 @@ public:
 	// to be updated when this value changes.
 	JSMVariable<Mapping> *AtSimPress(ButtonID chord)
 	{
-		auto existingSim = getSimMap(chord);
+		auto existingSim = _simMappings.find(chord);
 		if (!existingSim)
 		{
-			JSMVariable<Mapping> var(*this, Mapping());
-			_simMappings.emplace(chord, var);
-			_simListeners[chord] = _simMappings[chord].AddOnChangeListener(
+			existingSim = &_simMappings.emplace(chord, *this, Mapping());
+			_simListeners[size_t(chord)] = existingSim->second.AddOnChangeListener(
 			  bind(&SimPressCrossUpdate, chord, _id, placeholders::_1));
 		}
-		return &_simMappings[chord];
+		return &existingSim->second;
 	}
 
 	const JSMVariable<Mapping> *AtSimPress(ButtonID chord) const
@@ -370,11 +627,7 @@ public:
 	{
 		if (value && value->get() == Mapping::NO_MAPPING)
 		{
-			auto chordVar = _chordedVariables.find(chord);
-			if (chordVar != _chordedVariables.end())
-			{
-				_chordedVariables.erase(chordVar);
-			}
+			_chordedVariables.erase(chord);
 		}
 	}
 
@@ -382,11 +635,64 @@ public:
 	{
 		if (value && value->get() == Mapping::NO_MAPPING)
 		{
-			auto chordVar = _simMappings.find(chord);
-			if (chordVar != _simMappings.end())
-			{
-				_simMappings.erase(chordVar);
-			}
+			_simMappings.erase(chord);
 		}
 	}
+
+private:
+	void RemoveSimListeners()
+	{
+		_simMappings.forEach([this](ComboMap &sim) {
+			sim.second.RemoveOnChangeListener(_simListeners[size_t(sim.first)]);
+		});
+	}
+};
+
+// An immutable copy of the mappings of a button. The poll thread reads these from the settings snapshot rather than
+// the JSMButton, which commands change at any time.
+struct ButtonMappings
+{
+	ButtonID id = ButtonID::INVALID;
+	// The base mapping first, under NONE. The double press is under the button itself.
+	vector<pair<ButtonID, Mapping>> chords;
+	// By the other button
+	vector<pair<ButtonID, Mapping>> simPresses;
+
+	// No mapping at all
+	ButtonMappings() = default;
+
+	explicit ButtonMappings(const JSMButton &button)
+	  : id(button._id)
+	{
+		chords.emplace_back(ButtonID::NONE, *button.get());
+		button.forEachChord([this](ButtonID chord, const Mapping &mapping) { chords.emplace_back(chord, mapping); });
+		button.forEachSimPress([this](ButtonID simBtn, const Mapping &mapping) { simPresses.emplace_back(simBtn, mapping); });
+	}
+
+	const Mapping *get(ButtonID chord = ButtonID::NONE) const
+	{
+		return Find(chords, chord);
+	}
+
+	const Mapping *getDblPress() const
+	{
+		return get(id);
+	}
+
+	const Mapping *getSimPress(ButtonID simBtn) const
+	{
+		return Find(simPresses, simBtn);
+	}
+
+	bool HasSimMappings() const
+	{
+		return !simPresses.empty();
+	}
+
+private:
+	static const Mapping *Find(const vector<pair<ButtonID, Mapping>> &mappings, ButtonID id)
+	{
+		auto found = find_if(mappings.begin(), mappings.end(), [id](const auto &mapping) { return mapping.first == id; });
+		return found != mappings.end() ? &found->second : nullptr;
+	}
 };
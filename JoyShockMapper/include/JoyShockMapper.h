@@ -283,11 +283,13 @@ enum class SettingID
 	RIGHT_STICK_VIRTUAL_SCALE,
 	GYRO_OUTPUT,
 	FLICK_STICK_OUTPUT,
+	GYRO_SMOOTH_MODE,
 };
 
 // constexpr are like #define but with respect to typeness
 constexpr size_t MAX_NO_OF_TOUCH = 2; // Could be obtained from JSL?
 constexpr int MAPPING_SIZE = int(ButtonID::SIZE);
+constexpr size_t NUM_SETTINGS = magic_enum::enum_count<SettingID>();
 constexpr int FIRST_ANALOG_TRIGGER = int(ButtonID::ZLF);
 constexpr int LAST_ANALOG_TRIGGER = int(ButtonID::ZRF);
 constexpr int FIRST_TOUCH_BUTTON = MAPPING_SIZE + 1;
@@ -306,6 +308,12 @@ enum class GyroSpace
 	WORLD_LEAN,
 	INVALID
 };
+enum class SmoothingMode
+{
+	WINDOW,
+	EXPONENTIAL,
+	INVALID
+};
 enum class ControllerOrientation
 {
 	FORWARD,
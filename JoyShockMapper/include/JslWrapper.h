@@ -183,6 +183,29 @@ typedef struct TOUCH_STATE
 
 #endif
 
+// A single gyro and accelerometer reading as reported by the device, with the time elapsed since the
+// previous reading. deltaTime is 0 when the backend can't tell. IMU_STATE comes from JoyShockLibrary
+// and can't carry the timestamp itself.
+struct ImuSample
+{
+	IMU_STATE imu;
+	float deltaTime = 0.f;
+	uint64_t timestamp = 0; // in microseconds, 0 when unknown
+};
+
+// Everything the mapper reads from a device in one tick, filled by a single GetFrame call
+struct DeviceFrame
+{
+	JOY_SHOCK_STATE state; // buttons, triggers and sticks
+	IMU_STATE imu;
+	TOUCH_STATE touch;
+	int touchpadSizeX = 0;
+	int touchpadSizeY = 0;
+	int controllerType = 0;
+	int splitType = 0;
+	uint64_t timestamp = 0; // of the IMU reading, in microseconds. 0 when unknown
+};
+
 class JslWrapper
 {
 protected:
@@ -231,6 +254,12 @@ public:
 	virtual void SetCalibrationOffset(int deviceId, float xOffset, float yOffset, float zOffset) = 0;
 	virtual void SetCallback(void (*callback)(int, JOY_SHOCK_STATE, JOY_SHOCK_STATE, IMU_STATE, IMU_STATE, float)) = 0;
 	virtual void SetTouchCallback(void (*callback)(int, TOUCH_STATE, TOUCH_STATE, float)) = 0;
+	// Called with the handle of a device plugged in or unplugged after GetConnectedDeviceHandles. Backends that can't
+	// detect it leave the device list alone until the next ConnectDevices.
+	virtual void SetConnectionCallback(void (*callback)(int deviceId, bool isConnected)) { }
+	// Called after processing a device to know whether it has states that progress with time alone. Backends that
+	// skip devices without new input must still process those.
+	virtual void SetBusyCallback(bool (*callback)(int deviceId)) { }
 	virtual int GetControllerType(int deviceId) = 0;
 	virtual int GetControllerSplitType(int deviceId) = 0;
 	virtual int GetControllerColour(int deviceId) = 0;
@@ -239,4 +268,28 @@ public:
 	virtual void SetPlayerNumber(int deviceId, int number) = 0;
 	virtual void SetTriggerEffect(int deviceId, const AdaptiveTriggerSetting &_leftTriggerEffect, const AdaptiveTriggerSetting &_rightTriggerEffect) { };
 	virtual void SetMicLight(int deviceId, unsigned char mode) { }
+	// Pop the sensor samples received since the last call, oldest first. Returns the number of samples
+	// written. Backends that only expose the latest IMU state return 0.
+	virtual int GetIMUSamples(int deviceId, ImuSample *samples, int maxSamples) { return 0; }
+	// When true, the deltaTime given to the callbacks is the time to simulate rather than the polling period
+	virtual bool HasSimulatedTime() { return false; }
+	// Backends should override this to read the device once instead of going through every getter
+	virtual void GetFrame(int deviceId, DeviceFrame &frame)
+	{
+		frame.state.buttons = GetButtons(deviceId);
+		frame.state.lTrigger = GetLeftTrigger(deviceId);
+		frame.state.rTrigger = GetRightTrigger(deviceId);
+		frame.state.stickLX = GetLeftX(deviceId);
+		frame.state.stickLY = GetLeftY(deviceId);
+		frame.state.stickRX = GetRightX(deviceId);
+		frame.state.stickRY = GetRightY(deviceId);
+		frame.imu = GetIMUState(deviceId);
+		frame.touch = GetTouchState(deviceId);
+		if (!GetTouchpadDimension(deviceId, frame.touchpadSizeX, frame.touchpadSizeY))
+		{
+			frame.touchpadSizeX = frame.touchpadSizeY = 0;
+		}
+		frame.controllerType = GetControllerType(deviceId);
+		frame.splitType = GetControllerSplitType(deviceId);
+	}
 };
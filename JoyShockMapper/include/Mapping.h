@@ -57,6 +57,7 @@ private:
 	map<BtnEvent, EventActionIf::Callback> _eventMapping;
 	float _tapDurationMs = MAGIC_TAP_DURATION;
 	bool _hasViGEmBtn = false;
+	bool _hasGyroOnBind = false;
 
 	void InsertEventMapping(BtnEvent evt, EventActionIf::Callback action);
 	static void RunBothActions(EventActionIf *btn, EventActionIf::Callback action1, EventActionIf::Callback action2);
@@ -91,12 +92,19 @@ public:
 		_description.clear();
 		_tapDurationMs = MAGIC_TAP_DURATION;
 		_hasViGEmBtn = false;
+		_hasGyroOnBind = false;
 	}
 
 	inline bool hasViGEmBtn() const
 	{
 		return _hasViGEmBtn;
 	}
+
+	// Whether the mapping can enable the gyro even though the gyro settings keep it off
+	inline bool hasGyroOnBind() const
+	{
+		return _hasGyroOnBind;
+	}
 };
 
 istream &operator>>(istream &in, Mapping &mapping);
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "JslWrapper.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Decoding and encoding of the HID reports of the DualShock 4 and the DualSense, over USB and Bluetooth.
+// These only work on byte buffers, the backends do the I/O. Report layouts are described by the tables
+// in PlayStationReports.cpp rather than by code, so supporting a variant is a matter of adding a row.
+namespace PlayStationReports
+{
+	static constexpr uint16_t SONY_VENDOR_ID = 0x054C;
+
+	// Nominal sensitivity of the motion sensors
+	static constexpr float GYRO_SCALE = 1.f / 16.f;    // to degrees per second
+	static constexpr float ACCEL_SCALE = 1.f / 8192.f; // to Gs
+
+	enum class Bus
+	{
+		USB,
+		BLUETOOTH,
+	};
+
+	enum Axis : uint8_t
+	{
+		STICK_LX,
+		STICK_LY,
+		STICK_RX,
+		STICK_RY,
+		TRIGGER_L,
+		TRIGGER_R,
+		GYRO_X,
+		GYRO_Y,
+		GYRO_Z,
+		ACCEL_X,
+		ACCEL_Y,
+		ACCEL_Z,
+		AXIS_COUNT,
+	};
+
+	enum class Encoding : uint8_t
+	{
+		U8,          // 0 to 255
+		U8_CENTERED, // 0 to 255 around 128
+		S16,         // little endian
+	};
+
+	// Offsets are from the start of the part of the report shared by USB and Bluetooth
+	struct AxisField
+	{
+		Axis axis;
+		Encoding encoding;
+		uint8_t offset;
+		float scale;
+	};
+
+	struct ButtonField
+	{
+		uint8_t offset;
+		uint8_t mask;
+		uint8_t jsOffset;
+	};
+
+	struct InputLayout
+	{
+		int controllerType;
+		Bus bus;
+		uint8_t reportId;
+		uint8_t size; // including the report id
+		uint8_t base; // where the shared part starts
+		bool checksum; // Bluetooth reports end with a CRC32
+		std::vector<AxisField> axes;
+		std::vector<ButtonField> buttons;
+		uint8_t hat; // of the d-pad, in the low nibble
+		uint8_t timestamp;
+		uint8_t timestampBytes;
+		float timestampUnit; // microseconds per tick of the sensor clock
+		uint8_t touch; // two points of 4 bytes
+		float touchpadSizeY; // in touchpad units. The width is 1920 on both controllers
+	};
+
+	// Bias and sensitivity of each motion axis, from GYRO_X to ACCEL_Z, in raw units. The default is the nominal
+	// sensitivity of the sensors, without bias.
+	struct ImuCalibration
+	{
+		float bias[6] = {};
+		float scale[6] = { GYRO_SCALE, GYRO_SCALE, GYRO_SCALE, ACCEL_SCALE, ACCEL_SCALE, ACCEL_SCALE };
+	};
+
+	// Everything an input report carries
+	struct InputReport
+	{
+		JOY_SHOCK_STATE state;
+		IMU_STATE imu;
+		TOUCH_STATE touch;
+		uint32_t sensorTimestamp; // in ticks of the sensor clock
+	};
+
+	// Everything JSM writes to a controller
+	struct Output
+	{
+		uint8_t smallRumble = 0;
+		uint8_t bigRumble = 0;
+		bool hasLightColour = false;
+		uint32_t lightColour = 0;
+		int playerNumber = 0;
+		uint8_t micLight = 0;
+		AdaptiveTriggerSetting leftTriggerEffect;
+		AdaptiveTriggerSetting rightTriggerEffect;
+
+		bool operator==(const Output &rhs) const;
+		bool operator!=(const Output &rhs) const
+		{
+			return !(*this == rhs);
+		}
+	};
+
+	// The JS_TYPE of a product, 0 if it's not a supported controller
+	int GetControllerType(uint16_t vendorId, uint16_t productId);
+
+	// The input report layout of a controller on a bus, null if there's none
+	const InputLayout *FindInputLayout(int controllerType, Bus bus);
+
+	// Decode an input report. Returns false if the data is not a whole report of that layout. The motion is
+	// corrected with the calibration if there's one.
+	bool ParseInputReport(const InputLayout &layout, const uint8_t *data, size_t size, InputReport &report, const ImuCalibration *calibration = nullptr);
+
+	// The feature report holding the motion calibration of a controller, to read into a buffer of
+	// CALIBRATION_REPORT_SIZE bytes starting with that id
+	static constexpr size_t CALIBRATION_REPORT_SIZE = 41;
+	uint8_t CalibrationReportId(int controllerType, Bus bus);
+
+	// Decode the calibration feature report. Returns false if it's missing, corrupted or implausible, in which
+	// case the nominal sensitivity is the best guess.
+	bool ParseCalibration(int controllerType, Bus bus, const uint8_t *data, size_t size, ImuCalibration &calibration);
+
+	// Microseconds between two readings of the sensor clock, which wraps around
+	uint64_t TimestampDelta(const InputLayout &layout, uint32_t from, uint32_t to);
+
+	// Encode an output report into buffer, which must hold MAX_OUTPUT_SIZE bytes. The sequence number
+	// is only used by some Bluetooth reports. Returns the report size, 0 if the controller takes none.
+	static constexpr size_t MAX_OUTPUT_SIZE = 78;
+	size_t BuildOutputReport(int controllerType, Bus bus, const Output &output, uint8_t sequence, uint8_t *buffer);
+
+	// Fill the 11 bytes of a DualSense trigger effect
+	void WriteTriggerEffect(uint8_t *effect, const AdaptiveTriggerSetting &setting);
+
+	// The checksum of Bluetooth reports. The seed is the HID transaction header: 0xA1 for input, 0xA2 for output,
+	// 0xA3 for feature reports.
+	uint32_t BluetoothCrc(uint8_t seed, const uint8_t *data, size_t size);
+}
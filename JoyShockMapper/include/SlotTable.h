@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+// Fixed capacity table of shared objects indexed by handle. A handle packs the index of its slot with
+// the generation of that slot, which changes whenever the slot is emptied. A stale handle is therefore
+// rejected rather than reaching whatever took its place. Lookups never insert and can run concurrently
+// with insertions and removals, which never move the other entries.
+template<typename T, int INDEX_BITS = 6>
+class SlotTable
+{
+public:
+	static constexpr int CAPACITY = 1 << INDEX_BITS;
+	static constexpr int INVALID_HANDLE = -1;
+
+	using value_type = std::pair<int, std::shared_ptr<T>>;
+
+	class const_iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = SlotTable::value_type;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const value_type *;
+		using reference = const value_type &;
+
+		const_iterator(const SlotTable *table, int index)
+		  : _table(table)
+		  , _index(index)
+		{
+			SkipEmpty();
+		}
+
+		reference operator*() const
+		{
+			return _current;
+		}
+
+		pointer operator->() const
+		{
+			return &_current;
+		}
+
+		const_iterator &operator++()
+		{
+			++_index;
+			SkipEmpty();
+			return *this;
+		}
+
+		const_iterator operator++(int)
+		{
+			auto copy = *this;
+			++*this;
+			return copy;
+		}
+
+		bool operator==(const const_iterator &rhs) const
+		{
+			return _table == rhs._table && _index == rhs._index;
+		}
+
+		bool operator!=(const const_iterator &rhs) const
+		{
+			return !(*this == rhs);
+		}
+
+	private:
+		void SkipEmpty()
+		{
+			for (; _index < CAPACITY; ++_index)
+			{
+				const Slot &slot = _table->_slots[_index];
+				_current.first = MakeHandle(_index, slot.generation);
+				_current.second = std::atomic_load(&slot.value);
+				if (_current.second)
+					return;
+			}
+			_current = value_type{ INVALID_HANDLE, nullptr };
+		}
+
+		const SlotTable *_table;
+		int _index;
+		value_type _current;
+	};
+
+	// Store the value in a free slot and return its handle, or INVALID_HANDLE if the table is full
+	int Insert(std::shared_ptr<T> value)
+	{
+		std::lock_guard guard(_writeLock);
+		for (int index = 0; index < CAPACITY; ++index)
+		{
+			Slot &slot = _slots[index];
+			if (!std::atomic_load(&slot.value))
+			{
+				uint32_t generation = (slot.generation + 1) & GENERATION_MASK;
+				slot.generation = generation;
+				std::atomic_store(&slot.value, std::move(value));
+				++_size;
+				return MakeHandle(index, generation);
+			}
+		}
+		return INVALID_HANDLE;
+	}
+
+	// Store the value under a handle given by someone else. Fails if its slot is taken.
+	bool InsertAt(int handle, std::shared_ptr<T> value)
+	{
+		if (handle < 0)
+			return false;
+		std::lock_guard guard(_writeLock);
+		Slot &slot = _slots[handle & INDEX_MASK];
+		if (std::atomic_load(&slot.value))
+			return false;
+		slot.generation = uint32_t(handle) >> INDEX_BITS;
+		std::atomic_store(&slot.value, std::move(value));
+		++_size;
+		return true;
+	}
+
+	bool Remove(int handle)
+	{
+		if (handle < 0)
+			return false;
+		std::lock_guard guard(_writeLock);
+		Slot &slot = _slots[handle & INDEX_MASK];
+		if (slot.generation != uint32_t(handle) >> INDEX_BITS || !std::atomic_load(&slot.value))
+			return false;
+		// Bump the generation first so that readers reject the handle before the value goes away
+		slot.generation = (slot.generation + 1) & GENERATION_MASK;
+		std::atomic_store(&slot.value, std::shared_ptr<T>());
+		--_size;
+		return true;
+	}
+
+	void Clear()
+	{
+		std::lock_guard guard(_writeLock);
+		for (Slot &slot : _slots)
+		{
+			if (std::atomic_load(&slot.value))
+			{
+				slot.generation = (slot.generation + 1) & GENERATION_MASK;
+				std::atomic_store(&slot.value, std::shared_ptr<T>());
+			}
+		}
+		_size = 0;
+	}
+
+	// Returns null for unknown or stale handles
+	std::shared_ptr<T> Get(int handle) const
+	{
+		if (handle < 0)
+			return nullptr;
+		const Slot &slot = _slots[handle & INDEX_MASK];
+		uint32_t generation = uint32_t(handle) >> INDEX_BITS;
+		if (slot.generation != generation)
+			return nullptr;
+		auto value = std::atomic_load(&slot.value);
+		// The slot could have been emptied and reused in between
+		return slot.generation == generation ? value : nullptr;
+	}
+
+	size_t size() const
+	{
+		return _size;
+	}
+
+	bool empty() const
+	{
+		return _size == 0;
+	}
+
+	const_iterator begin() const
+	{
+		return const_iterator(this, 0);
+	}
+
+	const_iterator end() const
+	{
+		return const_iterator(this, CAPACITY);
+	}
+
+private:
+	static constexpr int INDEX_MASK = CAPACITY - 1;
+	// Keep handles positive
+	static constexpr uint32_t GENERATION_MASK = (1u << (31 - INDEX_BITS)) - 1;
+
+	struct Slot
+	{
+		std::atomic<uint32_t> generation = 0;
+		std::shared_ptr<T> value;
+	};
+
+	static int MakeHandle(int index, uint32_t generation)
+	{
+		return int(generation << INDEX_BITS) | index;
+	}
+
+	std::array<Slot, CAPACITY> _slots;
+	std::mutex _writeLock;
+	std::atomic<size_t> _size = 0;
+};
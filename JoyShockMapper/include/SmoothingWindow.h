@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+// Average of the latest samples of a signal with CHANNELS components, over a window of up to CAPACITY samples.
+// The sum of the samples in the window is kept as they come and go, so a sample costs the same whatever the
+// window length. The window can change length from one sample to the next: the samples it gains or loses are
+// still in the buffer and are added to or removed from the sum.
+template<std::size_t CHANNELS, std::size_t CAPACITY>
+class SmoothingWindow
+{
+public:
+	using Sample = std::array<float, CHANNELS>;
+
+	SmoothingWindow()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		_samples.fill(Sample{});
+		_sum.fill(0.0);
+		_newest = 0;
+		_window = 1;
+	}
+
+	// Add the sample and return the average of the window of the given length that ends with it
+	Sample Push(const Sample &sample, int window)
+	{
+		Resize(std::clamp<std::size_t>(std::size_t(std::max(window, 1)), 1, CAPACITY));
+		_newest = _newest + 1 < CAPACITY ? _newest + 1 : 0;
+		// The oldest sample of the window leaves it. When the window spans the whole buffer, it's the one overwritten.
+		Subtract(_samples[Index(_window)]);
+		_samples[_newest] = sample;
+		Add(sample);
+		if (_newest == 0)
+		{
+			// Rounding errors would pile up in the running sum otherwise
+			Resync();
+		}
+		Sample average;
+		for (std::size_t c = 0; c < CHANNELS; ++c)
+		{
+			average[c] = float(_sum[c] / _window);
+		}
+		return average;
+	}
+
+private:
+	// Index of the sample that came age samples before the newest one
+	std::size_t Index(std::size_t age) const
+	{
+		return _newest >= age ? _newest - age : _newest + CAPACITY - age;
+	}
+
+	void Resize(std::size_t window)
+	{
+		for (; _window < window; ++_window)
+		{
+			Add(_samples[Index(_window)]);
+		}
+		for (; _window > window; --_window)
+		{
+			Subtract(_samples[Index(_window - 1)]);
+		}
+	}
+
+	void Resync()
+	{
+		_sum.fill(0.0);
+		for (std::size_t age = 0; age < _window; ++age)
+		{
+			Add(_samples[Index(age)]);
+		}
+	}
+
+	void Add(const Sample &sample)
+	{
+		for (std::size_t c = 0; c < CHANNELS; ++c)
+		{
+			_sum[c] += sample[c];
+		}
+	}
+
+	void Subtract(const Sample &sample)
+	{
+		for (std::size_t c = 0; c < CHANNELS; ++c)
+		{
+			_sum[c] -= sample[c];
+		}
+	}
+
+	std::array<Sample, CAPACITY> _samples;
+	std::array<double, CHANNELS> _sum; // Of the _window latest samples
+	std::size_t _newest;
+	std::size_t _window;
+};
+
+// Exponential moving average of a signal with CHANNELS components. It lags as much as a SmoothingWindow of the
+// same length on a steady signal, but it needs no buffer and old samples fade out rather than drop out at once.
+template<std::size_t CHANNELS>
+class ExponentialSmoothing
+{
+public:
+	using Sample = std::array<float, CHANNELS>;
+
+	void Reset()
+	{
+		_average.fill(0.f);
+	}
+
+	Sample Push(const Sample &sample, int window)
+	{
+		float weight = 2.f / (std::max(window, 1) + 1);
+		for (std::size_t c = 0; c < CHANNELS; ++c)
+		{
+			_average[c] += (sample[c] - _average[c]) * weight;
+		}
+		return _average;
+	}
+
+private:
+	Sample _average{};
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Holds the current version of an immutable object shared with reader threads, RCU style. Readers never block
+// nor take a lock: they pin the version they read until their guard goes away. Publishing a new version swaps
+// the pointer, then waits for the readers that may still see the previous version before deleting it. Readers
+// are meant to hold on to a version briefly, so that wait is short, and it only ever delays the writer.
+template<typename T>
+class SnapshotPointer
+{
+public:
+	class ReadGuard
+	{
+	public:
+		ReadGuard(const T *snapshot, std::atomic<int> &readers)
+		  : _snapshot(snapshot)
+		  , _readers(&readers)
+		{
+		}
+
+		ReadGuard(const ReadGuard &) = delete;
+		ReadGuard &operator=(const ReadGuard &) = delete;
+
+		~ReadGuard()
+		{
+			--*_readers;
+		}
+
+		// Null until the first version is published
+		const T *get() const
+		{
+			return _snapshot;
+		}
+
+		const T *operator->() const
+		{
+			return _snapshot;
+		}
+
+		const T &operator*() const
+		{
+			return *_snapshot;
+		}
+
+		explicit operator bool() const
+		{
+			return _snapshot != nullptr;
+		}
+
+	private:
+		const T *_snapshot;
+		std::atomic<int> *_readers;
+	};
+
+	SnapshotPointer() = default;
+	SnapshotPointer(const SnapshotPointer &) = delete;
+	SnapshotPointer &operator=(const SnapshotPointer &) = delete;
+
+	~SnapshotPointer()
+	{
+		delete _current.load();
+	}
+
+	ReadGuard Read() const
+	{
+		while (true)
+		{
+			unsigned int epoch = _epoch;
+			++_readers[epoch & 1];
+			if (_epoch == epoch)
+			{
+				return ReadGuard(_current, _readers[epoch & 1]);
+			}
+			// A writer moved on meanwhile, register with the new epoch
+			--_readers[epoch & 1];
+		}
+	}
+
+	void Publish(std::unique_ptr<const T> snapshot)
+	{
+		std::lock_guard guard(_writeLock);
+		const T *previous = _current.exchange(snapshot.release());
+		// New readers register with the next epoch and see the new version. Only the readers of the previous
+		// epoch can still be using the previous version.
+		unsigned int epoch = _epoch++;
+		while (_readers[epoch & 1] != 0)
+		{
+			std::this_thread::yield();
+		}
+		delete previous;
+	}
+
+private:
+	std::atomic<const T *> _current = nullptr;
+	mutable std::atomic<unsigned int> _epoch = 0;
+	mutable std::array<std::atomic<int>, 2> _readers{};
+	std::mutex _writeLock;
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "JslWrapper.h"
+
+#include <string>
+
+// A backend of virtual controllers whose input comes from generators instead of hardware, to measure the
+// mapper on machines without controllers. The spec is a comma separated list of [COUNT*]TYPE[:GENERATOR]
+// where TYPE is DS4, DS, PRO or JOYCONS (a left and right pair), and GENERATOR is one of:
+//   SINE          frequency sweeps on the sticks, triggers, gyro and touchpad (default)
+//   WALK          random walks on the same inputs
+//   BUTTONS       a scripted pattern of taps, holds and chords on every button of the controller
+//   TRACE=<file>  the first device of a RECORD_INPUT file, in a loop
+// For example: 4*DS4:WALK,JOYCONS:BUTTONS,DS:TRACE=capture.jsmt
+// Returns null and fills error if the spec is invalid.
+JslWrapper *NewSyntheticWrapper(const std::string &spec, std::string &error);
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+// Paces a polling loop on absolute deadlines so that the processing time of a tick doesn't
+// delay the next one. It also records the actual period of the recent ticks.
+class TickScheduler
+{
+public:
+	struct Stats
+	{
+		size_t numTicks = 0;
+		size_t numOverruns = 0;
+		// All in milliseconds, over the recent ticks
+		float p50Period = 0.f;
+		float p99Period = 0.f;
+		float maxPeriod = 0.f;
+		float p50Jitter = 0.f;
+		float p99Jitter = 0.f;
+		float maxJitter = 0.f;
+		// Time from the start of a tick to EndTick
+		float p50Work = 0.f;
+		float p99Work = 0.f;
+		float maxWork = 0.f;
+	};
+
+	// Block until the next deadline. The period is read on each call so it can be changed at any time.
+	void WaitNextTick(float periodMs);
+
+	// Block until the given time instead of the next period, for loops that pick their own wake times.
+	// The jitter recorded is then how late the wake up was.
+	void WaitUntil(std::chrono::steady_clock::time_point wakeTime);
+
+	// Call once the work of the tick is done to record how long it took
+	void EndTick();
+
+	// Forget the recorded statistics and restart from the next tick. Can be called from any thread.
+	void Reset();
+
+	Stats GetStats() const;
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	// Sleep until this long before the deadline, then spin the remainder
+	static constexpr std::chrono::microseconds SPIN_MARGIN{ 1000 };
+	static constexpr size_t MAX_SAMPLES = 1024;
+
+	void Record(float periodMs, float targetMs, bool overrun);
+
+	Clock::time_point _deadline;
+	Clock::time_point _lastTick;
+	std::atomic_bool _restart = true;
+
+	mutable std::mutex _statsLock;
+	std::array<float, MAX_SAMPLES> _periods;
+	std::array<float, MAX_SAMPLES> _jitters;
+	std::array<float, MAX_SAMPLES> _works;
+	size_t _numWorks = 0;
+	size_t _nextWork = 0;
+	size_t _numSamples = 0;
+	size_t _nextSample = 0;
+	size_t _numTicks = 0;
+	size_t _numOverruns = 0;
+};
+
+// Learns the period and phase of the reports of a device from the polls that found new data in them, to
+// predict when the next report will be there. Polls are aimed just after the predicted arrival. A report
+// that was already waiting pulls the phase earlier, and a poll that came too early pushes it later, so the
+// polls settle right behind the reports.
+class ReportCadence
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// Record a poll of the device, and whether it had new data
+	void Update(Clock::time_point now, bool newData);
+
+	// When to poll the device next. The fallback period is used until the report period is known, and
+	// while the device doesn't send anything, as devices that only report changes do.
+	Clock::time_point NextPoll(Clock::duration fallback) const;
+
+	// 0 until measured
+	float GetPeriodMs() const;
+
+private:
+	// How long after the predicted arrival to poll, and how often to poll again while a report is late
+	static constexpr std::chrono::microseconds MARGIN{ 250 };
+	static constexpr std::chrono::microseconds RETRY{ 250 };
+	// Weight of a new measurement in the period
+	static constexpr int SMOOTHING = 8;
+
+	Clock::time_point _lastArrival;
+	Clock::time_point _lastPoll;
+	Clock::duration _period = Clock::duration::zero();
+	bool _hasArrival = false;
+};
@@ -1,10 +1,15 @@
 #include "CmdRegistry.h"
+#include "JSMVariable.hpp"
 #include "PlatformDefinitions.h"
 
 #include <cctype>
+#include <cstdint>
+#include <filesystem>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <regex>
+#include <sstream>
 #include <string>
 #include <fstream>
 
@@ -54,12 +59,30 @@ bool JSMCommand::ParseData(in_string arguments)
 	return true; // Command is completely processed
 }
 
+bool JSMCommand::Validate(in_string arguments, any& value)
+{
+	return true;
+}
+
+bool JSMCommand::Apply(in_string arguments, const any& value)
+{
+	return ParseData(arguments);
+}
+
+void JSMCommand::StageRegistryChange(in_string arguments, const any& value, map<string, bool>& commands) const
+{
+	if (_registryChange)
+	{
+		_registryChange(arguments, value, commands);
+	}
+}
+
 CmdRegistry::CmdRegistry()
 {
 	NONAME = { 0b01001011, 0b01001111 };
 }
 
-bool CmdRegistry::loadConfigFile(string fileName)
+bool CmdRegistry::openConfigFile(string& fileName, ifstream& file)
 {
 	// https://stackoverflow.com/questions/2602013/read-whole-ascii-file-into-c-stdstring
 	auto comment = fileName.find_first_of('#');
@@ -71,25 +94,242 @@ bool CmdRegistry::loadConfigFile(string fileName)
 	if (*fileName.begin() == '\"' && *(fileName.end() - 1) == '\"')
 		fileName = fileName.substr(1, fileName.size() - 2);
 
-	ifstream file(fileName);
+	file.open(fileName);
 	if (!file.is_open())
 	{
 		file.open(std::string{ BASE_JSM_CONFIG_FOLDER() } + fileName);
+		if (file.is_open())
+		{
+			fileName = std::string{ BASE_JSM_CONFIG_FOLDER() } + fileName;
+		}
+	}
+	return bool(file);
+}
+
+// The same file can be named from different folders, or through links
+static string CanonicalPath(in_string fileName)
+{
+	error_code error;
+	auto path = filesystem::weakly_canonical(fileName, error);
+	return error ? fileName : path.string();
+}
+
+bool CmdRegistry::loadConfigFile(string fileName)
+{
+	ifstream file;
+	if (!openConfigFile(fileName, file))
+	{
+		return false;
+	}
+	COUT << "Loading commands from file ";
+	COUT_INFO << fileName << endl;
+
+	error_code error;
+	auto key = filesystem::absolute(fileName, error).string();
+	auto cached = _stagedFiles.find(key);
+	shared_ptr<const StagedFile> staged;
+	if (cached != _stagedFiles.end() && isStagedFileCurrent(*cached->second))
+	{
+		staged = cached->second;
 	}
-	if (file)
+	else
 	{
-		COUT << "Loading commands from file ";
-		COUT_INFO << fileName << endl;
-		// https://stackoverflow.com/questions/6892754/creating-a-simple-configuration-file-and-parser-in-c
-		string line;
-		while (getline(file, line))
+		auto newStaged = make_shared<StagedFile>();
+		newStaged->registryVersion = _version;
+		vector<string> including{ CanonicalPath(fileName) };
+		newStaged->sources.push_back(fileName);
+		stageConfigFile(file, fileName, *newStaged, including);
+		if (!newStaged->diagnostics.empty())
 		{
-			processLine(line);
+			for (auto& diagnostic : newStaged->diagnostics)
+			{
+				CERR << diagnostic << endl;
+			}
+			CERR << "Nothing was loaded from " << fileName << "." << endl;
+			_stagedFiles.erase(key);
+			return true;
 		}
-		file.close();
-		return true;
+		if (stampStagedFile(*newStaged))
+		{
+			_stagedFiles[key] = newStaged;
+		}
+		staged = newStaged;
 	}
-	return false;
+	file.close();
+
+	// Listeners run once per variable whose value changed, when the whole file is applied
+	NotificationBatch batch;
+	for (auto& line : staged->lines)
+	{
+		applyLine(line);
+	}
+	return true;
+}
+
+void CmdRegistry::stageConfigFile(ifstream& file, in_string fileName, StagedFile& staged, vector<string>& including)
+{
+	// https://stackoverflow.com/questions/6892754/creating-a-simple-configuration-file-and-parser-in-c
+	string line;
+	for (int lineNumber = 1; getline(file, line); ++lineNumber)
+	{
+		auto trimmedLine = std::string{ strtrim(line) };
+		if (trimmedLine.empty() || trimmedLine.front() == '#')
+		{
+			continue;
+		}
+
+		string includedName = trimmedLine;
+		ifstream included;
+		if (openConfigFile(includedName, included))
+		{
+			auto includedPath = CanonicalPath(includedName);
+			if (find(including.begin(), including.end(), includedPath) != including.end())
+			{
+				staged.diagnostics.push_back(fileName + ":" + to_string(lineNumber) + ": " + includedName + " includes itself");
+			}
+			else
+			{
+				including.push_back(includedPath);
+				staged.sources.push_back(includedName);
+				stageConfigFile(included, includedName, staged, including);
+				including.pop_back();
+			}
+			continue;
+		}
+
+		auto parsed = parseLine(trimmedLine);
+		auto error = validateLine(parsed, staged.registryChanges);
+		if (!error.empty())
+		{
+			staged.diagnostics.push_back(fileName + ":" + to_string(lineNumber) + ": " + error);
+		}
+		else if (parsed.combo.empty())
+		{
+			for (auto& lineCommand : parsed.commands)
+			{
+				lineCommand.command->StageRegistryChange(parsed.arguments, lineCommand.value, staged.registryChanges);
+			}
+		}
+		staged.lines.push_back(move(parsed));
+	}
+}
+
+// FNV-1a
+static uint64_t HashBytes(string_view bytes)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (char byte : bytes)
+	{
+		hash = (hash ^ uint8_t(byte)) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static bool ReadWholeFile(const filesystem::path& path, string& contents)
+{
+	ifstream file(path, ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+	contents.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+	return !file.bad();
+}
+
+// Modification time and content hash of a source of a profile
+static bool ReadSourceStamp(const filesystem::path& source, int64_t& modified, uint64_t& hash)
+{
+	error_code error;
+	auto writeTime = filesystem::last_write_time(source, error);
+	string contents;
+	if (error || !ReadWholeFile(source, contents))
+	{
+		return false;
+	}
+	modified = int64_t(writeTime.time_since_epoch().count());
+	hash = HashBytes(contents);
+	return true;
+}
+
+bool CmdRegistry::isStagedFileCurrent(const StagedFile& staged) const
+{
+	if (staged.registryVersion != _version)
+	{
+		return false;
+	}
+	for (auto& source : staged.stamps)
+	{
+		int64_t modified;
+		uint64_t hash;
+		if (!ReadSourceStamp(source.path, modified, hash) || modified != source.modified || hash != source.hash)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CmdRegistry::stampStagedFile(StagedFile& staged)
+{
+	for (auto& source : staged.sources)
+	{
+		StagedFile::SourceStamp stamp;
+		error_code error;
+		stamp.path = filesystem::absolute(source, error).string();
+		if (error || !ReadSourceStamp(stamp.path, stamp.modified, stamp.hash))
+		{
+			return false;
+		}
+		staged.stamps.push_back(move(stamp));
+	}
+	return true;
+}
+
+string CmdRegistry::validateLine(ParsedLine& line, const map<string, bool>& registryChanges)
+{
+	bool isValid = false;
+	line.commands.clear();
+	line.registryVersion = _version;
+	auto change = registryChanges.find(line.name);
+	if (change != registryChanges.end() && !change->second)
+	{
+		return "Unrecognized command: \"" + line.text + "\"";
+	}
+	CmdMap::iterator cmd = find_if(_registry.begin(), _registry.end(), bind(&CmdRegistry::findCommandWithName, line.name, placeholders::_1));
+	while (cmd != _registry.end())
+	{
+		any value;
+		isValid |= cmd->second->Validate(line.arguments, value);
+		line.commands.push_back({ cmd->second.get(), move(value) });
+		cmd = find_if(++cmd, _registry.end(), bind(&CmdRegistry::findCommandWithName, line.name, placeholders::_1));
+	}
+	if (line.commands.empty() && change != registryChanges.end())
+	{
+		// Added by an earlier line: it is looked up and checked when applied
+		isValid = true;
+	}
+
+	if (!line.combo.empty())
+	{
+		stringstream ss(line.combo);
+		ButtonID btn;
+		ss >> btn;
+		if (btn <= ButtonID::NONE)
+		{
+			return line.combo + " is not a button";
+		}
+		if (regex_match(line.arguments, regex(R"(\s*=\s*NONE\s*)")))
+		{
+			// Removes the chord, sim press or modeshift
+			return "";
+		}
+	}
+
+	if (isValid)
+	{
+		return "";
+	}
+	return !line.commands.empty() ? "Invalid value for " + line.name + ": " + string{ strtrim(line.arguments) } : "Unrecognized command: \"" + line.text + "\"";
 }
 
 string_view CmdRegistry::strtrim(std::string_view str)
@@ -124,6 +364,7 @@ bool CmdRegistry::Add(JSMCommand* newCommand)
 	{
 		// Unique pointers automatically delete the pointer on object destruction
 		_registry.emplace(newCommand->_name, unique_ptr<JSMCommand>(newCommand));
+		++_version;
 		return true;
 	}
 	delete newCommand;
@@ -137,6 +378,7 @@ bool CmdRegistry::Remove(in_string name)
 	if (cmd != _registry.end())
 	{
 		_registry.erase(cmd);
+		++_version;
 		return true;
 	}
 	return false;
@@ -147,36 +389,44 @@ bool CmdRegistry::findCommandWithName(in_string name, CmdMap::value_type& pair)
 	return name == pair.first;
 }
 
-bool CmdRegistry::isCommandValid(in_string line)
+CmdRegistry::ParsedLine CmdRegistry::parseLine(in_string line)
 {
-	ifstream file(line);
-	if (file.is_open())
-	{
-		file.close();
-		return true;
-	}
+	ParsedLine parsed;
+	parsed.text = line;
 	smatch results;
-	string combo, name, arguments, label;
-	char op = '\0';
+	// Break up the line of text in its relevant parts.
+	// Pro tip: use regex101.com to develop these beautiful monstrosities. :P
+	// Also, use raw strings R"(...)" to avoid the need to escape characters
+	// I dislike having to code in exception for + and - buttons not being \w characters
 	if (regex_match(line, results, regex(R"(^\s*([+-]?\w*)\s*([,+]\s*([+-]?\w*))?\s*([^#\n]*)(#\s*(.*))?$)")))
 	{
 		if (results[2].length() > 0)
 		{
-			combo = results[1];
-			op = results[2].str()[0];
-			name = results[3];
+			parsed.combo = results[1];
+			parsed.op = results[2].str()[0];
+			parsed.name = results[3];
 		}
 		else
 		{
-			name = results[1];
+			parsed.name = results[1];
 		}
 
-		arguments = results[4];
-		label = results[6];
+		parsed.arguments = results[4];
+		parsed.label = results[6];
 	}
+	return parsed;
+}
 
-	bool hasProcessed = false;
-	CmdMap::iterator cmd = find_if(_registry.begin(), _registry.end(), bind(&CmdRegistry::findCommandWithName, name, placeholders::_1));
+bool CmdRegistry::isCommandValid(in_string line)
+{
+	ifstream file(line);
+	if (file.is_open())
+	{
+		file.close();
+		return true;
+	}
+	auto parsed = parseLine(line);
+	CmdMap::iterator cmd = find_if(_registry.begin(), _registry.end(), bind(&CmdRegistry::findCommandWithName, parsed.name, placeholders::_1));
 	return cmd != _registry.end();
 }
 
@@ -186,58 +436,54 @@ void CmdRegistry::processLine(const string& line)
 
 	if (!trimmedLine.empty() && trimmedLine.front() != '#' && !loadConfigFile(trimmedLine))
 	{
-		smatch results;
-		string combo, name, arguments, label;
-		char op = '\0';
-		// Break up the line of text in its relevant parts.
-		// Pro tip: use regex101.com to develop these beautiful monstrosities. :P
-		// Also, use raw strings R"(...)" to avoid the need to escape characters
-		// I dislike having to code in exception for + and - buttons not being \w characters
-		if (regex_match(trimmedLine, results, regex(R"(^\s*([+-]?\w*)\s*([,+]\s*([+-]?\w*))?\s*([^#\n]*)(#\s*(.*))?$)")))
-		{
-			if (results[2].length() > 0)
-			{
-				combo = results[1];
-				op = results[2].str()[0];
-				name = results[3];
-			}
-			else
-			{
-				name = results[1];
-			}
+		applyLine(parseLine(trimmedLine));
+	}
+	// else ignore empty lines
+}
 
-			arguments = results[4];
-			label = results[6];
+void CmdRegistry::applyLine(const ParsedLine& line)
+{
+	bool hasProcessed = false;
+	auto apply = [&line, &hasProcessed](JSMCommand* command, const any& value) {
+		if (line.combo.empty())
+		{
+			hasProcessed |= command->Apply(line.arguments, value);
 		}
-
-		bool hasProcessed = false;
-		CmdMap::iterator cmd = find_if(_registry.begin(), _registry.end(), bind(&CmdRegistry::findCommandWithName, name, placeholders::_1));
-		while (cmd != _registry.end())
+		else
 		{
-			if (combo.empty())
+			auto modCommand = command->GetModifiedCmd(line.op, line.combo);
+			if (modCommand)
 			{
-				hasProcessed |= cmd->second->ParseData(arguments);
+				// It reads its value its own way
+				hasProcessed |= modCommand->Apply(line.arguments, any());
 			}
-			else
-			{
-				auto modCommand = cmd->second->GetModifiedCmd(op, combo);
-				if (modCommand)
-				{
-					hasProcessed |= modCommand->ParseData(arguments);
-				}
-				// Any task set to be run on destruction is done here.
-			}
-			cmd = find_if(++cmd, _registry.end(), bind(&CmdRegistry::findCommandWithName, name, placeholders::_1));
+			// Any task set to be run on destruction is done here.
 		}
-
-		if (!hasProcessed)
+	};
+	if (!line.commands.empty() && line.registryVersion == _version)
+	{
+		// Validated along with its file
+		for (auto& lineCommand : line.commands)
 		{
-			CERR << "Unrecognized command: \"" << trimmedLine << "\"\nEnter ";
-			COUT_INFO << "HELP";
-			CERR << " to display all commands." << endl;
+			apply(lineCommand.command, lineCommand.value);
 		}
 	}
-	// else ignore empty lines
+	else
+	{
+		CmdMap::iterator cmd = find_if(_registry.begin(), _registry.end(), bind(&CmdRegistry::findCommandWithName, line.name, placeholders::_1));
+		while (cmd != _registry.end())
+		{
+			apply(cmd->second.get(), any());
+			cmd = find_if(++cmd, _registry.end(), bind(&CmdRegistry::findCommandWithName, line.name, placeholders::_1));
+		}
+	}
+
+	if (!hasProcessed)
+	{
+		CERR << "Unrecognized command: \"" << line.text << "\"\nEnter ";
+		COUT_INFO << "HELP";
+		CERR << " to display all commands." << endl;
+	}
 }
 
 void CmdRegistry::GetCommandList(vector<string>& outList)
@@ -9,22 +9,13 @@ void DigitalButton::Context::updateChordStack(bool isPressed, ButtonID id)
 	{
 		if (isPressed)
 		{
-			auto foundChord = find(chordStack.begin(), chordStack.end(), id);
-			if (foundChord == chordStack.end())
-			{
-				//COUT << "Button " << index << " is pressed!" << endl;
-				chordStack.push_front(id); // Always push at the fromt to make it a stack
-			}
-
+			//COUT << "Button " << index << " is pressed!" << endl;
+			chordStack.push(id); // Does nothing if it's already in
 		}
 		else
 		{
-			auto foundChord = find(chordStack.begin(), chordStack.end(), id);
-			if (foundChord != chordStack.end())
-			{
-				//COUT << "Button " << index << " is released!" << endl;
-				chordStack.erase(foundChord); // The chord is released
-			}
+			//COUT << "Button " << index << " is released!" << endl;
+			chordStack.erase(id); // The chord is released
 		}
 	}
 }
@@ -61,12 +52,11 @@ private:
 public:
 	vector<BtnEvent> _instantReleaseQueue;
 	unsigned int _turboCount = 0;
-	DigitalButtonImpl(JSMButton &mapping, shared_ptr<DigitalButton::Context> context)
-	  : _id(mapping._id)
+	DigitalButtonImpl(ButtonID id, shared_ptr<DigitalButton::Context> context)
+	  : _id(id)
 	  , _context(context)
 	  , _press_times()
 	  , _keyToRelease()
-	  , _mapping(mapping)
 	  , _instantReleaseQueue()
 	{
 		_instantReleaseQueue.reserve(2);
@@ -77,9 +67,24 @@ public:
 	shared_ptr<DigitalButton::Context> _context;
 	chrono::steady_clock::time_point _press_times;
 	unique_ptr<Mapping> _keyToRelease; // At key press, remember what to release
-	const JSMButton &_mapping;
 	DigitalButton *_simPressMaster = nullptr;
 
+	// Remember to release the double press mapping, which a new snapshot may have dropped since the first press
+	void SetDblPressMapping()
+	{
+		auto dblPress = mappings().getDblPress();
+		_keyToRelease.reset(new Mapping(dblPress ? *dblPress : Mapping::NO_MAPPING));
+		_nameToRelease = JSMButton::GetName(_id, _id);
+	}
+
+	// The mappings of this button in the current settings snapshot
+	const ButtonMappings &mappings() const
+	{
+		static const ButtonMappings unmapped;
+		auto &table = _context->mappings;
+		return table && _id > ButtonID::NONE && size_t(_id) < table->size() ? (*table)[size_t(_id)] : unmapped;
+	}
+
 	// Pretty wrapper
 	inline float GetPressDurationMS(chrono::steady_clock::time_point time_now)
 	{
@@ -122,18 +127,20 @@ public:
 		if (!_keyToRelease)
 		{
 			// Look at active chord mappings starting with the latest activates chord
-			for (auto activeChord = _context->chordStack.cbegin(); activeChord != _context->chordStack.cend(); activeChord++)
+			auto &buttonMappings = mappings();
+			for (auto activeChord = _context->chordStack.begin(); activeChord != _context->chordStack.end(); activeChord++)
 			{
-				auto binding = _mapping.get(*activeChord);
+				auto binding = buttonMappings.get(*activeChord);
 				if (binding && *activeChord != _id)
 				{
 					_keyToRelease.reset(new Mapping(*binding));
-					_nameToRelease = _mapping.getName(*activeChord);
+					_nameToRelease = JSMButton::GetName(_id, *activeChord);
 					return _keyToRelease.get();
 				}
 			}
-			// Chord stack should always include NONE which will provide a value in the loop above
-			throw runtime_error("ChordStack should always include ButtonID::NONE, for the chorded variable to return the base value.");
+			// A button is unmapped until the first snapshot with it is published
+			_keyToRelease.reset(new Mapping(Mapping::NO_MAPPING));
+			_nameToRelease = JSMButton::GetName(_id);
 		}
 		return _keyToRelease.get();
 	}
@@ -470,11 +477,11 @@ class NoPress : public DigitalButtonState
 	{
 		DigitalButtonState::react(e);
 		pimpl()->_press_times = e.time_now;
-		if (pimpl()->_mapping.HasSimMappings())
+		if (pimpl()->mappings().HasSimMappings())
 		{
 			changeState<WaitSim>();
 		}
-		else if (pimpl()->_mapping.getDblPressMap())
+		else if (pimpl()->mappings().getDblPress())
 		{
 			// Start counting time between two start presses
 			changeState<DblPressStart>();
@@ -610,8 +617,9 @@ class WaitSim : public DigitalButtonState
 		{
 			changeState<SimPressSlave>();
 			pimpl()->_press_times = e.time_now;                                                          // Reset Timer
-			pimpl()->_keyToRelease.reset(new Mapping(pimpl()->_mapping.AtSimPress(simBtn->_id)->get())); // Make a copy
-			pimpl()->_nameToRelease = pimpl()->_mapping.getSimPressName(simBtn->_id);
+			auto simPress = pimpl()->mappings().getSimPress(simBtn->_id);
+			pimpl()->_keyToRelease.reset(new Mapping(simPress ? *simPress : Mapping::NO_MAPPING)); // Make a copy
+			pimpl()->_nameToRelease = JSMButton::GetSimPressName(pimpl()->_id, simBtn->_id);
 			pimpl()->_simPressMaster = simBtn; // Second to press is the slave
 
 			Sync sync;
@@ -625,7 +633,7 @@ class WaitSim : public DigitalButtonState
 		else if (pimpl()->GetPressDurationMS(e.time_now) > sim_press_window)
 		{
 			// Button is still pressed but Sim delay did expire
-			if (pimpl()->_mapping.getDblPressMap())
+			if (pimpl()->mappings().getDblPress())
 			{
 				// Start counting time between two start presses
 				changeState<DblPressStart>();
@@ -644,7 +652,7 @@ class WaitSim : public DigitalButtonState
 	{
 		DigitalButtonState::react(e);
 		// Button was released before sim delay expired
-		if (pimpl()->_mapping.getDblPressMap())
+		if (pimpl()->mappings().getDblPress())
 		{
 			// Start counting time between two start presses
 			changeState<DblPressStart>();
@@ -759,8 +767,7 @@ class DblPressNoPressTap : public DigitalButtonState
 		}
 		else
 		{
-			pimpl()->_keyToRelease.reset(new Mapping(pimpl()->_mapping.getDblPressMap()->second));
-			pimpl()->_nameToRelease = pimpl()->_mapping.getName(pimpl()->_id);
+			pimpl()->SetDblPressMapping();
 			pimpl()->_press_times = e.time_now;
 			changeState<DblPressPress>();
 		}
@@ -793,8 +800,7 @@ class DblPressNoPressHold : public DigitalButtonState
 		{
 			changeState<DblPressPress>();
 			pimpl()->_press_times = e.time_now;
-			pimpl()->_keyToRelease.reset(new Mapping(pimpl()->_mapping.getDblPressMap()->second));
-			pimpl()->_nameToRelease = pimpl()->_mapping.getName(pimpl()->_id);
+			pimpl()->SetDblPressMapping();
 		}
 	}
 
@@ -817,8 +823,7 @@ class DblPressPress : public pocket_fsm::NestedStateMachine<ActiveMappingState,
 	REACT(OnEntry) override
 	{
 		DigitalButtonState::react(e);
-		pimpl()->_keyToRelease.reset(new Mapping(pimpl()->_mapping.getDblPressMap()->second));
-		pimpl()->_nameToRelease = pimpl()->_mapping.getName(pimpl()->_id);
+		pimpl()->SetDblPressMapping();
 		initialize(new ActiveStartPress(_pimpl));
 	}
 
@@ -854,16 +859,15 @@ class InstRelease : public DigitalButtonState
 
 // Top level interface
 
-DigitalButton::DigitalButton(shared_ptr<DigitalButton::Context> _context, JSMButton &mapping)
-  : _id(mapping._id)
+DigitalButton::DigitalButton(shared_ptr<DigitalButton::Context> _context, ButtonID id)
+  : _id(id)
 {
-	initialize(new NoPress(new DigitalButtonImpl(mapping, _context)));
+	initialize(new NoPress(new DigitalButtonImpl(id, _context)));
 }
 
 DigitalButton::Context::Context(Gamepad::Callback virtualControllerCallback, shared_ptr<MotionIf> mainMotion)
 	: rightMainMotion(mainMotion)
 {
-	chordStack.push_front(ButtonID::NONE); //Always hold mapping none at the end to handle modeshifts and chords
 #ifdef _WIN32
 	if (virtual_controller.get() != ControllerScheme::NONE)
 	{
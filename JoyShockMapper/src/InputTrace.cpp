@@ -0,0 +1,523 @@
+#include "InputTrace.h"
+#include "JoyShockMapper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+using namespace InputTraceFormat;
+
+bool InputTraceWriter::Open(const string &path)
+{
+	lock_guard guard(_lock);
+	_file.open(path, ios::binary | ios::trunc);
+	if (!_file)
+	{
+		return false;
+	}
+	TraceHeader header;
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.frameRecordSize = sizeof(FrameRecord);
+	header.imuRecordSize = sizeof(ImuRecord);
+	_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	_start = chrono::steady_clock::now();
+	_numFrames = 0;
+	_isOpen = true;
+	return true;
+}
+
+void InputTraceWriter::Close()
+{
+	lock_guard guard(_lock);
+	_isOpen = false;
+	_file.close();
+}
+
+size_t InputTraceWriter::GetNumFrames()
+{
+	lock_guard guard(_lock);
+	return _numFrames;
+}
+
+void InputTraceWriter::Write(int handle, float deltaTime, const DeviceFrame &frame, const ImuSample *samples, int numSamples)
+{
+	if (!_isOpen)
+	{
+		return;
+	}
+	lock_guard guard(_lock);
+	if (!_file.is_open())
+	{
+		return;
+	}
+	uint64_t time = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - _start).count();
+	for (int i = 0; i < numSamples; ++i)
+	{
+		ImuRecord record;
+		memset(&record, 0, sizeof(record));
+		record.header = { IMU_SAMPLE, uint16_t(sizeof(ImuRecord)), handle, time };
+		record.imu = samples[i].imu;
+		record.deltaTime = samples[i].deltaTime;
+		record.timestamp = samples[i].timestamp;
+		_file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+	}
+	FrameRecord record;
+	memset(&record, 0, sizeof(record));
+	record.header = { FRAME, uint16_t(sizeof(FrameRecord)), handle, time };
+	record.deltaTime = deltaTime;
+	record.controllerType = frame.controllerType;
+	record.splitType = frame.splitType;
+	record.touchpadSizeX = frame.touchpadSizeX;
+	record.touchpadSizeY = frame.touchpadSizeY;
+	record.imuTimestamp = frame.timestamp;
+	record.state = frame.state;
+	record.imu = frame.imu;
+	record.touch = frame.touch;
+	_file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+	++_numFrames;
+}
+
+unique_ptr<InputTrace> InputTrace::Load(const string &path, string &error)
+{
+	ifstream file(path, ios::binary | ios::ate);
+	if (!file)
+	{
+		error = "Could not open " + path;
+		return nullptr;
+	}
+	unique_ptr<InputTrace> trace(new InputTrace());
+	trace->_data.resize(size_t(file.tellg()));
+	file.seekg(0);
+	file.read(trace->_data.data(), trace->_data.size());
+
+	TraceHeader header;
+	if (trace->_data.size() < sizeof(header))
+	{
+		error = path + " is not an input trace";
+		return nullptr;
+	}
+	memcpy(&header, trace->_data.data(), sizeof(header));
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+	{
+		error = path + " is not an input trace";
+		return nullptr;
+	}
+	if (header.version != VERSION || header.frameRecordSize != sizeof(FrameRecord) || header.imuRecordSize != sizeof(ImuRecord))
+	{
+		error = path + " was recorded by an incompatible version of JoyShockMapper";
+		return nullptr;
+	}
+
+	// Check every record once so that playback doesn't have to
+	size_t offset = sizeof(TraceHeader);
+	while (offset < trace->_data.size())
+	{
+		if (trace->_data.size() - offset < sizeof(RecordHeader))
+		{
+			break;
+		}
+		auto record = reinterpret_cast<const RecordHeader *>(&trace->_data[offset]);
+		// Playback reads the records as their type, so each must have exactly the size of its type
+		size_t expectedSize = record->type == FRAME ? sizeof(FrameRecord) : record->type == IMU_SAMPLE ? sizeof(ImuRecord) : 0;
+		if (expectedSize == 0 || record->size != expectedSize || record->size > trace->_data.size() - offset)
+		{
+			break;
+		}
+		if (record->type == FRAME)
+		{
+			++trace->_numFrames;
+			if (find(trace->_handles.begin(), trace->_handles.end(), record->handle) == trace->_handles.end())
+			{
+				trace->_handles.push_back(record->handle);
+				trace->_firstFrames.push_back(*reinterpret_cast<const FrameRecord *>(record));
+			}
+		}
+		offset += record->size;
+	}
+	if (offset != trace->_data.size())
+	{
+		// Most likely the recording was interrupted. Play what is there, up to the first bad record.
+		trace->_data.resize(offset);
+	}
+	return trace;
+}
+
+const RecordHeader *InputTrace::Next(size_t &offset) const
+{
+	if (offset < sizeof(TraceHeader))
+	{
+		offset = sizeof(TraceHeader);
+	}
+	if (offset >= _data.size())
+	{
+		return nullptr;
+	}
+	auto record = reinterpret_cast<const RecordHeader *>(&_data[offset]);
+	offset += record->size;
+	return record;
+}
+
+class TraceReplayer : public JslWrapper
+{
+	struct Device
+	{
+		DeviceFrame frame;
+		vector<ImuSample> samples;
+	};
+
+public:
+	TraceReplayer(unique_ptr<InputTrace> trace, bool realTime)
+	  : _trace(move(trace))
+	  , _realTime(realTime)
+	  , _devices(_trace->GetHandles().size())
+	{
+		for (size_t i = 0; i < _devices.size(); ++i)
+		{
+			auto &first = _trace->GetFirstFrames()[i];
+			SetFrame(_devices[i], first);
+		}
+	}
+
+	~TraceReplayer()
+	{
+		DisconnectAndDisposeAll();
+	}
+
+	int ConnectDevices() override
+	{
+		if (!_thread.joinable())
+		{
+			_keepPlaying = true;
+			_thread = thread(&TraceReplayer::Play, this);
+		}
+		return int(_devices.size());
+	}
+
+	int GetConnectedDeviceHandles(int *deviceHandleArray, int size) override
+	{
+		int count = min(size, int(_devices.size()));
+		for (int i = 0; i < count; ++i)
+		{
+			deviceHandleArray[i] = i;
+		}
+		return count;
+	}
+
+	void DisconnectAndDisposeAll() override
+	{
+		_keepPlaying = false;
+		if (_thread.joinable())
+		{
+			_thread.join();
+		}
+		_callback = nullptr;
+		_touchCallback = nullptr;
+	}
+
+	bool HasSimulatedTime() override
+	{
+		return true;
+	}
+
+	void GetFrame(int deviceId, DeviceFrame &frame) override
+	{
+		frame = IsValid(deviceId) ? _devices[deviceId].frame : DeviceFrame();
+	}
+
+	int GetIMUSamples(int deviceId, ImuSample *samples, int maxSamples) override
+	{
+		if (!IsValid(deviceId))
+		{
+			return 0;
+		}
+		auto &pending = _devices[deviceId].samples;
+		int count = min(maxSamples, int(pending.size()));
+		copy_n(pending.begin(), count, samples);
+		pending.clear();
+		return count;
+	}
+
+	JOY_SHOCK_STATE GetSimpleState(int deviceId) override
+	{
+		return Frame(deviceId).state;
+	}
+
+	IMU_STATE GetIMUState(int deviceId) override
+	{
+		return Frame(deviceId).imu;
+	}
+
+	MOTION_STATE GetMotionState(int deviceId) override
+	{
+		return MOTION_STATE();
+	}
+
+	TOUCH_STATE GetTouchState(int deviceId, bool previous) override
+	{
+		return Frame(deviceId).touch;
+	}
+
+	bool GetTouchpadDimension(int deviceId, int &sizeX, int &sizeY) override
+	{
+		sizeX = Frame(deviceId).touchpadSizeX;
+		sizeY = Frame(deviceId).touchpadSizeY;
+		return IsValid(deviceId);
+	}
+
+	int GetButtons(int deviceId) override
+	{
+		return Frame(deviceId).state.buttons;
+	}
+
+	float GetLeftX(int deviceId) override
+	{
+		return Frame(deviceId).state.stickLX;
+	}
+
+	float GetLeftY(int deviceId) override
+	{
+		return Frame(deviceId).state.stickLY;
+	}
+
+	float GetRightX(int deviceId) override
+	{
+		return Frame(deviceId).state.stickRX;
+	}
+
+	float GetRightY(int deviceId) override
+	{
+		return Frame(deviceId).state.stickRY;
+	}
+
+	float GetLeftTrigger(int deviceId) override
+	{
+		return Frame(deviceId).state.lTrigger;
+	}
+
+	float GetRightTrigger(int deviceId) override
+	{
+		return Frame(deviceId).state.rTrigger;
+	}
+
+	float GetGyroX(int deviceId) override
+	{
+		return Frame(deviceId).imu.gyroX;
+	}
+
+	float GetGyroY(int deviceId) override
+	{
+		return Frame(deviceId).imu.gyroY;
+	}
+
+	float GetGyroZ(int deviceId) override
+	{
+		return Frame(deviceId).imu.gyroZ;
+	}
+
+	float GetAccelX(int deviceId) override
+	{
+		return Frame(deviceId).imu.accelX;
+	}
+
+	float GetAccelY(int deviceId) override
+	{
+		return Frame(deviceId).imu.accelY;
+	}
+
+	float GetAccelZ(int deviceId) override
+	{
+		return Frame(deviceId).imu.accelZ;
+	}
+
+	int GetTouchId(int deviceId, bool secondTouch) override
+	{
+		return secondTouch ? Frame(deviceId).touch.t1Id : Frame(deviceId).touch.t0Id;
+	}
+
+	bool GetTouchDown(int deviceId, bool secondTouch) override
+	{
+		return secondTouch ? Frame(deviceId).touch.t1Down : Frame(deviceId).touch.t0Down;
+	}
+
+	float GetTouchX(int deviceId, bool secondTouch) override
+	{
+		return secondTouch ? Frame(deviceId).touch.t1X : Frame(deviceId).touch.t0X;
+	}
+
+	float GetTouchY(int deviceId, bool secondTouch) override
+	{
+		return secondTouch ? Frame(deviceId).touch.t1Y : Frame(deviceId).touch.t0Y;
+	}
+
+	float GetStickStep(int deviceId) override
+	{
+		return 0.f;
+	}
+
+	float GetTriggerStep(int deviceId) override
+	{
+		return 0.f;
+	}
+
+	float GetPollRate(int deviceId) override
+	{
+		return 0.f;
+	}
+
+	void ResetContinuousCalibration(int deviceId) override
+	{
+	}
+
+	void StartContinuousCalibration(int deviceId) override
+	{
+	}
+
+	void PauseContinuousCalibration(int deviceId) override
+	{
+	}
+
+	void GetCalibrationOffset(int deviceId, float &xOffset, float &yOffset, float &zOffset) override
+	{
+		xOffset = yOffset = zOffset = 0.f;
+	}
+
+	void SetCalibrationOffset(int deviceId, float xOffset, float yOffset, float zOffset) override
+	{
+	}
+
+	void SetCallback(void (*callback)(int, JOY_SHOCK_STATE, JOY_SHOCK_STATE, IMU_STATE, IMU_STATE, float)) override
+	{
+		_callback = callback;
+	}
+
+	void SetTouchCallback(void (*callback)(int, TOUCH_STATE, TOUCH_STATE, float)) override
+	{
+		_touchCallback = callback;
+	}
+
+	int GetControllerType(int deviceId) override
+	{
+		return Frame(deviceId).controllerType;
+	}
+
+	int GetControllerSplitType(int deviceId) override
+	{
+		return Frame(deviceId).splitType;
+	}
+
+	int GetControllerColour(int deviceId) override
+	{
+		return 0;
+	}
+
+	// Outputs have nowhere to go
+	void SetLightColour(int deviceId, int colour) override
+	{
+	}
+
+	void SetRumble(int deviceId, int smallRumble, int bigRumble) override
+	{
+	}
+
+	void SetPlayerNumber(int deviceId, int number) override
+	{
+	}
+
+private:
+	bool IsValid(int deviceId) const
+	{
+		return deviceId >= 0 && deviceId < int(_devices.size());
+	}
+
+	const DeviceFrame &Frame(int deviceId) const
+	{
+		static const DeviceFrame none{};
+		return IsValid(deviceId) ? _devices[deviceId].frame : none;
+	}
+
+	static void SetFrame(Device &device, const FrameRecord &record)
+	{
+		device.frame.state = record.state;
+		device.frame.imu = record.imu;
+		device.frame.touch = record.touch;
+		device.frame.touchpadSizeX = record.touchpadSizeX;
+		device.frame.touchpadSizeY = record.touchpadSizeY;
+		device.frame.controllerType = record.controllerType;
+		device.frame.splitType = record.splitType;
+		device.frame.timestamp = record.imuTimestamp;
+	}
+
+	int FindDevice(int recordedHandle) const
+	{
+		auto &handles = _trace->GetHandles();
+		return int(find(handles.begin(), handles.end(), recordedHandle) - handles.begin());
+	}
+
+	void Play()
+	{
+		// The mapper sets the callbacks up after connecting
+		while (_keepPlaying && !_callback)
+		{
+			this_thread::sleep_for(chrono::milliseconds(1));
+		}
+
+		auto start = chrono::steady_clock::now();
+		size_t numFrames = 0;
+		size_t offset = 0;
+		const RecordHeader *record;
+		while (_keepPlaying && (record = _trace->Next(offset)) != nullptr)
+		{
+			int deviceId = FindDevice(record->handle);
+			if (!IsValid(deviceId))
+			{
+				continue;
+			}
+			Device &device = _devices[deviceId];
+			if (record->type == IMU_SAMPLE)
+			{
+				auto imuRecord = reinterpret_cast<const ImuRecord *>(record);
+				device.samples.push_back({ imuRecord->imu, imuRecord->deltaTime, imuRecord->timestamp });
+			}
+			else if (record->type == FRAME)
+			{
+				if (_realTime)
+				{
+					this_thread::sleep_until(start + chrono::microseconds(record->time));
+				}
+				auto frameRecord = reinterpret_cast<const FrameRecord *>(record);
+				TOUCH_STATE previousTouch = device.frame.touch;
+				SetFrame(device, *frameRecord);
+				auto callback = _callback.load();
+				if (callback)
+				{
+					callback(deviceId, frameRecord->state, frameRecord->state, frameRecord->imu, frameRecord->imu, frameRecord->deltaTime);
+				}
+				auto touchCallback = _touchCallback.load();
+				if (touchCallback)
+				{
+					touchCallback(deviceId, frameRecord->touch, previousTouch, frameRecord->deltaTime);
+				}
+				++numFrames;
+			}
+		}
+
+		float seconds = chrono::duration<float>(chrono::steady_clock::now() - start).count();
+		COUT << "Replayed " << numFrames << " frames in " << seconds << " seconds (" << (seconds > 0.f ? numFrames / seconds : 0.f) << " frames per second)" << endl;
+	}
+
+	unique_ptr<InputTrace> _trace;
+	bool _realTime;
+	vector<Device> _devices;
+	thread _thread;
+	atomic_bool _keepPlaying = false;
+	atomic<void (*)(int, JOY_SHOCK_STATE, JOY_SHOCK_STATE, IMU_STATE, IMU_STATE, float)> _callback = nullptr;
+	atomic<void (*)(int, TOUCH_STATE, TOUCH_STATE, float)> _touchCallback = nullptr;
+};
+
+JslWrapper *NewTraceReplayer(unique_ptr<InputTrace> trace, bool realTime)
+{
+	return new TraceReplayer(move(trace), realTime);
+}
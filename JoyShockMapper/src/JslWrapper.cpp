@@ -208,6 +208,19 @@ public:
 	{
 		JslSetPlayerNumber(deviceId, number);
 	}
+
+	void GetFrame(int deviceId, DeviceFrame &frame) override
+	{
+		frame.state = JslGetSimpleState(deviceId);
+		frame.imu = JslGetIMUState(deviceId);
+		frame.touch = JslGetTouchState(deviceId, false);
+		if (!JslGetTouchpadDimension(deviceId, frame.touchpadSizeX, frame.touchpadSizeY))
+		{
+			frame.touchpadSizeX = frame.touchpadSizeY = 0;
+		}
+		frame.controllerType = JslGetControllerType(deviceId);
+		frame.splitType = JslGetControllerSplitType(deviceId);
+	}
 };
 /*
 // not needed for connecting to add-on via JSL and then connecting to xInput controller via SDL
@@ -164,6 +164,7 @@ bool Mapping::AddMapping(KeyCode key, EventModifier evtMod, ActionModifier actMo
 		apply = bind(&EventActionIf::ApplyGyroAction, placeholders::_1, key);
 		release = bind(&EventActionIf::RemoveGyroAction, placeholders::_1);
 		_tapDurationMs = MAGIC_EXTENDED_TAP_DURATION; // Unused in regular press
+		_hasGyroOnBind |= key.code == GYRO_ON_BIND;
 	}
 	else if (key.code == COMMAND_ACTION)
 	{
@@ -0,0 +1,456 @@
+#include "PlayStationReports.h"
+#include "TriggerEffectGenerator.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace PlayStationReports
+{
+namespace
+{
+constexpr float TOUCHPAD_SIZE_X = 1920.f;
+constexpr uint8_t HAT_NONE = 8;
+
+// Pressed directions of each hat value, clockwise from up
+constexpr int HAT_BUTTONS[HAT_NONE] = {
+	1 << JSOFFSET_UP,
+	1 << JSOFFSET_UP | 1 << JSOFFSET_RIGHT,
+	1 << JSOFFSET_RIGHT,
+	1 << JSOFFSET_DOWN | 1 << JSOFFSET_RIGHT,
+	1 << JSOFFSET_DOWN,
+	1 << JSOFFSET_DOWN | 1 << JSOFFSET_LEFT,
+	1 << JSOFFSET_LEFT,
+	1 << JSOFFSET_UP | 1 << JSOFFSET_LEFT,
+};
+
+struct Product
+{
+	uint16_t productId;
+	int controllerType;
+};
+
+const Product PRODUCTS[] = {
+	{ 0x05C4, JS_TYPE_DS4 }, // DualShock 4
+	{ 0x09CC, JS_TYPE_DS4 }, // DualShock 4, second revision
+	{ 0x0BA0, JS_TYPE_DS4 }, // DualShock 4 wireless adapter
+	{ 0x0CE6, JS_TYPE_DS },  // DualSense
+	{ 0x0DF2, JS_TYPE_DS },  // DualSense Edge
+};
+
+const vector<AxisField> DS4_AXES = {
+	{ STICK_LX, Encoding::U8_CENTERED, 0, 1.f },
+	{ STICK_LY, Encoding::U8_CENTERED, 1, -1.f },
+	{ STICK_RX, Encoding::U8_CENTERED, 2, 1.f },
+	{ STICK_RY, Encoding::U8_CENTERED, 3, -1.f },
+	{ TRIGGER_L, Encoding::U8, 7, 1.f },
+	{ TRIGGER_R, Encoding::U8, 8, 1.f },
+	{ GYRO_X, Encoding::S16, 12, GYRO_SCALE },
+	{ GYRO_Y, Encoding::S16, 14, GYRO_SCALE },
+	{ GYRO_Z, Encoding::S16, 16, GYRO_SCALE },
+	{ ACCEL_X, Encoding::S16, 18, ACCEL_SCALE },
+	{ ACCEL_Y, Encoding::S16, 20, ACCEL_SCALE },
+	{ ACCEL_Z, Encoding::S16, 22, ACCEL_SCALE },
+};
+
+// The DualSense has the same buttons as the DualShock 4 in the same order, plus the mic button
+vector<ButtonField> FaceButtons(uint8_t offset, bool hasMic)
+{
+	vector<ButtonField> buttons = {
+		{ offset, 0x10, JSOFFSET_W },
+		{ offset, 0x20, JSOFFSET_S },
+		{ offset, 0x40, JSOFFSET_E },
+		{ offset, 0x80, JSOFFSET_N },
+		{ uint8_t(offset + 1), 0x01, JSOFFSET_L },
+		{ uint8_t(offset + 1), 0x02, JSOFFSET_R },
+		{ uint8_t(offset + 1), 0x04, JSOFFSET_ZL },
+		{ uint8_t(offset + 1), 0x08, JSOFFSET_ZR },
+		{ uint8_t(offset + 1), 0x10, JSOFFSET_SHARE },
+		{ uint8_t(offset + 1), 0x20, JSOFFSET_OPTIONS },
+		{ uint8_t(offset + 1), 0x40, JSOFFSET_LCLICK },
+		{ uint8_t(offset + 1), 0x80, JSOFFSET_RCLICK },
+		{ uint8_t(offset + 2), 0x01, JSOFFSET_PS },
+		{ uint8_t(offset + 2), 0x02, JSOFFSET_TOUCHPAD_CLICK },
+	};
+	if (hasMic)
+	{
+		buttons.push_back({ uint8_t(offset + 2), 0x04, JSOFFSET_MIC });
+	}
+	return buttons;
+}
+
+const vector<AxisField> DS_AXES = {
+	{ STICK_LX, Encoding::U8_CENTERED, 0, 1.f },
+	{ STICK_LY, Encoding::U8_CENTERED, 1, -1.f },
+	{ STICK_RX, Encoding::U8_CENTERED, 2, 1.f },
+	{ STICK_RY, Encoding::U8_CENTERED, 3, -1.f },
+	{ TRIGGER_L, Encoding::U8, 4, 1.f },
+	{ TRIGGER_R, Encoding::U8, 5, 1.f },
+	{ GYRO_X, Encoding::S16, 15, GYRO_SCALE },
+	{ GYRO_Y, Encoding::S16, 17, GYRO_SCALE },
+	{ GYRO_Z, Encoding::S16, 19, GYRO_SCALE },
+	{ ACCEL_X, Encoding::S16, 21, ACCEL_SCALE },
+	{ ACCEL_Y, Encoding::S16, 23, ACCEL_SCALE },
+	{ ACCEL_Z, Encoding::S16, 25, ACCEL_SCALE },
+};
+
+const InputLayout INPUT_LAYOUTS[] = {
+	// type, bus, id, size, base, checksum, axes, buttons, hat, timestamp, bytes, unit, touch, touchpad height
+	{ JS_TYPE_DS4, Bus::USB, 0x01, 64, 1, false, DS4_AXES, FaceButtons(4, false), 4, 9, 2, 16.f / 3.f, 34, 942.f },
+	{ JS_TYPE_DS4, Bus::BLUETOOTH, 0x11, 78, 3, true, DS4_AXES, FaceButtons(4, false), 4, 9, 2, 16.f / 3.f, 34, 942.f },
+	{ JS_TYPE_DS, Bus::USB, 0x01, 64, 1, false, DS_AXES, FaceButtons(7, true), 7, 27, 4, 1.f / 3.f, 32, 1080.f },
+	{ JS_TYPE_DS, Bus::BLUETOOTH, 0x31, 78, 2, true, DS_AXES, FaceButtons(7, true), 7, 27, 4, 1.f / 3.f, 32, 1080.f },
+};
+
+struct OutputLayout
+{
+	int controllerType;
+	Bus bus;
+	uint8_t reportId;
+	uint8_t size;
+	uint8_t base;
+	bool checksum;
+};
+
+const OutputLayout OUTPUT_LAYOUTS[] = {
+	{ JS_TYPE_DS4, Bus::USB, 0x05, 32, 1, false },
+	{ JS_TYPE_DS4, Bus::BLUETOOTH, 0x11, 78, 3, true },
+	{ JS_TYPE_DS, Bus::USB, 0x02, 63, 1, false },
+	{ JS_TYPE_DS, Bus::BLUETOOTH, 0x31, 78, 3, true },
+};
+
+// Player lights of the DualSense, as lit by the PS5
+constexpr uint8_t DS_PLAYER_LIGHTS[] = { 0x04, 0x0A, 0x15, 0x1B, 0x1F };
+
+uint16_t ReadU16(const uint8_t *data)
+{
+	return uint16_t(data[0] | data[1] << 8);
+}
+
+uint32_t ReadU32(const uint8_t *data)
+{
+	return uint32_t(data[0]) | uint32_t(data[1]) << 8 | uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24;
+}
+
+float ReadAxis(Encoding encoding, const uint8_t *data)
+{
+	switch (encoding)
+	{
+	case Encoding::U8:
+		return data[0] / 255.f;
+	case Encoding::U8_CENTERED:
+		return clamp((data[0] - 128) / 127.f, -1.f, 1.f);
+	case Encoding::S16:
+		return float(int16_t(ReadU16(data)));
+	}
+	return 0.f;
+}
+
+void ReadTouchPoint(const uint8_t *point, float sizeY, int &id, bool &down, float &x, float &y)
+{
+	id = point[0] & 0x7F;
+	down = (point[0] & 0x80) == 0;
+	x = clamp((point[1] | (point[2] & 0x0F) << 8) / TOUCHPAD_SIZE_X, 0.f, 1.f);
+	y = clamp((point[2] >> 4 | point[3] << 4) / sizeY, 0.f, 1.f);
+}
+
+// Fields shared by USB and Bluetooth, from the base of the layout
+void WriteDs4Output(const Output &output, uint8_t *common)
+{
+	common[0] = 0x01 | 0x02; // Enable rumble and light bar
+	common[3] = output.smallRumble;
+	common[4] = output.bigRumble;
+	if (output.hasLightColour)
+	{
+		common[5] = (output.lightColour >> 16) & 0xFF;
+		common[6] = (output.lightColour >> 8) & 0xFF;
+		common[7] = output.lightColour & 0xFF;
+	}
+	else
+	{
+		common[0] &= ~0x02;
+	}
+}
+
+// Same layout as the effect packet SDL takes
+void WriteDsOutput(const Output &output, uint8_t *common)
+{
+	common[0] = 0x01 | 0x02 | 0x04 | 0x08; // Enable rumble, and the right and left trigger effects
+	common[1] = 0x01;                      // Enable the mic light
+	common[2] = output.smallRumble;
+	common[3] = output.bigRumble;
+	common[8] = output.micLight;
+	WriteTriggerEffect(common + 10, output.rightTriggerEffect);
+	WriteTriggerEffect(common + 21, output.leftTriggerEffect);
+	if (output.playerNumber > 0 && output.playerNumber <= int(size(DS_PLAYER_LIGHTS)))
+	{
+		common[1] |= 0x10;
+		common[43] = DS_PLAYER_LIGHTS[output.playerNumber - 1];
+	}
+	if (output.hasLightColour)
+	{
+		common[1] |= 0x04;
+		common[44] = (output.lightColour >> 16) & 0xFF;
+		common[45] = (output.lightColour >> 8) & 0xFF;
+		common[46] = output.lightColour & 0xFF;
+	}
+}
+} // namespace
+
+bool Output::operator==(const Output &rhs) const
+{
+	return smallRumble == rhs.smallRumble && bigRumble == rhs.bigRumble && hasLightColour == rhs.hasLightColour &&
+	  lightColour == rhs.lightColour && playerNumber == rhs.playerNumber && micLight == rhs.micLight &&
+	  leftTriggerEffect == rhs.leftTriggerEffect && rightTriggerEffect == rhs.rightTriggerEffect;
+}
+
+int GetControllerType(uint16_t vendorId, uint16_t productId)
+{
+	if (vendorId == SONY_VENDOR_ID)
+	{
+		for (auto &product : PRODUCTS)
+		{
+			if (product.productId == productId)
+			{
+				return product.controllerType;
+			}
+		}
+	}
+	return 0;
+}
+
+const InputLayout *FindInputLayout(int controllerType, Bus bus)
+{
+	for (auto &layout : INPUT_LAYOUTS)
+	{
+		if (layout.controllerType == controllerType && layout.bus == bus)
+		{
+			return &layout;
+		}
+	}
+	return nullptr;
+}
+
+bool ParseInputReport(const InputLayout &layout, const uint8_t *data, size_t size, InputReport &report, const ImuCalibration *calibration)
+{
+	if (size < layout.size || data[0] != layout.reportId)
+	{
+		return false;
+	}
+	if (layout.checksum && BluetoothCrc(0xA1, data, layout.size - 4) != ReadU32(data + layout.size - 4))
+	{
+		return false;
+	}
+	const uint8_t *common = data + layout.base;
+
+	float axes[AXIS_COUNT] = {};
+	for (auto &field : layout.axes)
+	{
+		float value = ReadAxis(field.encoding, common + field.offset);
+		if (calibration && field.axis >= GYRO_X)
+		{
+			int imuAxis = field.axis - GYRO_X;
+			axes[field.axis] = (value - calibration->bias[imuAxis]) * calibration->scale[imuAxis];
+		}
+		else
+		{
+			axes[field.axis] = value * field.scale;
+		}
+	}
+	report.state.stickLX = axes[STICK_LX];
+	report.state.stickLY = axes[STICK_LY];
+	report.state.stickRX = axes[STICK_RX];
+	report.state.stickRY = axes[STICK_RY];
+	report.state.lTrigger = axes[TRIGGER_L];
+	report.state.rTrigger = axes[TRIGGER_R];
+	report.imu.gyroX = axes[GYRO_X];
+	report.imu.gyroY = axes[GYRO_Y];
+	report.imu.gyroZ = axes[GYRO_Z];
+	report.imu.accelX = axes[ACCEL_X];
+	report.imu.accelY = axes[ACCEL_Y];
+	report.imu.accelZ = axes[ACCEL_Z];
+
+	uint8_t hat = common[layout.hat] & 0x0F;
+	report.state.buttons = hat < HAT_NONE ? HAT_BUTTONS[hat] : 0;
+	for (auto &field : layout.buttons)
+	{
+		if (common[field.offset] & field.mask)
+		{
+			report.state.buttons |= 1 << field.jsOffset;
+		}
+	}
+
+	report.sensorTimestamp = layout.timestampBytes == 4 ? ReadU32(common + layout.timestamp) : ReadU16(common + layout.timestamp);
+
+	const uint8_t *touch = common + layout.touch;
+	ReadTouchPoint(touch, layout.touchpadSizeY, report.touch.t0Id, report.touch.t0Down, report.touch.t0X, report.touch.t0Y);
+	ReadTouchPoint(touch + 4, layout.touchpadSizeY, report.touch.t1Id, report.touch.t1Down, report.touch.t1X, report.touch.t1Y);
+	return true;
+}
+
+uint8_t CalibrationReportId(int controllerType, Bus bus)
+{
+	if (controllerType == JS_TYPE_DS4)
+	{
+		return bus == Bus::USB ? 0x02 : 0x05;
+	}
+	return controllerType == JS_TYPE_DS ? 0x05 : 0;
+}
+
+// Same format on both controllers, except for the order of the gyro ranges over USB on the DualShock 4
+bool ParseCalibration(int controllerType, Bus bus, const uint8_t *data, size_t size, ImuCalibration &calibration)
+{
+	uint8_t reportId = CalibrationReportId(controllerType, bus);
+	bool ds4Usb = controllerType == JS_TYPE_DS4 && bus == Bus::USB;
+	size_t reportSize = ds4Usb ? 37 : CALIBRATION_REPORT_SIZE;
+	if (reportId == 0 || size < reportSize || data[0] != reportId)
+	{
+		return false;
+	}
+	if (bus == Bus::BLUETOOTH && BluetoothCrc(0xA3, data, reportSize - 4) != ReadU32(data + reportSize - 4))
+	{
+		return false;
+	}
+	auto read = [data](int offset) {
+		return float(int16_t(ReadU16(data + offset)));
+	};
+
+	ImuCalibration parsed;
+	// The gyro reads the plus and minus ranges when turning at these speeds
+	float speed2x = read(19) + read(21);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float plus = read(ds4Usb ? 7 + 2 * axis : 7 + 4 * axis);
+		float minus = read(ds4Usb ? 13 + 2 * axis : 9 + 4 * axis);
+		parsed.bias[axis] = read(1 + 2 * axis);
+		parsed.scale[axis] = speed2x / (plus - minus);
+	}
+	// The accelerometer reads the plus and minus ranges at 1G each way
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float plus = read(23 + 4 * axis);
+		float minus = read(25 + 4 * axis);
+		parsed.bias[3 + axis] = (plus + minus) / 2.f;
+		parsed.scale[3 + axis] = 2.f / (plus - minus);
+	}
+
+	// Some controllers, clones mostly, report garbage. Also rejects divisions by 0.
+	const ImuCalibration nominal;
+	for (int i = 0; i < 6; ++i)
+	{
+		if (!(parsed.scale[i] > nominal.scale[i] * 0.5f && parsed.scale[i] < nominal.scale[i] * 2.f))
+		{
+			return false;
+		}
+	}
+	calibration = parsed;
+	return true;
+}
+
+uint64_t TimestampDelta(const InputLayout &layout, uint32_t from, uint32_t to)
+{
+	uint32_t ticks = to - from;
+	if (layout.timestampBytes == 2)
+	{
+		ticks &= 0xFFFF;
+	}
+	return uint64_t(ticks * double(layout.timestampUnit));
+}
+
+size_t BuildOutputReport(int controllerType, Bus bus, const Output &output, uint8_t sequence, uint8_t *buffer)
+{
+	auto layout = find_if(begin(OUTPUT_LAYOUTS), end(OUTPUT_LAYOUTS), [&](const OutputLayout &layout) {
+		return layout.controllerType == controllerType && layout.bus == bus;
+	});
+	if (layout == end(OUTPUT_LAYOUTS))
+	{
+		return 0;
+	}
+
+	memset(buffer, 0, layout->size);
+	buffer[0] = layout->reportId;
+	if (controllerType == JS_TYPE_DS4)
+	{
+		if (bus == Bus::BLUETOOTH)
+		{
+			buffer[1] = 0xC0; // HID report with a checksum
+		}
+		WriteDs4Output(output, buffer + layout->base);
+	}
+	else
+	{
+		if (bus == Bus::BLUETOOTH)
+		{
+			buffer[1] = sequence << 4;
+			buffer[2] = 0x10; // Tag of the effect report
+		}
+		WriteDsOutput(output, buffer + layout->base);
+	}
+
+	if (layout->checksum)
+	{
+		uint32_t crc = BluetoothCrc(0xA2, buffer, layout->size - 4);
+		for (int i = 0; i < 4; ++i)
+		{
+			buffer[layout->size - 4 + i] = (crc >> (8 * i)) & 0xFF;
+		}
+	}
+	return layout->size;
+}
+
+void WriteTriggerEffect(uint8_t *effect, const AdaptiveTriggerSetting &setting)
+{
+	using namespace ExtendInput::DataTools::DualSense;
+	effect[0] = (uint8_t)setting.mode;
+	switch (setting.mode)
+	{
+	case AdaptiveTriggerMode::RESISTANCE_RAW:
+		TriggerEffectGenerator::SimpleResistance(effect, 0, setting.start, setting.force);
+		break;
+	case AdaptiveTriggerMode::SEGMENT:
+		effect[1] = setting.start;
+		effect[2] = setting.end;
+		effect[3] = setting.force >> 8;
+		break;
+	case AdaptiveTriggerMode::RESISTANCE:
+		TriggerEffectGenerator::Resistance(effect, 0, setting.start, setting.force);
+		break;
+	case AdaptiveTriggerMode::BOW:
+		TriggerEffectGenerator::Bow(effect, 0, setting.start, setting.end, setting.force, setting.forceExtra);
+		break;
+	case AdaptiveTriggerMode::GALLOPING:
+		TriggerEffectGenerator::Galloping(effect, 0, setting.start, setting.end, setting.force, setting.forceExtra, setting.frequency);
+		break;
+	case AdaptiveTriggerMode::SEMI_AUTOMATIC:
+		TriggerEffectGenerator::SemiAutomaticGun(effect, 0, setting.start, setting.end, setting.force);
+		break;
+	case AdaptiveTriggerMode::AUTOMATIC:
+		TriggerEffectGenerator::AutomaticGun(effect, 0, setting.start, setting.force, setting.frequency);
+		break;
+	case AdaptiveTriggerMode::MACHINE:
+		TriggerEffectGenerator::Machine(effect, 0, setting.start, setting.end, setting.force, setting.forceExtra, setting.frequency, setting.frequencyExtra);
+		break;
+	default:
+		effect[0] = 0x05; // no effect
+	}
+}
+
+uint32_t BluetoothCrc(uint8_t seed, const uint8_t *data, size_t size)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	auto add = [&crc](uint8_t byte) {
+		crc ^= byte;
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	};
+	add(seed);
+	for (size_t i = 0; i < size; ++i)
+	{
+		add(data[i]);
+	}
+	return ~crc;
+}
+} // namespace PlayStationReports
@@ -12,11 +12,21 @@
 #include <memory>
 #include <iostream>
 #include <cstring>
-#include "TriggerEffectGenerator.h"
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include "PlayStationReports.h"
+#include "TickScheduler.h"
+#include "SlotTable.h"
+#include "CallbackPool.h"
 
 unique_ptr<JSlWrapperImpl> jsl(new JSlWrapperImpl);
 
 extern JSMVariable<float> tick_time; // defined in main.cc
+extern JSMVariable<int> poll_threads; // defined in main.cc
+extern TickScheduler tick_scheduler; // defined in main.cc
+extern JSMVariable<float> output_report_interval; // defined in main.cc
+extern JSMVariable<Switch> auto_tick; // defined in main.cc
 
 typedef struct
 {
@@ -43,6 +53,25 @@ typedef struct
 	Uint8 ucLedBlue;                  /* 46 */
 } DS5EffectsState_t;
 
+// Everything JSM writes to a controller
+struct OutputState
+{
+	uint16_t smallRumble = 0;
+	uint16_t bigRumble = 0;
+	AdaptiveTriggerSetting leftTriggerEffect;
+	AdaptiveTriggerSetting rightTriggerEffect;
+	uint8_t micLight = 0;
+	bool hasLightColour = false;
+	uint32_t lightColour = 0;
+
+	bool operator==(const OutputState &rhs) const
+	{
+		return smallRumble == rhs.smallRumble && bigRumble == rhs.bigRumble && leftTriggerEffect == rhs.leftTriggerEffect &&
+		  rightTriggerEffect == rhs.rightTriggerEffect && micLight == rhs.micLight && hasLightColour == rhs.hasLightColour &&
+		  lightColour == rhs.lightColour;
+	}
+};
+
 struct ControllerDevice
 {
 	ControllerDevice(int id)
@@ -66,6 +95,12 @@ struct ControllerDevice
 				{
 					SDL_GameControllerSetSensorEnabled(_sdlController, SDL_SENSOR_ACCEL, SDL_TRUE);
 				}
+				if (_has_gyro || _has_accel)
+				{
+					float rate = SDL_GameControllerGetSensorDataRate(_sdlController, _has_gyro ? SDL_SENSOR_GYRO : SDL_SENSOR_ACCEL);
+					_sensorInterval = rate > 0.f ? 1.f / rate : 0.f;
+				}
+				_instanceId = SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(_sdlController));
 
 				int vid = SDL_GameControllerGetVendor(_sdlController);
 				int pid = SDL_GameControllerGetProduct(_sdlController);
@@ -136,12 +171,15 @@ struct ControllerDevice
 
 	virtual ~ControllerDevice()
 	{
-		_micLight = 0;
-		memset(&_leftTriggerEffect, 0, sizeof(_leftTriggerEffect));
-		memset(&_rightTriggerEffect, 0, sizeof(_rightTriggerEffect));
-		_big_rumble = 0;
-		_small_rumble = 0;
-		SendEffect();
+		{
+			lock_guard guard(_outputLock);
+			_output.micLight = 0;
+			memset(&_output.leftTriggerEffect, 0, sizeof(_output.leftTriggerEffect));
+			memset(&_output.rightTriggerEffect, 0, sizeof(_output.rightTriggerEffect));
+			_output.bigRumble = 0;
+			_output.smallRumble = 0;
+		}
+		FlushOutput(0.f);
 		SDL_GameControllerClose(_sdlController);
 	}
 
@@ -150,83 +188,192 @@ struct ControllerDevice
 		return _sdlController != nullptr;
 	}
 
-private:
-	void LoadTriggerEffect(Uint8 *rgucTriggerEffect, const AdaptiveTriggerSetting *trigger_effect)
+	// Gyro and accel come in as separate events. A sample is completed by the gyro reading (or the accel
+	// reading for accel-only devices) and carries the latest accel reading along with it.
+	void PushSensorEvent(const SDL_ControllerSensorEvent &event)
 	{
-		using namespace ExtendInput::DataTools::DualSense;
-		//ExtendInput::DataTools::DualSense::TriggerEffectGenerator::Bow(rgucTriggerEffect, 0, 0, 5, 3, 8);
-		//ExtendInput::DataTools::DualSense::TriggerEffectGenerator::Galloping(rgucTriggerEffect, 0, 0, 9, 3, 5, 3);
-		rgucTriggerEffect[0] = (uint8_t)trigger_effect->mode;
-		switch (trigger_effect->mode)
+		if (event.sensor == SDL_SENSOR_ACCEL)
 		{
-        case AdaptiveTriggerMode::RESISTANCE_RAW:
-			TriggerEffectGenerator::SimpleResistance(rgucTriggerEffect, 0, trigger_effect->start, trigger_effect->force);
-			break;
-		case AdaptiveTriggerMode::SEGMENT:
-			rgucTriggerEffect[1] = trigger_effect->start;
-			rgucTriggerEffect[2] = trigger_effect->end;
-			rgucTriggerEffect[3] = trigger_effect->force >> 8;
-			break;
-		case AdaptiveTriggerMode::RESISTANCE:
-			TriggerEffectGenerator::Resistance(rgucTriggerEffect, 0, trigger_effect->start, trigger_effect->force);
-			break;
-		case AdaptiveTriggerMode::BOW:
-			TriggerEffectGenerator::Bow(rgucTriggerEffect, 0, trigger_effect->start, trigger_effect->end, trigger_effect->force, trigger_effect->forceExtra);
-			break;
-		case AdaptiveTriggerMode::GALLOPING:
-			TriggerEffectGenerator::Galloping(rgucTriggerEffect, 0, trigger_effect->start, trigger_effect->end, trigger_effect->force, trigger_effect->forceExtra, trigger_effect->frequency);
-			break;
-	    case AdaptiveTriggerMode::SEMI_AUTOMATIC:
-			TriggerEffectGenerator::SemiAutomaticGun(rgucTriggerEffect, 0, trigger_effect->start, trigger_effect->end, trigger_effect->force);
-			break;
-		case AdaptiveTriggerMode::AUTOMATIC:
-			TriggerEffectGenerator::AutomaticGun(rgucTriggerEffect, 0, trigger_effect->start, trigger_effect->force, trigger_effect->frequency);
-			break;
-		case AdaptiveTriggerMode::MACHINE:
-			TriggerEffectGenerator::Machine(rgucTriggerEffect, 0, trigger_effect->start, trigger_effect->end, trigger_effect->force, trigger_effect->forceExtra, trigger_effect->frequency, trigger_effect->frequencyExtra);
-			break;
-		default:
-			rgucTriggerEffect[0] = 0x05; // no effect
+			constexpr float toGs = 1.f / 9.8f;
+			_lastAccel[0] = event.data[0] * toGs;
+			_lastAccel[1] = event.data[1] * toGs;
+			_lastAccel[2] = event.data[2] * toGs;
+			if (_has_gyro)
+				return;
+		}
+		else if (event.sensor != SDL_SENSOR_GYRO)
+		{
+			return;
+		}
+
+		_hasNewSensorData = true;
+		ImuSample &sample = _sensorSamples[(_firstSensorSample + _numSensorSamples) % MAX_SENSOR_SAMPLES];
+		if (_numSensorSamples < MAX_SENSOR_SAMPLES)
+		{
+			++_numSensorSamples;
+		}
+		else
+		{
+			// Nobody consumed the samples for a while: drop the oldest one
+			_firstSensorSample = (_firstSensorSample + 1) % MAX_SENSOR_SAMPLES;
+		}
+
+		memset(&sample.imu, 0, sizeof(sample.imu));
+		if (event.sensor == SDL_SENSOR_GYRO)
+		{
+			constexpr float toDegPerSec = 180.f / M_PI;
+			sample.imu.gyroX = event.data[0] * toDegPerSec;
+			sample.imu.gyroY = event.data[1] * toDegPerSec;
+			sample.imu.gyroZ = event.data[2] * toDegPerSec;
+		}
+		sample.imu.accelX = _lastAccel[0];
+		sample.imu.accelY = _lastAccel[1];
+		sample.imu.accelZ = _lastAccel[2];
+
+#if SDL_VERSION_ATLEAST(2, 26, 0)
+		uint64_t timestamp = event.timestamp_us;
+#else
+		uint64_t timestamp = 0;
+#endif
+		if (timestamp == 0 && _sensorInterval > 0.f)
+		{
+			// No sensor timestamp: keep a clock running at the nominal sensor rate instead
+			timestamp = _lastSensorTimestamp + uint64_t(_sensorInterval * 1000000.f);
+		}
+		if (timestamp != 0 && _lastSensorTimestamp != 0 && timestamp > _lastSensorTimestamp)
+		{
+			sample.deltaTime = (timestamp - _lastSensorTimestamp) / 1000000.f;
+		}
+		else
+		{
+			sample.deltaTime = _sensorInterval;
 		}
+		sample.timestamp = timestamp;
+		_lastSensorTimestamp = timestamp;
 	}
 
-public:
-	void SendEffect()
+	int PopSensorSamples(ImuSample *samples, int maxSamples)
+	{
+		int count = min(_numSensorSamples, maxSamples);
+		for (int i = 0; i < count; ++i)
+		{
+			samples[i] = _sensorSamples[(_firstSensorSample + i) % MAX_SENSOR_SAMPLES];
+		}
+		_firstSensorSample = (_firstSensorSample + count) % MAX_SENSOR_SAMPLES;
+		_numSensorSamples -= count;
+		return count;
+	}
+
+	// Set the output state to send on the next flush
+	template<typename Func>
+	void UpdateOutput(Func update)
+	{
+		lock_guard guard(_outputLock);
+		update(_output);
+	}
+
+	// Send whatever changed in the output state since the last report, unless the last report is more
+	// recent than minIntervalMs. Everything is sent in a single report when the controller supports it.
+	void FlushOutput(float minIntervalMs)
 	{
+		lock_guard guard(_outputLock);
+		auto now = chrono::steady_clock::now();
+		bool isRumbling = _output.bigRumble != 0 || _output.smallRumble != 0;
+		// SDL stops the rumble after the given duration, so refresh it while it's on. The DS effect report has no such limit.
+		bool refreshRumble = _ctrlr_type != JS_TYPE_DS && isRumbling && now - _lastRumbleTime >= RUMBLE_REFRESH;
+		if ((_output == _sentOutput && !refreshRumble) ||
+		  now - _lastOutputTime < chrono::duration<float, milli>(minIntervalMs))
+		{
+			return;
+		}
+
 		if (_ctrlr_type == JS_TYPE_DS)
 		{
-			DS5EffectsState_t effectPacket;
-			memset(&effectPacket, 0, sizeof(effectPacket));
+			SendEffect();
+		}
+		else
+		{
+			if (refreshRumble || _output.bigRumble != _sentOutput.bigRumble || _output.smallRumble != _sentOutput.smallRumble)
+			{
+				SDL_GameControllerRumble(_sdlController, _output.bigRumble, _output.smallRumble, isRumbling ? RUMBLE_DURATION_MS : 0);
+				_lastRumbleTime = now;
+			}
+			if (_output.hasLightColour && (_output.lightColour != _sentOutput.lightColour || !_sentOutput.hasLightColour))
+			{
+				SDL_GameControllerSetLED(_sdlController, (_output.lightColour >> 16) & 0xFF, (_output.lightColour >> 8) & 0xFF, _output.lightColour & 0xFF);
+			}
+		}
+		_sentOutput = _output;
+		_lastOutputTime = now;
+	}
 
-			// Add adaptive trigger data
-			effectPacket.ucEnableBits1 |= 0x08 | 0x04; // Enable left and right trigger effect respectively
-			LoadTriggerEffect(effectPacket.rgucLeftTriggerEffect, &_leftTriggerEffect);
-			LoadTriggerEffect(effectPacket.rgucRightTriggerEffect, &_rightTriggerEffect);
+private:
+	void SendEffect()
+	{
+		DS5EffectsState_t effectPacket;
+		memset(&effectPacket, 0, sizeof(effectPacket));
 
-			// Add current rumbling data
-			effectPacket.ucEnableBits1 |= 0x01 | 0x02;
-			effectPacket.ucRumbleLeft = _big_rumble >> 8;
-			effectPacket.ucRumbleRight = _small_rumble >> 8;
+		// Add adaptive trigger data
+		effectPacket.ucEnableBits1 |= 0x08 | 0x04; // Enable left and right trigger effect respectively
+		PlayStationReports::WriteTriggerEffect(effectPacket.rgucLeftTriggerEffect, _output.leftTriggerEffect);
+		PlayStationReports::WriteTriggerEffect(effectPacket.rgucRightTriggerEffect, _output.rightTriggerEffect);
 
-			// Add current mic light
-			effectPacket.ucEnableBits2 |= 0x01;      /* Enable microphone light */
-			effectPacket.ucMicLightMode = _micLight; /* Bitmask, 0x00 = off, 0x01 = solid, 0x02 = pulse */
+		// Add current rumbling data
+		effectPacket.ucEnableBits1 |= 0x01 | 0x02;
+		effectPacket.ucRumbleLeft = _output.bigRumble >> 8;
+		effectPacket.ucRumbleRight = _output.smallRumble >> 8;
 
-			// Send to controller
-			SDL_GameControllerSendEffect(_sdlController, &effectPacket, sizeof(effectPacket));
+		// Add current mic light
+		effectPacket.ucEnableBits2 |= 0x01;             /* Enable microphone light */
+		effectPacket.ucMicLightMode = _output.micLight; /* Bitmask, 0x00 = off, 0x01 = solid, 0x02 = pulse */
+
+		// Add current light bar colour
+		if (_output.hasLightColour)
+		{
+			effectPacket.ucEnableBits2 |= 0x04; /* Enable LED color */
+			effectPacket.ucLedRed = (_output.lightColour >> 16) & 0xFF;
+			effectPacket.ucLedGreen = (_output.lightColour >> 8) & 0xFF;
+			effectPacket.ucLedBlue = _output.lightColour & 0xFF;
 		}
+
+		// Send to controller
+		SDL_GameControllerSendEffect(_sdlController, &effectPacket, sizeof(effectPacket));
 	}
 
+	static constexpr Uint32 RUMBLE_DURATION_MS = 1000;
+	static constexpr chrono::milliseconds RUMBLE_REFRESH{ 500 };
+
+	mutex _outputLock;
+	OutputState _output;
+	OutputState _sentOutput;
+	chrono::steady_clock::time_point _lastOutputTime;
+	chrono::steady_clock::time_point _lastRumbleTime;
+
+public:
 	bool _has_gyro;
 	bool _has_accel;
 	int _split_type = JS_SPLIT_TYPE_FULL;
 	int _ctrlr_type = 0;
-	uint16_t _small_rumble = 0;
-	uint16_t _big_rumble = 0;
-	AdaptiveTriggerSetting _leftTriggerEffect;
-	AdaptiveTriggerSetting _rightTriggerEffect;
-	uint8_t _micLight = 0;
 	SDL_GameController *_sdlController = nullptr;
+	SDL_JoystickID _instanceId = -1;
+	int _imuAddon = -1; // JoyShockLibrary handle of the gyro add-on routed to a device without sensors
+	DeviceFrame _frame{}; // Snapshot taken at the start of the tick
+
+	// Enough for a 1 kHz sensor at the longest tick time
+	static constexpr int MAX_SENSOR_SAMPLES = 128;
+	array<ImuSample, MAX_SENSOR_SAMPLES> _sensorSamples;
+	int _firstSensorSample = 0;
+	int _numSensorSamples = 0;
+	float _lastAccel[3] = { 0.f, 0.f, 0.f };
+	uint64_t _lastSensorTimestamp = 0;
+	float _sensorInterval = 0.f;
+
+	// For AUTO_TICK
+	ReportCadence _cadence;
+	bool _hasNewSensorData = false;
+	bool _isBusy = false; // The mapper has time based states to progress
+	atomic<float> _reportRate = 0.f; // in Hz, measured by _cadence
+	chrono::steady_clock::time_point _lastDispatch;
 };
 
 struct SdlInstance : public JslWrapper
@@ -243,6 +390,7 @@ public:
 		SDL_SetHint(SDL_HINT_JOYSTICK_HIDAPI_XBOX, "1");
 		SDL_SetHint(SDL_HINT_JOYSTICK_THREAD, "1");
 		SDL_Init(SDL_INIT_GAMECONTROLLER);
+		SDL_EventState(SDL_CONTROLLERSENSORUPDATE, SDL_ENABLE);
 	}
 
 	virtual ~SdlInstance()
@@ -255,123 +403,307 @@ public:
 		auto inst = static_cast<SdlInstance *>(obj);
 		while (inst->keep_polling)
 		{
-			SDL_Delay(tick_time.get());
+			bool autoTick = auto_tick.get() == Switch::ON;
+			if (autoTick)
+			{
+				tick_scheduler.WaitUntil(inst->NextAutoTick());
+			}
+			else
+			{
+				tick_scheduler.WaitNextTick(tick_time.get());
+			}
+
+			inst->NotifyConnectionChanges();
 
 			std::lock_guard guard(inst->controller_lock);
-			for (auto iter = inst->_controllerMap.begin(); iter != inst->_controllerMap.end(); ++iter)
+
+			// Update all controllers once
+			SDL_GameControllerUpdate();
+			inst->PumpDeviceEvents();
+			inst->PumpSensorEvents();
+
+			// Snapshot every device so that all callbacks see the same tick. With AUTO_TICK, devices without
+			// a new report are skipped unless the mapper has time based states to progress on them.
+			auto now = chrono::steady_clock::now();
+			auto fallback = chrono::duration<float, milli>(tick_time.get());
+			inst->_dispatchHandles.clear();
+			for (auto &pair : inst->_controllers)
 			{
-				SDL_GameControllerUpdate();
-				if (inst->g_callback)
+				ControllerDevice *device = pair.second.get();
+				DeviceFrame frame;
+				inst->ReadFrame(device, frame);
+				bool newData = device->_hasNewSensorData || !SameInput(frame, device->_frame);
+				device->_hasNewSensorData = false;
+				device->_cadence.Update(now, newData);
+				float periodMs = device->_cadence.GetPeriodMs();
+				device->_reportRate = periodMs > 0.f ? 1000.f / periodMs : 0.f;
+				device->_frame = frame;
+				if (!autoTick || newData || (device->_isBusy && now - device->_lastDispatch >= fallback))
 				{
-					JOY_SHOCK_STATE dummy1;
-					IMU_STATE dummy2;
-					memset(&dummy1, 0, sizeof(dummy1));
-					memset(&dummy2, 0, sizeof(dummy2));
-					inst->g_callback(iter->first, dummy1, dummy1, dummy2, dummy2, tick_time.get());
+					device->_lastDispatch = now;
+					inst->_dispatchHandles.push_back(pair.first);
 				}
-				if (inst->g_touch_callback)
+			}
+
+			// Run the mapping of each device. Each JoyShock has its own callback lock so they can run side by side.
+			size_t numThreads = size_t(max(0, poll_threads.get() - 1));
+			if (numThreads > 0 && inst->_dispatchHandles.size() > 1)
+			{
+				inst->_callbackPool.Resize(numThreads);
+				inst->_callbackPool.Run(inst->_dispatchHandles, [inst](int handle) { inst->DispatchCallbacks(handle); });
+			}
+			else
+			{
+				inst->_callbackPool.Resize(0);
+				for (int handle : inst->_dispatchHandles)
 				{
-					TOUCH_STATE touch = inst->GetTouchState(iter->first, false), dummy3;
-					memset(&dummy3, 0, sizeof(dummy3));
-					inst->g_touch_callback(iter->first, touch, dummy3, tick_time.get());
+					inst->DispatchCallbacks(handle);
 				}
-				// Perform rumble
-				SDL_GameControllerRumble(iter->second->_sdlController, iter->second->_big_rumble, iter->second->_small_rumble, tick_time.get() + 5);
 			}
+
+			if (inst->g_busy_callback)
+			{
+				for (int handle : inst->_dispatchHandles)
+				{
+					if (auto device = inst->_controllers.Get(handle))
+					{
+						device->_isBusy = inst->g_busy_callback(handle);
+					}
+				}
+			}
+
+			// Send the output reports
+			for (auto &pair : inst->_controllers)
+			{
+				pair.second->FlushOutput(output_report_interval.get());
+			}
+			tick_scheduler.EndTick();
 		}
 
 		return 1;
 	}
 
-	map<int, ControllerDevice *> _controllerMap;
-	void (*g_callback)(int, JOY_SHOCK_STATE, JOY_SHOCK_STATE, IMU_STATE, IMU_STATE, float) = nullptr;
-	void (*g_touch_callback)(int, TOUCH_STATE, TOUCH_STATE, float) = nullptr;
-	atomic_bool keep_polling = false;
-	std::mutex controller_lock;
-
-	int ConnectDevices() override
+	void DispatchCallbacks(int handle)
 	{
-		bool isFalse = false;
-		jsl->ConnectDevices();
-		if (keep_polling.compare_exchange_strong(isFalse, true))
+		if (g_callback)
 		{
-			// keep polling was false! It is set to true now.
-			SDL_Thread *controller_polling_thread = SDL_CreateThread(&SdlInstance::pollDevices, "Poll Devices", this);
-			SDL_DetachThread(controller_polling_thread);
+			JOY_SHOCK_STATE dummy1;
+			IMU_STATE dummy2;
+			memset(&dummy1, 0, sizeof(dummy1));
+			memset(&dummy2, 0, sizeof(dummy2));
+			g_callback(handle, dummy1, dummy1, dummy2, dummy2, tick_time.get());
+		}
+		auto device = _controllers.Get(handle);
+		if (g_touch_callback && device)
+		{
+			TOUCH_STATE dummy3;
+			memset(&dummy3, 0, sizeof(dummy3));
+			g_touch_callback(handle, device->_frame.touch, dummy3, tick_time.get());
 		}
-		SDL_GameControllerUpdate(); // Refresh driver listing
-		return SDL_NumJoysticks();
 	}
 
-	int GetConnectedDeviceHandles(int *deviceHandleArray, int size) override
+	// The next report expected from any device, and no later than tick_time after the last processing of a
+	// device with time based states
+	chrono::steady_clock::time_point NextAutoTick()
 	{
-		std::vector<int> dummyArray(size, -1);
-		jsl->GetConnectedDeviceHandles(dummyArray.data(), size);
+		auto fallback = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<float, milli>(tick_time.get()));
 		std::lock_guard guard(controller_lock);
-		auto iter = _controllerMap.begin();
-		while (iter != _controllerMap.end())
+		auto next = chrono::steady_clock::now() + fallback;
+		for (auto &pair : _controllers)
 		{
-			delete iter->second;
-			iter = _controllerMap.erase(iter);
+			next = min(next, pair.second->_cadence.NextPoll(fallback));
+			if (pair.second->_isBusy)
+			{
+				next = min(next, pair.second->_lastDispatch + fallback);
+			}
 		}
-		for (int i = 0; i < size; i++)
+		return next;
+	}
+
+	static bool SameInput(const DeviceFrame &lhs, const DeviceFrame &rhs)
+	{
+		return memcmp(&lhs.state, &rhs.state, sizeof(lhs.state)) == 0 && lhs.touch.t0Down == rhs.touch.t0Down &&
+		  lhs.touch.t1Down == rhs.touch.t1Down && lhs.touch.t0X == rhs.touch.t0X && lhs.touch.t0Y == rhs.touch.t0Y &&
+		  lhs.touch.t1X == rhs.touch.t1X && lhs.touch.t1Y == rhs.touch.t1Y;
+	}
+
+	// Tell the mapper about the devices added and removed during the previous tick. The mapper calls back into this
+	// instance to set the device up, so this must not be called with controller_lock held.
+	void NotifyConnectionChanges()
+	{
+		void (*callback)(int, bool) = nullptr;
+		vector<pair<int, bool>> changes;
 		{
-			ControllerDevice *device = new ControllerDevice(i);
-			if (device->isValid())
+			std::lock_guard guard(controller_lock);
+			callback = g_connection_callback;
+			changes.swap(_connectionChanges);
+		}
+		if (callback)
+		{
+			for (auto &change : changes)
 			{
-				deviceHandleArray[i] = i + 0; // used to be 'i + 1', but this is part of the hacky way to get the add-on to work
-				_controllerMap[deviceHandleArray[i]] = device;
+				callback(change.first, change.second);
 			}
-			else
+		}
+	}
+
+	// Open the controllers plugged in and close the ones unplugged, leaving the others untouched. Caller must hold controller_lock.
+	void PumpDeviceEvents()
+	{
+		SDL_Event events[8];
+		int count;
+		while ((count = SDL_PeepEvents(events, 8, SDL_GETEVENT, SDL_CONTROLLERDEVICEADDED, SDL_CONTROLLERDEVICEREMOVED)) > 0)
+		{
+			for (int i = 0; i < count; ++i)
 			{
-				delete device;
+				if (events[i].type == SDL_CONTROLLERDEVICEADDED)
+				{
+					// which is the device index here. The device may have been opened by GetConnectedDeviceHandles already.
+					if (FindHandle(SDL_JoystickGetDeviceInstanceID(events[i].cdevice.which)) == decltype(_controllers)::INVALID_HANDLE)
+					{
+						int handle = OpenDevice(events[i].cdevice.which);
+						if (handle != decltype(_controllers)::INVALID_HANDLE)
+						{
+							_connectionChanges.emplace_back(handle, true);
+							auto device = _controllers.Get(handle);
+							if (!device->_has_gyro && !device->_has_accel)
+							{
+								RouteImuAddons();
+							}
+						}
+					}
+				}
+				else
+				{
+					// which is the instance id here
+					int handle = FindHandle(events[i].cdevice.which);
+					auto device = _controllers.Get(handle);
+					bool neededMotion = device && (device->_imuAddon >= 0 || (!device->_has_gyro && !device->_has_accel));
+					if (RemoveDevice(handle))
+					{
+						_connectionChanges.emplace_back(handle, false);
+						if (neededMotion)
+						{
+							// Hand the add-ons over again, or let JoyShockLibrary go if no device needs one anymore
+							RouteImuAddons();
+						}
+					}
+				}
 			}
 		}
-		return _controllerMap.size();
 	}
 
-	void DisconnectAndDisposeAll() override
+	// Dispatch the queued sensor events to their device's sample buffer. Caller must hold controller_lock.
+	void PumpSensorEvents()
 	{
-		jsl->DisconnectAndDisposeAll();
-		lock_guard guard(controller_lock);
-		keep_polling = false;
-		g_callback = nullptr;
-		g_touch_callback = nullptr;
-		auto iter = _controllerMap.begin();
-		while (iter != _controllerMap.end())
+		SDL_Event events[32];
+		int count;
+		while ((count = SDL_PeepEvents(events, 32, SDL_GETEVENT, SDL_CONTROLLERSENSORUPDATE, SDL_CONTROLLERSENSORUPDATE)) > 0)
 		{
-			delete iter->second;
-			iter = _controllerMap.erase(iter);
+			for (int i = 0; i < count; ++i)
+			{
+				auto device = _controllers.Get(FindHandle(events[i].csensor.which));
+				if (device)
+				{
+					device->PushSensorEvent(events[i].csensor);
+				}
+			}
 		}
-		SDL_Delay(200);
+		// Button and axis states are read directly. Drop those events so they don't fill up the queue, but keep
+		// the device events for the next tick.
+		SDL_FlushEvents(SDL_JOYAXISMOTION, SDL_CONTROLLERDEVICEADDED - 1);
+		SDL_FlushEvents(SDL_CONTROLLERDEVICEREMAPPED, SDL_CONTROLLERSENSORUPDATE - 1);
 	}
 
-	JOY_SHOCK_STATE GetSimpleState(int deviceId) override
+	int FindHandle(SDL_JoystickID instanceId) const
 	{
-		return JOY_SHOCK_STATE();
+		auto entry = _handlesByInstance.find(instanceId);
+		return entry != _handlesByInstance.end() ? entry->second : decltype(_controllers)::INVALID_HANDLE;
 	}
 
-	IMU_STATE GetIMUState(int deviceId) override
+	int OpenDevice(int deviceIndex)
+	{
+		auto device = make_shared<ControllerDevice>(deviceIndex);
+		int handle = device->isValid() ? _controllers.Insert(device) : decltype(_controllers)::INVALID_HANDLE;
+		if (handle != decltype(_controllers)::INVALID_HANDLE)
+		{
+			_handlesByInstance[device->_instanceId] = handle;
+		}
+		return handle;
+	}
+
+	bool RemoveDevice(int handle)
+	{
+		auto device = _controllers.Get(handle);
+		if (device && _controllers.Remove(handle))
+		{
+			_handlesByInstance.erase(device->_instanceId);
+			return true;
+		}
+		return false;
+	}
+
+	// Every device is serviced by SDL, except the motion of devices SDL has no sensor for, which is routed to a
+	// gyro add-on read through JoyShockLibrary. JoyShockLibrary can only open every controller it knows at once,
+	// so it's only connected while such a device is present, instead of servicing all of them a second time.
+	// Caller must hold controller_lock.
+	void RouteImuAddons()
+	{
+		vector<ControllerDevice *> needMotion;
+		for (auto &pair : _controllers)
+		{
+			pair.second->_imuAddon = -1;
+			if (!pair.second->_has_gyro && !pair.second->_has_accel)
+			{
+				needMotion.push_back(pair.second.get());
+			}
+		}
+		if (needMotion.empty())
+		{
+			if (_jslConnected)
+			{
+				jsl->DisconnectAndDisposeAll();
+				_jslConnected = false;
+			}
+			return;
+		}
+
+		jsl->ConnectDevices();
+		_jslConnected = true;
+		array<int, decltype(_controllers)::CAPACITY> jslHandles;
+		int numJslHandles = jsl->GetConnectedDeviceHandles(jslHandles.data(), int(jslHandles.size()));
+		auto device = needMotion.begin();
+		for (int i = 0; i < numJslHandles && device != needMotion.end(); ++i)
+		{
+			if (jsl->GetControllerType(jslHandles[i]) == JS_TYPE_GAMEPAD_IMU_ADDON)
+			{
+				(*device++)->_imuAddon = jslHandles[i];
+			}
+		}
+	}
+
+	// Readers shared by the individual getters and GetFrame, so the latter only looks the device up once
+	IMU_STATE ReadIMUState(ControllerDevice *device)
 	{
 		IMU_STATE imuState;
 		memset(&imuState, 0, sizeof(imuState));
-		if (_controllerMap[deviceId]->_has_gyro)
+		if (device->_has_gyro)
 		{
 			array<float, 3> gyro;
-			SDL_GameControllerGetSensorData(_controllerMap[deviceId]->_sdlController, SDL_SENSOR_GYRO, &gyro[0], 3);
+			SDL_GameControllerGetSensorData(device->_sdlController, SDL_SENSOR_GYRO, &gyro[0], 3);
 			constexpr float toDegPerSec = 180.f / M_PI;
 			imuState.gyroX = gyro[0] * toDegPerSec;
 			imuState.gyroY = gyro[1] * toDegPerSec;
 			imuState.gyroZ = gyro[2] * toDegPerSec;
 		}
-		else if (!_controllerMap[deviceId]->_has_accel)
+		else if (!device->_has_accel && device->_imuAddon >= 0)
 		{
-			imuState = jsl->GetIMUState(deviceId);
+			imuState = jsl->GetIMUState(device->_imuAddon);
 		}
-		if (_controllerMap[deviceId]->_has_accel)
+		if (device->_has_accel)
 		{
 			array<float, 3> accel;
-			SDL_GameControllerGetSensorData(_controllerMap[deviceId]->_sdlController, SDL_SENSOR_ACCEL, &accel[0], 3);
+			SDL_GameControllerGetSensorData(device->_sdlController, SDL_SENSOR_ACCEL, &accel[0], 3);
 			constexpr float toGs = 1.f / 9.8f;
 			imuState.accelX = accel[0] * toGs;
 			imuState.accelY = accel[1] * toGs;
@@ -380,17 +712,12 @@ public:
 		return imuState;
 	}
 
-	MOTION_STATE GetMotionState(int deviceId) override
-	{
-		return MOTION_STATE();
-	}
-
-	TOUCH_STATE GetTouchState(int deviceId, bool previous) override
+	static TOUCH_STATE ReadTouchState(ControllerDevice *device)
 	{
 		uint8_t state0 = 0, state1 = 0;
 		TOUCH_STATE state;
 		memset(&state, 0, sizeof(TOUCH_STATE));
-		if (SDL_GameControllerGetTouchpadFinger(_controllerMap[deviceId]->_sdlController, 0, 0, &state0, &state.t0X, &state.t0Y, nullptr) == 0 && SDL_GameControllerGetTouchpadFinger(_controllerMap[deviceId]->_sdlController, 0, 1, &state1, &state.t1X, &state.t1Y, nullptr) == 0)
+		if (SDL_GameControllerGetTouchpadFinger(device->_sdlController, 0, 0, &state0, &state.t0X, &state.t0Y, nullptr) == 0 && SDL_GameControllerGetTouchpadFinger(device->_sdlController, 0, 1, &state1, &state.t1X, &state.t1Y, nullptr) == 0)
 		{
 			state.t0Down = state0 == SDL_PRESSED;
 			state.t1Down = state1 == SDL_PRESSED;
@@ -398,33 +725,27 @@ public:
 		return state;
 	}
 
-	bool GetTouchpadDimension(int deviceId, int &sizeX, int &sizeY) override
+	static void ReadTouchpadDimension(ControllerDevice *device, int &sizeX, int &sizeY)
 	{
 		// I am assuming a single touchpad (or all touchpads are the same dimension)?
-		auto *jc = _controllerMap[deviceId];
-		if (jc != nullptr)
+		switch (device->_ctrlr_type)
 		{
-			switch (_controllerMap[deviceId]->_ctrlr_type)
-			{
-			case JS_TYPE_DS4:
-			case JS_TYPE_DS:
-				// Matching SDL2 resolution
-				sizeX = 1920;
-				sizeY = 920;
-				break;
-			default:
-				sizeX = 0;
-				sizeY = 0;
-				break;
-			}
-			return true;
+		case JS_TYPE_DS4:
+		case JS_TYPE_DS:
+			// Matching SDL2 resolution
+			sizeX = 1920;
+			sizeY = 920;
+			break;
+		default:
+			sizeX = 0;
+			sizeY = 0;
+			break;
 		}
-		return false;
 	}
 
-	int GetButtons(int deviceId) override
+	static int ReadButtons(ControllerDevice *device)
 	{
-		static const std::map<int, int> sdl2jsl = {
+		static constexpr pair<SDL_GameControllerButton, int> sdl2jsl[] = {
 			{ SDL_CONTROLLER_BUTTON_A, JSOFFSET_S },
 			{ SDL_CONTROLLER_BUTTON_B, JSOFFSET_E },
 			{ SDL_CONTROLLER_BUTTON_X, JSOFFSET_W },
@@ -440,90 +761,239 @@ public:
 			{ SDL_CONTROLLER_BUTTON_DPAD_DOWN, JSOFFSET_DOWN },
 			{ SDL_CONTROLLER_BUTTON_DPAD_LEFT, JSOFFSET_LEFT },
 			{ SDL_CONTROLLER_BUTTON_DPAD_RIGHT, JSOFFSET_RIGHT },
-			{ SDL_CONTROLLER_BUTTON_PADDLE2, JSOFFSET_SL },  // LSL
-			{ SDL_CONTROLLER_BUTTON_PADDLE4, JSOFFSET_SR },  // LSR
+			{ SDL_CONTROLLER_BUTTON_PADDLE2, JSOFFSET_SL }, // LSL
+			{ SDL_CONTROLLER_BUTTON_PADDLE4, JSOFFSET_SR }, // LSR
 		};
+		SDL_GameController *controller = device->_sdlController;
 		int buttons = 0;
-		for (auto pair : sdl2jsl)
+		for (auto &pair : sdl2jsl)
 		{
-			buttons |= SDL_GameControllerGetButton(_controllerMap[deviceId]->_sdlController, SDL_GameControllerButton(pair.first)) > 0 ? 1 << pair.second : 0;
+			buttons |= SDL_GameControllerGetButton(controller, pair.first) > 0 ? 1 << pair.second : 0;
 		}
-		switch (_controllerMap[deviceId]->_ctrlr_type)
+		switch (device->_ctrlr_type)
 		{
 		case JS_TYPE_DS:
-			buttons |= SDL_GameControllerGetButton(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_BUTTON_MISC1) > 0 ? 1 << JSOFFSET_MIC : 0;
+			buttons |= SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_MISC1) > 0 ? 1 << JSOFFSET_MIC : 0;
 			// Intentional fall through to the next case
 		case JS_TYPE_DS4:
-			buttons |= SDL_GameControllerGetButton(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_BUTTON_TOUCHPAD) > 0 ? 1 << JSOFFSET_CAPTURE : 0;
+			buttons |= SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_TOUCHPAD) > 0 ? 1 << JSOFFSET_CAPTURE : 0;
 			break;
 		case JS_TYPE_JOYCON_RIGHT:
-			buttons |= SDL_GameControllerGetButton(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_BUTTON_PADDLE3) > 0 ? 1 << JSOFFSET_SL : 0;
-			buttons |= SDL_GameControllerGetButton(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_BUTTON_PADDLE1) > 0 ? 1 << JSOFFSET_SR : 0;
+			buttons |= SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_PADDLE3) > 0 ? 1 << JSOFFSET_SL : 0;
+			buttons |= SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_PADDLE1) > 0 ? 1 << JSOFFSET_SR : 0;
 		default:
-			buttons |= SDL_GameControllerGetButton(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_BUTTON_MISC1) > 0 ? 1 << JSOFFSET_CAPTURE : 0;
-			buttons |= SDL_GameControllerGetButton(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_BUTTON_PADDLE3) > 0 ? 1 << JSOFFSET_SL2 : 0;
-			buttons |= SDL_GameControllerGetButton(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_BUTTON_PADDLE1) > 0 ? 1 << JSOFFSET_SR2 : 0;
+			buttons |= SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_MISC1) > 0 ? 1 << JSOFFSET_CAPTURE : 0;
+			buttons |= SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_PADDLE3) > 0 ? 1 << JSOFFSET_SL2 : 0;
+			buttons |= SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_PADDLE1) > 0 ? 1 << JSOFFSET_SR2 : 0;
 			break;
 		}
 		return buttons;
 	}
 
+	static float ReadAxis(ControllerDevice *device, SDL_GameControllerAxis axis)
+	{
+		return SDL_GameControllerGetAxis(device->_sdlController, axis) / (float)SDL_JOYSTICK_AXIS_MAX;
+	}
+
+	void ReadFrame(ControllerDevice *device, DeviceFrame &frame)
+	{
+		frame.state.buttons = ReadButtons(device);
+		frame.state.lTrigger = ReadAxis(device, SDL_CONTROLLER_AXIS_TRIGGERLEFT);
+		frame.state.rTrigger = ReadAxis(device, SDL_CONTROLLER_AXIS_TRIGGERRIGHT);
+		frame.state.stickLX = ReadAxis(device, SDL_CONTROLLER_AXIS_LEFTX);
+		frame.state.stickLY = -ReadAxis(device, SDL_CONTROLLER_AXIS_LEFTY);
+		frame.state.stickRX = ReadAxis(device, SDL_CONTROLLER_AXIS_RIGHTX);
+		frame.state.stickRY = -ReadAxis(device, SDL_CONTROLLER_AXIS_RIGHTY);
+		frame.imu = ReadIMUState(device);
+		frame.touch = ReadTouchState(device);
+		ReadTouchpadDimension(device, frame.touchpadSizeX, frame.touchpadSizeY);
+		frame.controllerType = device->_ctrlr_type;
+		frame.splitType = device->_split_type;
+		frame.timestamp = device->_lastSensorTimestamp;
+	}
+
+	// Handles given to the mapper are slots of this table. A stale handle finds nothing instead of another device.
+	SlotTable<ControllerDevice> _controllers;
+	map<SDL_JoystickID, int> _handlesByInstance; // Of the devices in _controllers, for the SDL events
+	void (*g_callback)(int, JOY_SHOCK_STATE, JOY_SHOCK_STATE, IMU_STATE, IMU_STATE, float) = nullptr;
+	void (*g_touch_callback)(int, TOUCH_STATE, TOUCH_STATE, float) = nullptr;
+	void (*g_connection_callback)(int, bool) = nullptr;
+	bool (*g_busy_callback)(int) = nullptr;
+	vector<pair<int, bool>> _connectionChanges; // Handle and whether it was connected, waiting to be told to the mapper
+	bool _jslConnected = false; // Whether JoyShockLibrary is open for gyro add-ons
+	atomic_bool keep_polling = false;
+	std::mutex controller_lock;
+	vector<int> _dispatchHandles;
+	CallbackPool _callbackPool;
+
+	int ConnectDevices() override
+	{
+		bool isFalse = false;
+		if (keep_polling.compare_exchange_strong(isFalse, true))
+		{
+			// keep polling was false! It is set to true now.
+			tick_scheduler.Reset();
+			SDL_Thread *controller_polling_thread = SDL_CreateThread(&SdlInstance::pollDevices, "Poll Devices", this);
+			SDL_DetachThread(controller_polling_thread);
+		}
+		SDL_GameControllerUpdate(); // Refresh driver listing
+		return SDL_NumJoysticks();
+	}
+
+	int GetConnectedDeviceHandles(int *deviceHandleArray, int size) override
+	{
+		std::lock_guard guard(controller_lock);
+		// Devices that are open already keep their handle and state
+		int count = 0;
+		for (int i = 0; i < size; i++)
+		{
+			int handle = FindHandle(SDL_JoystickGetDeviceInstanceID(i));
+			if (handle == decltype(_controllers)::INVALID_HANDLE)
+			{
+				handle = OpenDevice(i);
+			}
+			if (handle != decltype(_controllers)::INVALID_HANDLE)
+			{
+				deviceHandleArray[count++] = handle;
+			}
+		}
+		for (auto &pair : _controllers)
+		{
+			if (find(deviceHandleArray, deviceHandleArray + count, pair.first) == deviceHandleArray + count)
+			{
+				RemoveDevice(pair.first);
+			}
+		}
+		RouteImuAddons();
+		// The caller gets the complete list
+		_connectionChanges.clear();
+		return count;
+	}
+
+	void DisconnectAndDisposeAll() override
+	{
+		lock_guard guard(controller_lock);
+		if (_jslConnected)
+		{
+			jsl->DisconnectAndDisposeAll();
+			_jslConnected = false;
+		}
+		keep_polling = false;
+		_callbackPool.Resize(0);
+		g_callback = nullptr;
+		g_touch_callback = nullptr;
+		g_connection_callback = nullptr;
+		g_busy_callback = nullptr;
+		_connectionChanges.clear();
+		_controllers.Clear();
+		_handlesByInstance.clear();
+		SDL_Delay(200);
+	}
+
+	JOY_SHOCK_STATE GetSimpleState(int deviceId) override
+	{
+		return JOY_SHOCK_STATE();
+	}
+
+	IMU_STATE GetIMUState(int deviceId) override
+	{
+		auto device = _controllers.Get(deviceId);
+		return device ? ReadIMUState(device.get()) : IMU_STATE();
+	}
+
+	MOTION_STATE GetMotionState(int deviceId) override
+	{
+		return MOTION_STATE();
+	}
+
+	TOUCH_STATE GetTouchState(int deviceId, bool previous) override
+	{
+		auto device = _controllers.Get(deviceId);
+		return device ? ReadTouchState(device.get()) : TOUCH_STATE();
+	}
+
+	bool GetTouchpadDimension(int deviceId, int &sizeX, int &sizeY) override
+	{
+		auto jc = _controllers.Get(deviceId);
+		if (jc != nullptr)
+		{
+			ReadTouchpadDimension(jc.get(), sizeX, sizeY);
+			return true;
+		}
+		return false;
+	}
+
+	int GetButtons(int deviceId) override
+	{
+		auto device = _controllers.Get(deviceId);
+		return device ? ReadButtons(device.get()) : 0;
+	}
+
 	float GetLeftX(int deviceId) override
 	{
-		return SDL_GameControllerGetAxis(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_AXIS_LEFTX) / (float)SDL_JOYSTICK_AXIS_MAX;
+		auto device = _controllers.Get(deviceId);
+		return device ? ReadAxis(device.get(), SDL_CONTROLLER_AXIS_LEFTX) : 0.f;
 	}
 
 	float GetLeftY(int deviceId) override
 	{
-		return -SDL_GameControllerGetAxis(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_AXIS_LEFTY) / (float)SDL_JOYSTICK_AXIS_MAX;
+		auto device = _controllers.Get(deviceId);
+		return device ? -ReadAxis(device.get(), SDL_CONTROLLER_AXIS_LEFTY) : 0.f;
 	}
 
 	float GetRightX(int deviceId) override
 	{
-		return SDL_GameControllerGetAxis(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_AXIS_RIGHTX) / (float)SDL_JOYSTICK_AXIS_MAX;
+		auto device = _controllers.Get(deviceId);
+		return device ? ReadAxis(device.get(), SDL_CONTROLLER_AXIS_RIGHTX) : 0.f;
 	}
 
 	float GetRightY(int deviceId) override
 	{
-		return -SDL_GameControllerGetAxis(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_AXIS_RIGHTY) / (float)SDL_JOYSTICK_AXIS_MAX;
+		auto device = _controllers.Get(deviceId);
+		return device ? -ReadAxis(device.get(), SDL_CONTROLLER_AXIS_RIGHTY) : 0.f;
 	}
 
 	float GetLeftTrigger(int deviceId) override
 	{
-		return SDL_GameControllerGetAxis(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_AXIS_TRIGGERLEFT) / (float)SDL_JOYSTICK_AXIS_MAX;
+		auto device = _controllers.Get(deviceId);
+		return device ? ReadAxis(device.get(), SDL_CONTROLLER_AXIS_TRIGGERLEFT) : 0.f;
 	}
 
 	float GetRightTrigger(int deviceId) override
 	{
-		return SDL_GameControllerGetAxis(_controllerMap[deviceId]->_sdlController, SDL_CONTROLLER_AXIS_TRIGGERRIGHT) / (float)SDL_JOYSTICK_AXIS_MAX;
+		auto device = _controllers.Get(deviceId);
+		return device ? ReadAxis(device.get(), SDL_CONTROLLER_AXIS_TRIGGERRIGHT) : 0.f;
 	}
 
 	float GetGyroX(int deviceId) override
 	{
-		if (_controllerMap[deviceId]->_has_gyro)
+		auto device = _controllers.Get(deviceId);
+		if (device && device->_has_gyro)
 		{
 			float rawGyro[3];
-			SDL_GameControllerGetSensorData(_controllerMap[deviceId]->_sdlController, SDL_SENSOR_GYRO, rawGyro, 3);
+			SDL_GameControllerGetSensorData(device->_sdlController, SDL_SENSOR_GYRO, rawGyro, 3);
 		}
 		return float();
 	}
 
 	float GetGyroY(int deviceId) override
 	{
-		if (_controllerMap[deviceId]->_has_gyro)
+		auto device = _controllers.Get(deviceId);
+		if (device && device->_has_gyro)
 		{
 			float rawGyro[3];
-			SDL_GameControllerGetSensorData(_controllerMap[deviceId]->_sdlController, SDL_SENSOR_GYRO, rawGyro, 3);
+			SDL_GameControllerGetSensorData(device->_sdlController, SDL_SENSOR_GYRO, rawGyro, 3);
 		}
 		return float();
 	}
 
 	float GetGyroZ(int deviceId) override
 	{
-		if (_controllerMap[deviceId]->_has_gyro)
+		auto device = _controllers.Get(deviceId);
+		if (device && device->_has_gyro)
 		{
 			float rawGyro[3];
-			SDL_GameControllerGetSensorData(_controllerMap[deviceId]->_sdlController, SDL_SENSOR_GYRO, rawGyro, 3);
+			SDL_GameControllerGetSensorData(device->_sdlController, SDL_SENSOR_GYRO, rawGyro, 3);
 		}
 		return float();
 	}
@@ -551,7 +1021,8 @@ public:
 	bool GetTouchDown(int deviceId, bool secondTouch)
 	{
 		uint8_t touchState = 0;
-		if (SDL_GameControllerGetTouchpadFinger(_controllerMap[deviceId]->_sdlController, 0, secondTouch ? 1 : 0, &touchState, nullptr, nullptr, nullptr) == 0)
+		auto device = _controllers.Get(deviceId);
+		if (device && SDL_GameControllerGetTouchpadFinger(device->_sdlController, 0, secondTouch ? 1 : 0, &touchState, nullptr, nullptr, nullptr) == 0)
 		{
 			return touchState == SDL_PRESSED;
 		}
@@ -561,7 +1032,8 @@ public:
 	float GetTouchX(int deviceId, bool secondTouch = false) override
 	{
 		float x = 0;
-		if (SDL_GameControllerGetTouchpadFinger(_controllerMap[deviceId]->_sdlController, 0, secondTouch ? 1 : 0, nullptr, nullptr, &x, nullptr) == 0)
+		auto device = _controllers.Get(deviceId);
+		if (device && SDL_GameControllerGetTouchpadFinger(device->_sdlController, 0, secondTouch ? 1 : 0, nullptr, nullptr, &x, nullptr) == 0)
 		{
 			return x;
 		}
@@ -571,7 +1043,8 @@ public:
 	float GetTouchY(int deviceId, bool secondTouch = false) override
 	{
 		float y = 0;
-		if (SDL_GameControllerGetTouchpadFinger(_controllerMap[deviceId]->_sdlController, 0, secondTouch ? 1 : 0, nullptr, nullptr, &y, nullptr) == 0)
+		auto device = _controllers.Get(deviceId);
+		if (device && SDL_GameControllerGetTouchpadFinger(device->_sdlController, 0, secondTouch ? 1 : 0, nullptr, nullptr, &y, nullptr) == 0)
 		{
 			return y;
 		}
@@ -590,7 +1063,8 @@ public:
 
 	float GetPollRate(int deviceId) override
 	{
-		return float();
+		auto device = _controllers.Get(deviceId);
+		return device ? device->_reportRate.load() : 0.f;
 	}
 
 	void ResetContinuousCalibration(int deviceId) override
@@ -625,14 +1099,28 @@ public:
 		g_touch_callback = callback;
 	}
 
+	void SetConnectionCallback(void (*callback)(int, bool)) override
+	{
+		std::lock_guard guard(controller_lock);
+		g_connection_callback = callback;
+	}
+
+	void SetBusyCallback(bool (*callback)(int)) override
+	{
+		std::lock_guard guard(controller_lock);
+		g_busy_callback = callback;
+	}
+
 	int GetControllerType(int deviceId) override
 	{
-		return _controllerMap[deviceId]->_ctrlr_type;
+		auto device = _controllers.Get(deviceId);
+		return device ? device->_ctrlr_type : 0;
 	}
 
 	int GetControllerSplitType(int deviceId) override
 	{
-		return _controllerMap[deviceId]->_split_type;
+		auto device = _controllers.Get(deviceId);
+		return device ? device->_split_type : 0;
 	}
 
 	int GetControllerColour(int deviceId) override
@@ -640,52 +1128,77 @@ public:
 		return int();
 	}
 
+	// The output setters only record the new state. It is sent when the poll thread flushes the outputs.
 	void SetLightColour(int deviceId, int colour) override
 	{
-		if (SDL_GameControllerHasLED(_controllerMap[deviceId]->_sdlController))
+		auto device = _controllers.Get(deviceId);
+		if (device && SDL_GameControllerHasLED(device->_sdlController))
 		{
-			union
-			{
-				uint32_t raw;
-				uint8_t argb[4];
-			} uColour;
-			uColour.raw = colour;
-			SDL_GameControllerSetLED(_controllerMap[deviceId]->_sdlController, uColour.argb[2], uColour.argb[1], uColour.argb[0]);
+			device->UpdateOutput([colour](OutputState &output) {
+				output.hasLightColour = true;
+				output.lightColour = uint32_t(colour) & 0xFFFFFF;
+			});
 		}
 	}
 
 	void SetRumble(int deviceId, int smallRumble, int bigRumble) override
 	{
-		// Rumble command needs to be sent at every poll in SDL, so the next value is set here and the actual call
-		// is done after the callback return
-		_controllerMap[deviceId]->_small_rumble = clamp(smallRumble, 0, int(UINT16_MAX));
-		_controllerMap[deviceId]->_big_rumble = clamp(bigRumble, 0, int(UINT16_MAX));
+		auto device = _controllers.Get(deviceId);
+		if (device)
+		{
+			device->UpdateOutput([smallRumble, bigRumble](OutputState &output) {
+				output.smallRumble = clamp(smallRumble, 0, int(UINT16_MAX));
+				output.bigRumble = clamp(bigRumble, 0, int(UINT16_MAX));
+			});
+		}
 	}
 
 	void SetPlayerNumber(int deviceId, int number) override
 	{
-		SDL_GameControllerSetPlayerIndex(_controllerMap[deviceId]->_sdlController, number);
+		auto device = _controllers.Get(deviceId);
+		if (device)
+		{
+			SDL_GameControllerSetPlayerIndex(device->_sdlController, number);
+		}
 	}
 
 	void SetTriggerEffect(int deviceId, const AdaptiveTriggerSetting &_leftTriggerEffect, const AdaptiveTriggerSetting &_rightTriggerEffect) override
 	{
-		if (_leftTriggerEffect != _controllerMap[deviceId]->_leftTriggerEffect || _rightTriggerEffect != _controllerMap[deviceId]->_rightTriggerEffect)
+		auto device = _controllers.Get(deviceId);
+		if (device)
 		{
-			// Update active trigger effect
-			_controllerMap[deviceId]->_leftTriggerEffect = _leftTriggerEffect;
-			_controllerMap[deviceId]->_rightTriggerEffect = _rightTriggerEffect;
+			device->UpdateOutput([&](OutputState &output) {
+				output.leftTriggerEffect = _leftTriggerEffect;
+				output.rightTriggerEffect = _rightTriggerEffect;
+			});
+		}
+	}
 
-			_controllerMap[deviceId]->SendEffect();
+	int GetIMUSamples(int deviceId, ImuSample *samples, int maxSamples) override
+	{
+		auto device = _controllers.Get(deviceId);
+		return device ? device->PopSensorSamples(samples, maxSamples) : 0;
+	}
+
+	void GetFrame(int deviceId, DeviceFrame &frame) override
+	{
+		auto device = _controllers.Get(deviceId);
+		if (!device)
+		{
+			frame = DeviceFrame{};
+			return;
 		}
+		frame = device->_frame;
 	}
 
 	virtual void SetMicLight(int deviceId, uint8_t mode) override
 	{
-		if (mode != _controllerMap[deviceId]->_micLight)
+		auto device = _controllers.Get(deviceId);
+		if (device)
 		{
-			_controllerMap[deviceId]->_micLight = mode;
-
-			_controllerMap[deviceId]->SendEffect();
+			device->UpdateOutput([mode](OutputState &output) {
+				output.micLight = mode;
+			});
 		}
 	}
 };
@@ -0,0 +1,710 @@
+#include "SyntheticWrapper.h"
+#include "CallbackPool.h"
+#include "InputTrace.h"
+#include "JSMVariable.hpp"
+#include "TickScheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+extern JSMVariable<float> tick_time; // defined in main.cc
+extern JSMVariable<int> poll_threads; // defined in main.cc
+extern TickScheduler tick_scheduler; // defined in main.cc
+
+namespace
+{
+constexpr float PI_F = 3.14159265f;
+
+// Fills a frame with the input of a controller at the given time in seconds. Time only moves forward.
+class Generator
+{
+public:
+	virtual ~Generator()
+	{
+	}
+	virtual void Evaluate(double time, DeviceFrame &frame) = 0;
+};
+
+// Circles on the sticks and waves on the other inputs, whose frequency sweeps up and starts over
+class SineGenerator : public Generator
+{
+public:
+	SineGenerator(int seed)
+	  : _offset(seed * 0.37f)
+	{
+	}
+
+	void Evaluate(double time, DeviceFrame &frame) override
+	{
+		static constexpr double SWEEP_TIME = 10.0;
+		static constexpr double LOW_FREQUENCY = 0.1;
+		static constexpr double HIGH_FREQUENCY = 3.0;
+		double t = fmod(time + _offset, SWEEP_TIME);
+		float phase = float(2.0 * PI_F * (LOW_FREQUENCY * t + (HIGH_FREQUENCY - LOW_FREQUENCY) * t * t / (2.0 * SWEEP_TIME)));
+
+		frame.state.stickLX = 0.9f * cosf(phase);
+		frame.state.stickLY = 0.9f * sinf(phase);
+		frame.state.stickRX = 0.9f * cosf(1.3f * phase);
+		frame.state.stickRY = 0.9f * sinf(1.3f * phase);
+		frame.state.lTrigger = 0.5f + 0.5f * sinf(phase);
+		frame.state.rTrigger = 0.5f + 0.5f * cosf(phase);
+		frame.imu.gyroX = 360.f * sinf(phase);
+		frame.imu.gyroY = 200.f * cosf(0.7f * phase);
+		frame.imu.gyroZ = 50.f * sinf(1.1f * phase);
+		frame.imu.accelX = 0.f;
+		frame.imu.accelY = 1.f;
+		frame.imu.accelZ = 0.f;
+		frame.touch.t0Down = fmod(time, 1.0) < 0.5;
+		frame.touch.t0X = 0.5f + 0.4f * cosf(phase);
+		frame.touch.t0Y = 0.5f + 0.4f * sinf(phase);
+		frame.touch.t1Down = false;
+	}
+
+private:
+	float _offset;
+};
+
+// Brownian motion of every input, bounded to its range
+class WalkGenerator : public Generator
+{
+public:
+	WalkGenerator(int seed)
+	  : _random(seed)
+	{
+	}
+
+	void Evaluate(double time, DeviceFrame &frame) override
+	{
+		float dt = _lastTime < 0.0 ? 0.f : float(time - _lastTime);
+		_lastTime = time;
+		float scale = sqrtf(dt);
+		auto step = [this, scale](float &value, float speed, float low, float high) {
+			value = clamp(value + _normal(_random) * speed * scale, low, high);
+		};
+		step(_state.stickLX, 1.f, -1.f, 1.f);
+		step(_state.stickLY, 1.f, -1.f, 1.f);
+		step(_state.stickRX, 1.f, -1.f, 1.f);
+		step(_state.stickRY, 1.f, -1.f, 1.f);
+		step(_state.lTrigger, 1.f, 0.f, 1.f);
+		step(_state.rTrigger, 1.f, 0.f, 1.f);
+		step(_imu.gyroX, 300.f, -1000.f, 1000.f);
+		step(_imu.gyroY, 300.f, -1000.f, 1000.f);
+		step(_imu.gyroZ, 100.f, -1000.f, 1000.f);
+		step(_touchX, 0.5f, 0.f, 1.f);
+		step(_touchY, 0.5f, 0.f, 1.f);
+		frame.state.stickLX = _state.stickLX;
+		frame.state.stickLY = _state.stickLY;
+		frame.state.stickRX = _state.stickRX;
+		frame.state.stickRY = _state.stickRY;
+		frame.state.lTrigger = _state.lTrigger;
+		frame.state.rTrigger = _state.rTrigger;
+		frame.imu = _imu;
+		frame.imu.accelY = 1.f;
+		frame.touch.t0Down = _touchX > 0.25f;
+		frame.touch.t0X = _touchX;
+		frame.touch.t0Y = _touchY;
+		frame.touch.t1Down = false;
+	}
+
+private:
+	mt19937 _random;
+	normal_distribution<float> _normal;
+	double _lastTime = -1.0;
+	JOY_SHOCK_STATE _state{};
+	IMU_STATE _imu{};
+	float _touchX = 0.f;
+	float _touchY = 0.f;
+};
+
+// Taps each button of the controller in turn, with a long hold and a chord every few steps
+class ButtonGenerator : public Generator
+{
+public:
+	ButtonGenerator(int splitType, int controllerType)
+	{
+		static constexpr int LEFT_JOYCON[] = { JSOFFSET_UP, JSOFFSET_DOWN, JSOFFSET_LEFT, JSOFFSET_RIGHT, JSOFFSET_MINUS, JSOFFSET_LCLICK,
+			JSOFFSET_L, JSOFFSET_ZL, JSOFFSET_CAPTURE, JSOFFSET_SL, JSOFFSET_SR };
+		static constexpr int RIGHT_JOYCON[] = { JSOFFSET_N, JSOFFSET_E, JSOFFSET_S, JSOFFSET_W, JSOFFSET_PLUS, JSOFFSET_RCLICK,
+			JSOFFSET_R, JSOFFSET_ZR, JSOFFSET_HOME, JSOFFSET_SL, JSOFFSET_SR };
+		if (splitType == JS_SPLIT_TYPE_LEFT)
+		{
+			_buttons.assign(begin(LEFT_JOYCON), end(LEFT_JOYCON));
+		}
+		else if (splitType == JS_SPLIT_TYPE_RIGHT)
+		{
+			_buttons.assign(begin(RIGHT_JOYCON), end(RIGHT_JOYCON));
+		}
+		else
+		{
+			for (int offset = JSOFFSET_UP; offset <= (controllerType == JS_TYPE_DS ? JSOFFSET_MIC : JSOFFSET_CAPTURE); ++offset)
+			{
+				_buttons.push_back(offset);
+			}
+		}
+	}
+
+	void Evaluate(double time, DeviceFrame &frame) override
+	{
+		static constexpr double STEP_TIME = 0.25;
+		static constexpr double TAP_TIME = 0.08;
+		size_t step = size_t(time / STEP_TIME);
+		double phase = fmod(time, STEP_TIME);
+		int button = _buttons[step % _buttons.size()];
+		int next = _buttons[(step + 1) % _buttons.size()];
+		frame.state = JOY_SHOCK_STATE{};
+		switch (step % 8)
+		{
+		case 5: // Hold through the whole step
+			frame.state.buttons = 1 << button;
+			break;
+		case 7: // Chord with the next button
+			frame.state.buttons = phase < STEP_TIME - TAP_TIME ? (1 << button) | (1 << next) : 0;
+			break;
+		default:
+			frame.state.buttons = phase < TAP_TIME ? 1 << button : 0;
+			break;
+		}
+		frame.state.lTrigger = (frame.state.buttons & JSMASK_ZL) ? 1.f : 0.f;
+		frame.state.rTrigger = (frame.state.buttons & JSMASK_ZR) ? 1.f : 0.f;
+		frame.imu = IMU_STATE{};
+		frame.imu.accelY = 1.f;
+		frame.touch = TOUCH_STATE{};
+	}
+
+private:
+	vector<int> _buttons;
+};
+
+// Loops over the frames recorded for the first device of a trace
+class TraceGenerator : public Generator
+{
+public:
+	TraceGenerator(const InputTrace &trace)
+	{
+		size_t offset = 0;
+		const InputTraceFormat::RecordHeader *record;
+		while ((record = trace.Next(offset)) != nullptr)
+		{
+			if (record->type == InputTraceFormat::FRAME && record->handle == trace.GetHandles().front())
+			{
+				_frames.push_back(*reinterpret_cast<const InputTraceFormat::FrameRecord *>(record));
+			}
+		}
+		_duration = (_frames.back().header.time - _frames.front().header.time) / 1000000.0 + 0.001;
+	}
+
+	void Evaluate(double time, DeviceFrame &frame) override
+	{
+		double t = _frames.front().header.time / 1000000.0 + fmod(time, _duration);
+		if (t < _frames[_current].header.time / 1000000.0)
+		{
+			_current = 0; // Looped
+		}
+		while (_current + 1 < _frames.size() && _frames[_current + 1].header.time / 1000000.0 <= t)
+		{
+			++_current;
+		}
+		frame.state = _frames[_current].state;
+		frame.imu = _frames[_current].imu;
+		frame.touch = _frames[_current].touch;
+	}
+
+private:
+	vector<InputTraceFormat::FrameRecord> _frames;
+	double _duration;
+	size_t _current = 0;
+};
+
+class SyntheticWrapper : public JslWrapper
+{
+public:
+	struct Device
+	{
+		int controllerType = 0;
+		int splitType = JS_SPLIT_TYPE_FULL;
+		float sampleRate = 0.f; // of the IMU
+		unique_ptr<Generator> generator;
+		DeviceFrame frame{};
+		vector<ImuSample> samples;
+		double nextSampleTime = 0.0;
+	};
+
+	SyntheticWrapper(vector<Device> &&devices)
+	  : _devices(move(devices))
+	{
+	}
+
+	~SyntheticWrapper()
+	{
+		DisconnectAndDisposeAll();
+	}
+
+	int ConnectDevices() override
+	{
+		if (!_thread.joinable())
+		{
+			_keepPolling = true;
+			tick_scheduler.Reset();
+			_thread = thread(&SyntheticWrapper::Poll, this);
+		}
+		return int(_devices.size());
+	}
+
+	int GetConnectedDeviceHandles(int *deviceHandleArray, int size) override
+	{
+		int count = min(size, int(_devices.size()));
+		for (int i = 0; i < count; ++i)
+		{
+			deviceHandleArray[i] = i;
+		}
+		return count;
+	}
+
+	void DisconnectAndDisposeAll() override
+	{
+		_keepPolling = false;
+		if (_thread.joinable())
+		{
+			_thread.join();
+		}
+		lock_guard guard(_lock);
+		_callbackPool.Resize(0);
+		_callback = nullptr;
+		_touchCallback = nullptr;
+	}
+
+	void GetFrame(int deviceId, DeviceFrame &frame) override
+	{
+		frame = Frame(deviceId);
+	}
+
+	int GetIMUSamples(int deviceId, ImuSample *samples, int maxSamples) override
+	{
+		if (!IsValid(deviceId))
+		{
+			return 0;
+		}
+		auto &pending = _devices[deviceId].samples;
+		int count = min(maxSamples, int(pending.size()));
+		copy_n(pending.begin(), count, samples);
+		pending.clear();
+		return count;
+	}
+
+	JOY_SHOCK_STATE GetSimpleState(int deviceId) override
+	{
+		return Frame(deviceId).state;
+	}
+
+	IMU_STATE GetIMUState(int deviceId) override
+	{
+		return Frame(deviceId).imu;
+	}
+
+	MOTION_STATE GetMotionState(int deviceId) override
+	{
+		return MOTION_STATE();
+	}
+
+	TOUCH_STATE GetTouchState(int deviceId, bool previous) override
+	{
+		return Frame(deviceId).touch;
+	}
+
+	bool GetTouchpadDimension(int deviceId, int &sizeX, int &sizeY) override
+	{
+		sizeX = Frame(deviceId).touchpadSizeX;
+		sizeY = Frame(deviceId).touchpadSizeY;
+		return IsValid(deviceId);
+	}
+
+	int GetButtons(int deviceId) override
+	{
+		return Frame(deviceId).state.buttons;
+	}
+
+	float GetLeftX(int deviceId) override
+	{
+		return Frame(deviceId).state.stickLX;
+	}
+
+	float GetLeftY(int deviceId) override
+	{
+		return Frame(deviceId).state.stickLY;
+	}
+
+	float GetRightX(int deviceId) override
+	{
+		return Frame(deviceId).state.stickRX;
+	}
+
+	float GetRightY(int deviceId) override
+	{
+		return Frame(deviceId).state.stickRY;
+	}
+
+	float GetLeftTrigger(int deviceId) override
+	{
+		return Frame(deviceId).state.lTrigger;
+	}
+
+	float GetRightTrigger(int deviceId) override
+	{
+		return Frame(deviceId).state.rTrigger;
+	}
+
+	float GetGyroX(int deviceId) override
+	{
+		return Frame(deviceId).imu.gyroX;
+	}
+
+	float GetGyroY(int deviceId) override
+	{
+		return Frame(deviceId).imu.gyroY;
+	}
+
+	float GetGyroZ(int deviceId) override
+	{
+		return Frame(deviceId).imu.gyroZ;
+	}
+
+	float GetAccelX(int deviceId) override
+	{
+		return Frame(deviceId).imu.accelX;
+	}
+
+	float GetAccelY(int deviceId) override
+	{
+		return Frame(deviceId).imu.accelY;
+	}
+
+	float GetAccelZ(int deviceId) override
+	{
+		return Frame(deviceId).imu.accelZ;
+	}
+
+	int GetTouchId(int deviceId, bool secondTouch) override
+	{
+		return secondTouch ? Frame(deviceId).touch.t1Id : Frame(deviceId).touch.t0Id;
+	}
+
+	bool GetTouchDown(int deviceId, bool secondTouch) override
+	{
+		return secondTouch ? Frame(deviceId).touch.t1Down : Frame(deviceId).touch.t0Down;
+	}
+
+	float GetTouchX(int deviceId, bool secondTouch) override
+	{
+		return secondTouch ? Frame(deviceId).touch.t1X : Frame(deviceId).touch.t0X;
+	}
+
+	float GetTouchY(int deviceId, bool secondTouch) override
+	{
+		return secondTouch ? Frame(deviceId).touch.t1Y : Frame(deviceId).touch.t0Y;
+	}
+
+	float GetStickStep(int deviceId) override
+	{
+		return 0.f;
+	}
+
+	float GetTriggerStep(int deviceId) override
+	{
+		return 0.f;
+	}
+
+	float GetPollRate(int deviceId) override
+	{
+		return IsValid(deviceId) ? _devices[deviceId].sampleRate : 0.f;
+	}
+
+	void ResetContinuousCalibration(int deviceId) override
+	{
+	}
+
+	void StartContinuousCalibration(int deviceId) override
+	{
+	}
+
+	void PauseContinuousCalibration(int deviceId) override
+	{
+	}
+
+	void GetCalibrationOffset(int deviceId, float &xOffset, float &yOffset, float &zOffset) override
+	{
+		xOffset = yOffset = zOffset = 0.f;
+	}
+
+	void SetCalibrationOffset(int deviceId, float xOffset, float yOffset, float zOffset) override
+	{
+	}
+
+	void SetCallback(void (*callback)(int, JOY_SHOCK_STATE, JOY_SHOCK_STATE, IMU_STATE, IMU_STATE, float)) override
+	{
+		lock_guard guard(_lock);
+		_callback = callback;
+	}
+
+	void SetTouchCallback(void (*callback)(int, TOUCH_STATE, TOUCH_STATE, float)) override
+	{
+		lock_guard guard(_lock);
+		_touchCallback = callback;
+	}
+
+	int GetControllerType(int deviceId) override
+	{
+		return IsValid(deviceId) ? _devices[deviceId].controllerType : 0;
+	}
+
+	int GetControllerSplitType(int deviceId) override
+	{
+		return IsValid(deviceId) ? _devices[deviceId].splitType : 0;
+	}
+
+	int GetControllerColour(int deviceId) override
+	{
+		return 0;
+	}
+
+	// Outputs have nowhere to go
+	void SetLightColour(int deviceId, int colour) override
+	{
+	}
+
+	void SetRumble(int deviceId, int smallRumble, int bigRumble) override
+	{
+	}
+
+	void SetPlayerNumber(int deviceId, int number) override
+	{
+	}
+
+private:
+	bool IsValid(int deviceId) const
+	{
+		return deviceId >= 0 && deviceId < int(_devices.size());
+	}
+
+	const DeviceFrame &Frame(int deviceId) const
+	{
+		static const DeviceFrame none{};
+		return IsValid(deviceId) ? _devices[deviceId].frame : none;
+	}
+
+	void Poll()
+	{
+		auto start = chrono::steady_clock::now();
+		while (_keepPolling)
+		{
+			tick_scheduler.WaitNextTick(tick_time.get());
+
+			lock_guard guard(_lock);
+			double now = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			_dispatchHandles.clear();
+			for (size_t i = 0; i < _devices.size(); ++i)
+			{
+				Generate(_devices[i], now);
+				_dispatchHandles.push_back(int(i));
+			}
+
+			size_t numThreads = size_t(max(0, poll_threads.get() - 1));
+			if (numThreads > 0 && _dispatchHandles.size() > 1)
+			{
+				_callbackPool.Resize(numThreads);
+				_callbackPool.Run(_dispatchHandles, [this](int handle) { DispatchCallbacks(handle); });
+			}
+			else
+			{
+				_callbackPool.Resize(0);
+				for (int handle : _dispatchHandles)
+				{
+					DispatchCallbacks(handle);
+				}
+			}
+			tick_scheduler.EndTick();
+		}
+	}
+
+	// Produce the IMU samples due since the last tick, then the frame of this tick
+	static void Generate(Device &device, double now)
+	{
+		if (device.sampleRate > 0.f)
+		{
+			double interval = 1.0 / device.sampleRate;
+			DeviceFrame sampleFrame = device.frame;
+			while (device.nextSampleTime <= now)
+			{
+				device.generator->Evaluate(device.nextSampleTime, sampleFrame);
+				if (device.samples.size() < 128)
+				{
+					device.samples.push_back({ sampleFrame.imu, float(interval), uint64_t(device.nextSampleTime * 1000000.0) });
+				}
+				device.nextSampleTime += interval;
+			}
+		}
+		device.generator->Evaluate(now, device.frame);
+		device.frame.timestamp = uint64_t(now * 1000000.0);
+	}
+
+	void DispatchCallbacks(int handle)
+	{
+		if (_callback)
+		{
+			JOY_SHOCK_STATE dummy1{};
+			IMU_STATE dummy2{};
+			_callback(handle, dummy1, dummy1, dummy2, dummy2, tick_time.get());
+		}
+		if (_touchCallback)
+		{
+			TOUCH_STATE dummy3{};
+			_touchCallback(handle, _devices[handle].frame.touch, dummy3, tick_time.get());
+		}
+	}
+
+	vector<Device> _devices;
+	thread _thread;
+	atomic_bool _keepPolling = false;
+	mutex _lock;
+	vector<int> _dispatchHandles;
+	CallbackPool _callbackPool;
+	void (*_callback)(int, JOY_SHOCK_STATE, JOY_SHOCK_STATE, IMU_STATE, IMU_STATE, float) = nullptr;
+	void (*_touchCallback)(int, TOUCH_STATE, TOUCH_STATE, float) = nullptr;
+};
+
+SyntheticWrapper::Device MakeDevice(int controllerType, int splitType)
+{
+	SyntheticWrapper::Device device;
+	device.controllerType = controllerType;
+	device.splitType = splitType;
+	device.frame.controllerType = controllerType;
+	device.frame.splitType = splitType;
+	switch (controllerType)
+	{
+	case JS_TYPE_DS4:
+	case JS_TYPE_DS:
+		device.sampleRate = 250.f;
+		device.frame.touchpadSizeX = 1920;
+		device.frame.touchpadSizeY = 920;
+		break;
+	default:
+		device.sampleRate = 200.f; // 3 samples per 15ms report
+		break;
+	}
+	return device;
+}
+
+unique_ptr<Generator> MakeGenerator(const string &name, const SyntheticWrapper::Device &device, int seed, const InputTrace *trace)
+{
+	if (name == "SINE")
+		return make_unique<SineGenerator>(seed);
+	if (name == "WALK")
+		return make_unique<WalkGenerator>(seed);
+	if (name == "BUTTONS")
+		return make_unique<ButtonGenerator>(device.splitType, device.controllerType);
+	if (trace)
+		return make_unique<TraceGenerator>(*trace);
+	return nullptr;
+}
+} // namespace
+
+JslWrapper *NewSyntheticWrapper(const string &spec, string &error)
+{
+	vector<SyntheticWrapper::Device> devices;
+	vector<unique_ptr<InputTrace>> traces;
+	stringstream entries(spec);
+	string entry;
+	while (getline(entries, entry, ','))
+	{
+		// [COUNT*]TYPE[:GENERATOR]
+		int count = 1;
+		size_t star = entry.find('*');
+		if (star != string::npos)
+		{
+			count = atoi(entry.substr(0, star).c_str());
+			entry = entry.substr(star + 1);
+		}
+		string type = entry.substr(0, entry.find(':'));
+		string generator = entry.find(':') == string::npos ? "SINE" : entry.substr(entry.find(':') + 1);
+		transform(type.begin(), type.end(), type.begin(), ::toupper);
+		if (generator.rfind("TRACE=", 0) != 0)
+		{
+			transform(generator.begin(), generator.end(), generator.begin(), ::toupper);
+		}
+		if (count <= 0)
+		{
+			error = "Invalid controller count in " + entry;
+			return nullptr;
+		}
+
+		vector<pair<int, int>> models; // Controller and split types
+		if (type == "DS4")
+		{
+			models = { { JS_TYPE_DS4, JS_SPLIT_TYPE_FULL } };
+		}
+		else if (type == "DS")
+		{
+			models = { { JS_TYPE_DS, JS_SPLIT_TYPE_FULL } };
+		}
+		else if (type == "PRO")
+		{
+			models = { { JS_TYPE_PRO_CONTROLLER, JS_SPLIT_TYPE_FULL } };
+		}
+		else if (type == "JOYCONS")
+		{
+			models = { { JS_TYPE_JOYCON_LEFT, JS_SPLIT_TYPE_LEFT }, { JS_TYPE_JOYCON_RIGHT, JS_SPLIT_TYPE_RIGHT } };
+		}
+		else
+		{
+			error = "Unknown controller type " + type + ". Use DS4, DS, PRO or JOYCONS.";
+			return nullptr;
+		}
+
+		const InputTrace *trace = nullptr;
+		if (generator.rfind("TRACE=", 0) == 0)
+		{
+			auto loaded = InputTrace::Load(generator.substr(6), error);
+			if (!loaded)
+			{
+				return nullptr;
+			}
+			if (loaded->GetNumFrames() == 0)
+			{
+				error = generator.substr(6) + " has no frame";
+				return nullptr;
+			}
+			traces.push_back(move(loaded));
+			trace = traces.back().get();
+		}
+		else if (generator != "SINE" && generator != "WALK" && generator != "BUTTONS")
+		{
+			error = "Unknown generator " + generator + ". Use SINE, WALK, BUTTONS or TRACE=<file>.";
+			return nullptr;
+		}
+
+		for (int i = 0; i < count; ++i)
+		{
+			for (auto &model : models)
+			{
+				SyntheticWrapper::Device device = MakeDevice(model.first, model.second);
+				device.generator = MakeGenerator(generator, device, int(devices.size()), trace);
+				devices.push_back(move(device));
+			}
+		}
+	}
+	if (devices.empty())
+	{
+		error = "No synthetic controller given";
+		return nullptr;
+	}
+	return new SyntheticWrapper(move(devices));
+}
@@ -0,0 +1,191 @@
+#include "TickScheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+void TickScheduler::WaitNextTick(float periodMs)
+{
+	auto period = chrono::duration_cast<Clock::duration>(chrono::duration<float, milli>(periodMs));
+	auto now = Clock::now();
+	if (_restart.exchange(false))
+	{
+		_deadline = now + period;
+		_lastTick = now;
+	}
+
+	if (_deadline > now + SPIN_MARGIN)
+	{
+		this_thread::sleep_until(_deadline - SPIN_MARGIN);
+	}
+	while ((now = Clock::now()) < _deadline)
+	{
+		this_thread::yield();
+	}
+
+	float actualMs = chrono::duration<float, milli>(now - _lastTick).count();
+	_lastTick = now;
+
+	// Schedule from the previous deadline rather than from now so the processing time doesn't add up.
+	// If a whole period was missed, there's no catching up: restart from now.
+	_deadline += period;
+	bool overrun = _deadline <= now;
+	if (overrun)
+	{
+		_deadline = now + period;
+	}
+	Record(actualMs, periodMs, overrun);
+}
+
+void TickScheduler::WaitUntil(Clock::time_point wakeTime)
+{
+	auto now = Clock::now();
+	if (_restart.exchange(false))
+	{
+		_lastTick = now;
+	}
+	bool overrun = wakeTime <= now;
+
+	// No spinning here: wake times are predictions, and waking a few tens of microseconds late is better than
+	// keeping a core busy between reports
+	this_thread::sleep_until(wakeTime);
+	now = Clock::now();
+
+	float actualMs = chrono::duration<float, milli>(now - _lastTick).count();
+	float targetMs = max(0.f, chrono::duration<float, milli>(wakeTime - _lastTick).count());
+	_lastTick = now;
+	// Should WaitNextTick be used again, restart from here
+	_deadline = now;
+	Record(actualMs, targetMs, overrun);
+}
+
+void TickScheduler::EndTick()
+{
+	float workMs = chrono::duration<float, milli>(Clock::now() - _lastTick).count();
+	lock_guard guard(_statsLock);
+	_works[_nextWork] = workMs;
+	_nextWork = (_nextWork + 1) % MAX_SAMPLES;
+	_numWorks = min(_numWorks + 1, MAX_SAMPLES);
+}
+
+void TickScheduler::Reset()
+{
+	lock_guard guard(_statsLock);
+	_restart = true;
+	_numSamples = 0;
+	_nextSample = 0;
+	_numWorks = 0;
+	_nextWork = 0;
+	_numTicks = 0;
+	_numOverruns = 0;
+}
+
+void TickScheduler::Record(float periodMs, float targetMs, bool overrun)
+{
+	lock_guard guard(_statsLock);
+	_periods[_nextSample] = periodMs;
+	_jitters[_nextSample] = fabsf(periodMs - targetMs);
+	_nextSample = (_nextSample + 1) % MAX_SAMPLES;
+	_numSamples = min(_numSamples + 1, MAX_SAMPLES);
+	++_numTicks;
+	if (overrun)
+		++_numOverruns;
+}
+
+TickScheduler::Stats TickScheduler::GetStats() const
+{
+	Stats stats;
+	vector<float> periods, jitters, works;
+	{
+		lock_guard guard(_statsLock);
+		stats.numTicks = _numTicks;
+		stats.numOverruns = _numOverruns;
+		periods.assign(_periods.begin(), _periods.begin() + _numSamples);
+		jitters.assign(_jitters.begin(), _jitters.begin() + _numSamples);
+		works.assign(_works.begin(), _works.begin() + _numWorks);
+	}
+	if (periods.empty())
+		return stats;
+
+	auto percentile = [](vector<float> &samples, float ratio) {
+		auto nth = samples.begin() + min(samples.size() - 1, size_t(ratio * samples.size()));
+		nth_element(samples.begin(), nth, samples.end());
+		return *nth;
+	};
+	stats.p50Period = percentile(periods, 0.50f);
+	stats.p99Period = percentile(periods, 0.99f);
+	stats.maxPeriod = *max_element(periods.begin(), periods.end());
+	stats.p50Jitter = percentile(jitters, 0.50f);
+	stats.p99Jitter = percentile(jitters, 0.99f);
+	stats.maxJitter = *max_element(jitters.begin(), jitters.end());
+	if (!works.empty())
+	{
+		stats.p50Work = percentile(works, 0.50f);
+		stats.p99Work = percentile(works, 0.99f);
+		stats.maxWork = *max_element(works.begin(), works.end());
+	}
+	return stats;
+}
+
+void ReportCadence::Update(Clock::time_point now, bool newData)
+{
+	Clock::time_point previousPoll = _lastPoll;
+	_lastPoll = now;
+	if (!newData)
+	{
+		return;
+	}
+	if (!_hasArrival)
+	{
+		_lastArrival = now;
+		_hasArrival = true;
+		return;
+	}
+
+	// The report arrived after the previous poll, which didn't see it. Assume it came a little earlier than
+	// predicted, which corrects the drift of polls landing later and later behind reports already waiting.
+	Clock::time_point arrival = now;
+	if (_period != Clock::duration::zero())
+	{
+		arrival = clamp(_lastArrival + _period - MARGIN, previousPoll, now);
+	}
+
+	auto interval = arrival - _lastArrival;
+	if (_period == Clock::duration::zero())
+	{
+		_period = interval;
+	}
+	else if (interval > Clock::duration::zero())
+	{
+		// A long interval spans several reports: a late poll, or reports with nothing new
+		auto numReports = max(Clock::rep(1), Clock::rep(llround(double(interval.count()) / _period.count())));
+		_period += (interval / numReports - _period) / SMOOTHING;
+	}
+	_lastArrival = arrival;
+}
+
+ReportCadence::Clock::time_point ReportCadence::NextPoll(Clock::duration fallback) const
+{
+	if (_period == Clock::duration::zero())
+	{
+		return _lastPoll + fallback;
+	}
+	auto expected = _lastArrival + _period + MARGIN;
+	if (_lastPoll < expected)
+	{
+		return expected;
+	}
+	if (_lastPoll - _lastArrival > 2 * _period)
+	{
+		// Nothing for a while: the device only reports changes, or it's gone quiet
+		return _lastPoll + max(fallback, Clock::duration(RETRY));
+	}
+	return _lastPoll + RETRY;
+}
+
+float ReportCadence::GetPeriodMs() const
+{
+	return chrono::duration<float, milli>(_period).count();
+}
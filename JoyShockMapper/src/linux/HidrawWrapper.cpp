@@ -0,0 +1,827 @@
+#include "HidrawWrapper.h"
+#include "JoyShockMapper.h"
+#include "JSMVariable.hpp"
+#include "PlayStationReports.h"
+#include "SlotTable.h"
+
+#include <fcntl.h>
+#include <linux/hidraw.h>
+#include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std;
+using PlayStationReports::Bus;
+using PlayStationReports::ImuCalibration;
+using PlayStationReports::InputLayout;
+using PlayStationReports::InputReport;
+
+extern JSMVariable<float> output_report_interval; // defined in main.cc
+
+namespace
+{
+constexpr const char *DEVICE_DIRECTORY = "/dev";
+constexpr const char *DEVICE_PREFIX = "hidraw";
+
+// epoll data of the descriptors that aren't devices. Devices use their handle.
+constexpr uint64_t WAKE_EVENT = UINT64_MAX;
+constexpr uint64_t HOTPLUG_EVENT = UINT64_MAX - 1;
+
+// Read the bus and ids of a hidraw node from sysfs, which doesn't need access to the node itself
+bool ReadHidId(const string &name, int &bus, uint16_t &vendorId, uint16_t &productId)
+{
+	ifstream uevent("/sys/class/hidraw/" + name + "/device/uevent");
+	string line;
+	while (getline(uevent, line))
+	{
+		unsigned int busValue, vendorValue, productValue;
+		if (sscanf(line.c_str(), "HID_ID=%x:%x:%x", &busValue, &vendorValue, &productValue) == 3)
+		{
+			bus = int(busValue);
+			vendorId = uint16_t(vendorValue);
+			productId = uint16_t(productValue);
+			return true;
+		}
+	}
+	return false;
+}
+
+struct HidDevice
+{
+	HidDevice(int fd, Bus bus, const InputLayout *layout, const string &name)
+	  : _fd(fd)
+	  , _bus(bus)
+	  , _layout(layout)
+	  , _name(name)
+	  , _lastCallback(chrono::steady_clock::now())
+	{
+		_frame.controllerType = layout->controllerType;
+		_frame.splitType = JS_SPLIT_TYPE_FULL;
+		// Matching SDL2 resolution
+		_frame.touchpadSizeX = 1920;
+		_frame.touchpadSizeY = 920;
+	}
+
+	~HidDevice()
+	{
+		{
+			// Don't leave the controller rumbling
+			lock_guard guard(_outputLock);
+			_output.smallRumble = 0;
+			_output.bigRumble = 0;
+			_output.micLight = 0;
+			_output.leftTriggerEffect = AdaptiveTriggerSetting();
+			_output.rightTriggerEffect = AdaptiveTriggerSetting();
+		}
+		FlushOutput(0.f);
+		close(_fd);
+	}
+
+	// Called with _lock held
+	void Receive(const InputReport &report)
+	{
+		_frame.state = report.state;
+		_frame.imu = report.imu;
+		_frame.touch = report.touch;
+
+		float deltaTime = 0.f;
+		if (_frame.timestamp == 0)
+		{
+			// The sensor clock starts anywhere: start from the wall clock instead
+			_frame.timestamp = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+		}
+		else
+		{
+			uint64_t delta = PlayStationReports::TimestampDelta(*_layout, _lastSensorTimestamp, report.sensorTimestamp);
+			_frame.timestamp += delta;
+			deltaTime = delta / 1000000.f;
+			if (deltaTime > 0.f)
+			{
+				_reportRate = _reportRate == 0.f ? 1.f / deltaTime : 0.95f * _reportRate + 0.05f / deltaTime;
+			}
+		}
+		_lastSensorTimestamp = report.sensorTimestamp;
+
+		ImuSample &sample = _samples[(_firstSample + _numSamples) % MAX_SAMPLES];
+		if (_numSamples < MAX_SAMPLES)
+		{
+			++_numSamples;
+		}
+		else
+		{
+			// Nobody consumed the samples for a while: drop the oldest one
+			_firstSample = (_firstSample + 1) % MAX_SAMPLES;
+		}
+		sample.imu = report.imu;
+		sample.deltaTime = deltaTime;
+		sample.timestamp = _frame.timestamp;
+	}
+
+	// Called with _lock held
+	int PopSamples(ImuSample *samples, int maxSamples)
+	{
+		int count = min(_numSamples, maxSamples);
+		for (int i = 0; i < count; ++i)
+		{
+			samples[i] = _samples[(_firstSample + i) % MAX_SAMPLES];
+		}
+		_firstSample = (_firstSample + _numSamples) % MAX_SAMPLES;
+		_numSamples = 0;
+		return count;
+	}
+
+	template<typename F>
+	void UpdateOutput(F update)
+	{
+		lock_guard guard(_outputLock);
+		update(_output);
+	}
+
+	// Write the output report if something changed, at most once per minIntervalMs
+	void FlushOutput(float minIntervalMs)
+	{
+		lock_guard guard(_outputLock);
+		auto now = chrono::steady_clock::now();
+		if (_output == _sentOutput || now - _lastOutputTime < chrono::duration<float, milli>(minIntervalMs))
+		{
+			return;
+		}
+		uint8_t report[PlayStationReports::MAX_OUTPUT_SIZE];
+		size_t size = PlayStationReports::BuildOutputReport(_layout->controllerType, _bus, _output, _outputSequence, report);
+		_outputSequence = (_outputSequence + 1) & 0x0F;
+		if (size > 0 && write(_fd, report, size) < 0 && errno != EAGAIN)
+		{
+			return; // The device is going away, the poll thread will notice
+		}
+		_sentOutput = _output;
+		_lastOutputTime = now;
+	}
+
+	// Enough for a 1 kHz controller at the longest tick time
+	static constexpr int MAX_SAMPLES = 128;
+
+	const int _fd;
+	const Bus _bus;
+	const InputLayout *const _layout;
+	const string _name; // of the device node
+	ImuCalibration _calibration; // set on open, before reading any report
+
+	mutex _lock;
+	DeviceFrame _frame{};
+	array<ImuSample, MAX_SAMPLES> _samples;
+	int _firstSample = 0;
+	int _numSamples = 0;
+	uint32_t _lastSensorTimestamp = 0;
+	float _reportRate = 0.f;
+
+	// Only touched by the poll thread
+	chrono::steady_clock::time_point _lastCallback;
+
+	mutex _outputLock;
+	PlayStationReports::Output _output;
+	PlayStationReports::Output _sentOutput;
+	uint8_t _outputSequence = 0;
+	chrono::steady_clock::time_point _lastOutputTime;
+};
+
+class HidrawWrapper : public JslWrapper
+{
+public:
+	~HidrawWrapper()
+	{
+		DisconnectAndDisposeAll();
+	}
+
+	int ConnectDevices() override
+	{
+		if (!_thread.joinable() && !Start())
+		{
+			return 0;
+		}
+		int denied = 0;
+		error_code error;
+		for (auto &entry : filesystem::directory_iterator(DEVICE_DIRECTORY, error))
+		{
+			string name = entry.path().filename().string();
+			if (name.rfind(DEVICE_PREFIX, 0) == 0 && OpenDevice(name) == SlotTable<HidDevice>::INVALID_HANDLE && errno == EACCES)
+			{
+				++denied;
+			}
+		}
+		if (denied > 0)
+		{
+			COUT_WARN << "Can't open " << denied << " controller(s) in " << DEVICE_DIRECTORY << ". Apply the udev rules in dist/linux to give your user access to them." << endl;
+		}
+		return int(_devices.size());
+	}
+
+	int GetConnectedDeviceHandles(int *deviceHandleArray, int size) override
+	{
+		int count = 0;
+		for (auto &entry : _devices)
+		{
+			if (count == size)
+			{
+				break;
+			}
+			deviceHandleArray[count++] = entry.first;
+		}
+		return count;
+	}
+
+	void DisconnectAndDisposeAll() override
+	{
+		if (_thread.joinable())
+		{
+			_keepPolling = false;
+			WakePollThread();
+			_thread.join();
+		}
+		for (int *fd : { &_epollFd, &_wakeFd, &_inotifyFd })
+		{
+			if (*fd >= 0)
+			{
+				close(*fd);
+				*fd = -1;
+			}
+		}
+		_devices.Clear();
+		lock_guard guard(_callbackLock);
+		_callback = nullptr;
+		_touchCallback = nullptr;
+		_connectionCallback = nullptr;
+	}
+
+	void GetFrame(int deviceId, DeviceFrame &frame) override
+	{
+		frame = ReadFrame(deviceId);
+	}
+
+	int GetIMUSamples(int deviceId, ImuSample *samples, int maxSamples) override
+	{
+		auto device = _devices.Get(deviceId);
+		if (!device)
+		{
+			return 0;
+		}
+		lock_guard guard(device->_lock);
+		return device->PopSamples(samples, maxSamples);
+	}
+
+	JOY_SHOCK_STATE GetSimpleState(int deviceId) override
+	{
+		return ReadFrame(deviceId).state;
+	}
+
+	IMU_STATE GetIMUState(int deviceId) override
+	{
+		return ReadFrame(deviceId).imu;
+	}
+
+	MOTION_STATE GetMotionState(int deviceId) override
+	{
+		return MOTION_STATE();
+	}
+
+	TOUCH_STATE GetTouchState(int deviceId, bool previous) override
+	{
+		return ReadFrame(deviceId).touch;
+	}
+
+	bool GetTouchpadDimension(int deviceId, int &sizeX, int &sizeY) override
+	{
+		DeviceFrame frame = ReadFrame(deviceId);
+		sizeX = frame.touchpadSizeX;
+		sizeY = frame.touchpadSizeY;
+		return frame.controllerType != 0;
+	}
+
+	int GetButtons(int deviceId) override
+	{
+		return ReadFrame(deviceId).state.buttons;
+	}
+
+	float GetLeftX(int deviceId) override
+	{
+		return ReadFrame(deviceId).state.stickLX;
+	}
+
+	float GetLeftY(int deviceId) override
+	{
+		return ReadFrame(deviceId).state.stickLY;
+	}
+
+	float GetRightX(int deviceId) override
+	{
+		return ReadFrame(deviceId).state.stickRX;
+	}
+
+	float GetRightY(int deviceId) override
+	{
+		return ReadFrame(deviceId).state.stickRY;
+	}
+
+	float GetLeftTrigger(int deviceId) override
+	{
+		return ReadFrame(deviceId).state.lTrigger;
+	}
+
+	float GetRightTrigger(int deviceId) override
+	{
+		return ReadFrame(deviceId).state.rTrigger;
+	}
+
+	float GetGyroX(int deviceId) override
+	{
+		return ReadFrame(deviceId).imu.gyroX;
+	}
+
+	float GetGyroY(int deviceId) override
+	{
+		return ReadFrame(deviceId).imu.gyroY;
+	}
+
+	float GetGyroZ(int deviceId) override
+	{
+		return ReadFrame(deviceId).imu.gyroZ;
+	}
+
+	float GetAccelX(int deviceId) override
+	{
+		return ReadFrame(deviceId).imu.accelX;
+	}
+
+	float GetAccelY(int deviceId) override
+	{
+		return ReadFrame(deviceId).imu.accelY;
+	}
+
+	float GetAccelZ(int deviceId) override
+	{
+		return ReadFrame(deviceId).imu.accelZ;
+	}
+
+	int GetTouchId(int deviceId, bool secondTouch) override
+	{
+		auto touch = ReadFrame(deviceId).touch;
+		return secondTouch ? touch.t1Id : touch.t0Id;
+	}
+
+	bool GetTouchDown(int deviceId, bool secondTouch) override
+	{
+		auto touch = ReadFrame(deviceId).touch;
+		return secondTouch ? touch.t1Down : touch.t0Down;
+	}
+
+	float GetTouchX(int deviceId, bool secondTouch) override
+	{
+		auto touch = ReadFrame(deviceId).touch;
+		return secondTouch ? touch.t1X : touch.t0X;
+	}
+
+	float GetTouchY(int deviceId, bool secondTouch) override
+	{
+		auto touch = ReadFrame(deviceId).touch;
+		return secondTouch ? touch.t1Y : touch.t0Y;
+	}
+
+	float GetStickStep(int deviceId) override
+	{
+		return 1.f / 127.f;
+	}
+
+	float GetTriggerStep(int deviceId) override
+	{
+		return 1.f / 255.f;
+	}
+
+	float GetPollRate(int deviceId) override
+	{
+		auto device = _devices.Get(deviceId);
+		if (!device)
+		{
+			return 0.f;
+		}
+		lock_guard guard(device->_lock);
+		return device->_reportRate;
+	}
+
+	void ResetContinuousCalibration(int deviceId) override
+	{
+	}
+
+	void StartContinuousCalibration(int deviceId) override
+	{
+	}
+
+	void PauseContinuousCalibration(int deviceId) override
+	{
+	}
+
+	void GetCalibrationOffset(int deviceId, float &xOffset, float &yOffset, float &zOffset) override
+	{
+	}
+
+	void SetCalibrationOffset(int deviceId, float xOffset, float yOffset, float zOffset) override
+	{
+	}
+
+	void SetCallback(void (*callback)(int, JOY_SHOCK_STATE, JOY_SHOCK_STATE, IMU_STATE, IMU_STATE, float)) override
+	{
+		lock_guard guard(_callbackLock);
+		_callback = callback;
+	}
+
+	void SetTouchCallback(void (*callback)(int, TOUCH_STATE, TOUCH_STATE, float)) override
+	{
+		lock_guard guard(_callbackLock);
+		_touchCallback = callback;
+	}
+
+	void SetConnectionCallback(void (*callback)(int, bool)) override
+	{
+		lock_guard guard(_callbackLock);
+		_connectionCallback = callback;
+	}
+
+	int GetControllerType(int deviceId) override
+	{
+		auto device = _devices.Get(deviceId);
+		return device ? device->_layout->controllerType : 0;
+	}
+
+	int GetControllerSplitType(int deviceId) override
+	{
+		return _devices.Get(deviceId) ? JS_SPLIT_TYPE_FULL : 0;
+	}
+
+	int GetControllerColour(int deviceId) override
+	{
+		return 0;
+	}
+
+	void SetLightColour(int deviceId, int colour) override
+	{
+		UpdateOutput(deviceId, [colour](PlayStationReports::Output &output) {
+			output.hasLightColour = true;
+			output.lightColour = uint32_t(colour) & 0xFFFFFF;
+		});
+	}
+
+	// Same range as the SDL backend
+	void SetRumble(int deviceId, int smallRumble, int bigRumble) override
+	{
+		UpdateOutput(deviceId, [smallRumble, bigRumble](PlayStationReports::Output &output) {
+			output.smallRumble = clamp(smallRumble, 0, int(UINT16_MAX)) >> 8;
+			output.bigRumble = clamp(bigRumble, 0, int(UINT16_MAX)) >> 8;
+		});
+	}
+
+	void SetPlayerNumber(int deviceId, int number) override
+	{
+		UpdateOutput(deviceId, [number](PlayStationReports::Output &output) {
+			output.playerNumber = number;
+		});
+	}
+
+	void SetTriggerEffect(int deviceId, const AdaptiveTriggerSetting &_leftTriggerEffect, const AdaptiveTriggerSetting &_rightTriggerEffect) override
+	{
+		UpdateOutput(deviceId, [&](PlayStationReports::Output &output) {
+			output.leftTriggerEffect = _leftTriggerEffect;
+			output.rightTriggerEffect = _rightTriggerEffect;
+		});
+	}
+
+	void SetMicLight(int deviceId, uint8_t mode) override
+	{
+		UpdateOutput(deviceId, [mode](PlayStationReports::Output &output) {
+			output.micLight = mode;
+		});
+	}
+
+private:
+	DeviceFrame ReadFrame(int deviceId)
+	{
+		auto device = _devices.Get(deviceId);
+		if (!device)
+		{
+			return DeviceFrame{};
+		}
+		lock_guard guard(device->_lock);
+		return device->_frame;
+	}
+
+	// The report goes out with the next input report of the device
+	template<typename F>
+	void UpdateOutput(int deviceId, F update)
+	{
+		auto device = _devices.Get(deviceId);
+		if (device)
+		{
+			device->UpdateOutput(update);
+		}
+	}
+
+	bool Start()
+	{
+		_epollFd = epoll_create1(EPOLL_CLOEXEC);
+		_wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (_epollFd < 0 || _wakeFd < 0)
+		{
+			CERR << "Can't wait on hidraw devices: " << strerror(errno) << endl;
+			return false;
+		}
+		epoll_event event{};
+		event.events = EPOLLIN;
+		event.data.u64 = WAKE_EVENT;
+		epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &event);
+
+		// Nodes are created as root then handed over by udev, so both are worth a try
+		_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (_inotifyFd >= 0 && inotify_add_watch(_inotifyFd, DEVICE_DIRECTORY, IN_CREATE | IN_ATTRIB) >= 0)
+		{
+			event.data.u64 = HOTPLUG_EVENT;
+			epoll_ctl(_epollFd, EPOLL_CTL_ADD, _inotifyFd, &event);
+		}
+		else
+		{
+			COUT_WARN << "Controllers plugged in later won't be detected until RECONNECT_CONTROLLERS: " << strerror(errno) << endl;
+		}
+
+		_keepPolling = true;
+		_thread = thread(&HidrawWrapper::Poll, this);
+		return true;
+	}
+
+	// Returns the new handle. On failure errno tells why, and is 0 if the node isn't a supported controller.
+	int OpenDevice(const string &name)
+	{
+		lock_guard guard(_openLock);
+		errno = 0;
+		for (auto &entry : _devices)
+		{
+			if (entry.second->_name == name)
+			{
+				return SlotTable<HidDevice>::INVALID_HANDLE;
+			}
+		}
+
+		int bus = 0;
+		uint16_t vendorId = 0, productId = 0;
+		if (!ReadHidId(name, bus, vendorId, productId))
+		{
+			return SlotTable<HidDevice>::INVALID_HANDLE;
+		}
+		int controllerType = PlayStationReports::GetControllerType(vendorId, productId);
+		Bus reportBus = bus == BUS_BLUETOOTH ? Bus::BLUETOOTH : Bus::USB;
+		const InputLayout *layout = PlayStationReports::FindInputLayout(controllerType, reportBus);
+		if (!layout)
+		{
+			return SlotTable<HidDevice>::INVALID_HANDLE;
+		}
+
+		int fd = open((string(DEVICE_DIRECTORY) + "/" + name).c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0)
+		{
+			return SlotTable<HidDevice>::INVALID_HANDLE;
+		}
+		// Reading the calibration also makes Bluetooth controllers send their full report with motion
+		uint8_t calibrationReport[PlayStationReports::CALIBRATION_REPORT_SIZE] = { PlayStationReports::CalibrationReportId(controllerType, reportBus) };
+		int calibrationSize = ioctl(fd, HIDIOCGFEATURE(sizeof(calibrationReport)), calibrationReport);
+		ImuCalibration calibration;
+		if (calibrationSize < 0 || !PlayStationReports::ParseCalibration(controllerType, reportBus, calibrationReport, size_t(calibrationSize), calibration))
+		{
+			CERR << "Couldn't read the motion calibration of " << name << ", using nominal values" << endl;
+		}
+
+		auto device = make_shared<HidDevice>(fd, reportBus, layout, name);
+		device->_calibration = calibration;
+		int handle = _devices.Insert(device);
+		if (handle == SlotTable<HidDevice>::INVALID_HANDLE)
+		{
+			CERR << "Too many controllers, ignoring " << name << endl;
+			return handle;
+		}
+		epoll_event event{};
+		event.events = EPOLLIN;
+		event.data.u64 = uint64_t(handle);
+		epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event);
+		return handle;
+	}
+
+	void WakePollThread()
+	{
+		uint64_t wake = 1;
+		while (write(_wakeFd, &wake, sizeof(wake)) < 0)
+		{
+			// EAGAIN: the counter is full, so the thread is already woken
+			if (errno != EINTR)
+			{
+				if (errno != EAGAIN)
+				{
+					CERR << "Can't wake the hidraw thread: " << strerror(errno) << endl;
+				}
+				return;
+			}
+		}
+	}
+
+	void ClearWake()
+	{
+		uint64_t value;
+		while (read(_wakeFd, &value, sizeof(value)) < 0)
+		{
+			// EAGAIN: another wake already cleared it
+			if (errno != EINTR)
+			{
+				if (errno != EAGAIN)
+				{
+					CERR << "Can't clear the hidraw thread wake: " << strerror(errno) << endl;
+				}
+				return;
+			}
+		}
+	}
+
+	void Poll()
+	{
+		epoll_event events[16];
+		while (_keepPolling)
+		{
+			int count = epoll_wait(_epollFd, events, int(size(events)), -1);
+			if (count < 0 && errno != EINTR)
+			{
+				CERR << "Stopped reading hidraw devices: " << strerror(errno) << endl;
+				break;
+			}
+			for (int i = 0; i < count; ++i)
+			{
+				if (events[i].data.u64 == WAKE_EVENT)
+				{
+					ClearWake();
+				}
+				else if (events[i].data.u64 == HOTPLUG_EVENT)
+				{
+					ReadHotplugEvents();
+				}
+				else
+				{
+					int handle = int(events[i].data.u64);
+					if (!ReadReports(handle) || (events[i].events & (EPOLLERR | EPOLLHUP)) != 0)
+					{
+						RemoveDevice(handle);
+					}
+				}
+			}
+		}
+	}
+
+	// Parse every report queued on the device, then call back once with the latest state.
+	// Returns false if the device is gone.
+	bool ReadReports(int handle)
+	{
+		auto device = _devices.Get(handle);
+		if (!device)
+		{
+			return true;
+		}
+		bool received = false;
+		uint8_t buffer[128];
+		while (true)
+		{
+			ssize_t size = read(device->_fd, buffer, sizeof(buffer));
+			if (size < 0)
+			{
+				if (errno == EAGAIN || errno == EINTR)
+				{
+					break;
+				}
+				return false;
+			}
+			InputReport report;
+			if (PlayStationReports::ParseInputReport(*device->_layout, buffer, size_t(size), report, &device->_calibration))
+			{
+				lock_guard guard(device->_lock);
+				device->Receive(report);
+				received = true;
+			}
+		}
+		if (received)
+		{
+			DispatchCallbacks(handle, *device);
+		}
+		return true;
+	}
+
+	void DispatchCallbacks(int handle, HidDevice &device)
+	{
+		auto now = chrono::steady_clock::now();
+		float deltaTime = chrono::duration<float>(now - device._lastCallback).count();
+		device._lastCallback = now;
+
+		decltype(_callback) callback;
+		decltype(_touchCallback) touchCallback;
+		{
+			lock_guard guard(_callbackLock);
+			callback = _callback;
+			touchCallback = _touchCallback;
+		}
+		if (callback)
+		{
+			JOY_SHOCK_STATE dummy1{};
+			IMU_STATE dummy2{};
+			callback(handle, dummy1, dummy1, dummy2, dummy2, deltaTime);
+		}
+		if (touchCallback)
+		{
+			TOUCH_STATE dummy3{};
+			touchCallback(handle, ReadFrame(handle).touch, dummy3, deltaTime);
+		}
+		device.FlushOutput(output_report_interval.get());
+	}
+
+	void ReadHotplugEvents()
+	{
+		alignas(inotify_event) char buffer[4096];
+		ssize_t size;
+		while ((size = read(_inotifyFd, buffer, sizeof(buffer))) > 0)
+		{
+			for (char *next = buffer; next < buffer + size;)
+			{
+				auto event = reinterpret_cast<inotify_event *>(next);
+				next += sizeof(inotify_event) + event->len;
+				if (event->len > 0 && string(event->name).rfind(DEVICE_PREFIX, 0) == 0)
+				{
+					int handle = OpenDevice(event->name);
+					if (handle != SlotTable<HidDevice>::INVALID_HANDLE)
+					{
+						NotifyConnection(handle, true);
+					}
+				}
+			}
+		}
+	}
+
+	void RemoveDevice(int handle)
+	{
+		{
+			lock_guard guard(_openLock);
+			auto device = _devices.Get(handle);
+			if (!device)
+			{
+				return;
+			}
+			// The node stays open until the last reader lets go of the device
+			epoll_ctl(_epollFd, EPOLL_CTL_DEL, device->_fd, nullptr);
+			_devices.Remove(handle);
+		}
+		NotifyConnection(handle, false);
+	}
+
+	void NotifyConnection(int handle, bool isConnected)
+	{
+		decltype(_connectionCallback) callback;
+		{
+			lock_guard guard(_callbackLock);
+			callback = _connectionCallback;
+		}
+		if (callback)
+		{
+			callback(handle, isConnected);
+		}
+	}
+
+	SlotTable<HidDevice> _devices;
+	mutex _openLock; // Serializes opening and closing between ConnectDevices and the poll thread
+	int _epollFd = -1;
+	int _wakeFd = -1;
+	int _inotifyFd = -1;
+	thread _thread;
+	atomic_bool _keepPolling = false;
+	mutex _callbackLock;
+	void (*_callback)(int, JOY_SHOCK_STATE, JOY_SHOCK_STATE, IMU_STATE, IMU_STATE, float) = nullptr;
+	void (*_touchCallback)(int, TOUCH_STATE, TOUCH_STATE, float) = nullptr;
+	void (*_connectionCallback)(int, bool) = nullptr;
+};
+} // namespace
+
+JslWrapper *NewHidrawWrapper()
+{
+	return new HidrawWrapper();
+}
@@ -340,6 +340,7 @@ public:
 		  &uinput_device_);
 		if (error != 0)
 		{
+			libevdev_free(device_);
 			throw std::runtime_error(
 				std::string("Failed to create virtual device: ") +
 				std::strerror(-error) + std::string("\n"));
@@ -475,18 +476,44 @@ float getMouseSpeed()
 
 namespace
 {
-VirtualInputDevice mouse{ VirtualInputDevice::Device::MOUSE };
-VirtualInputDevice keyboard{ VirtualInputDevice::Device::KEYBOARD };
+// Null when the output is optional and they couldn't be created
+std::unique_ptr<VirtualInputDevice> mouse;
+std::unique_ptr<VirtualInputDevice> keyboard;
 } // namespace
 
+void initVirtualOutput(bool optional)
+{
+	try
+	{
+		mouse = std::make_unique<VirtualInputDevice>(VirtualInputDevice::Device::MOUSE);
+		keyboard = std::make_unique<VirtualInputDevice>(VirtualInputDevice::Device::KEYBOARD);
+	}
+	catch (const std::runtime_error &error)
+	{
+		std::fprintf(stderr, "%s", error.what());
+		if (!optional)
+		{
+			throw;
+		}
+		std::fprintf(stderr, "No input will be sent.\n");
+		mouse.reset();
+		keyboard.reset();
+	}
+}
+
 // send mouse button
 int pressMouse(WORD vkKey, bool isPressed)
 {
+	if (!mouse)
+	{
+		return 0;
+	}
+
 	if (vkKey == V_WHEEL_UP)
 	{
 		if (isPressed)
 		{
-			mouse.mouse_scroll(1);
+			mouse->mouse_scroll(1);
 		}
 
 		return 0;
@@ -496,7 +523,7 @@ int pressMouse(WORD vkKey, bool isPressed)
 	{
 		if (isPressed)
 		{
-			mouse.mouse_scroll(-1);
+			mouse->mouse_scroll(-1);
 		}
 
 		return 0;
@@ -504,11 +531,11 @@ int pressMouse(WORD vkKey, bool isPressed)
 
 	if (isPressed)
 	{
-		mouse.press_key(vkKey);
+		mouse->press_key(vkKey);
 	}
 	else
 	{
-		mouse.release_key(vkKey);
+		mouse->release_key(vkKey);
 	}
 
 	return 0;
@@ -525,13 +552,18 @@ int pressKey(KeyCode vkKey, bool pressed)
 		return pressMouse(vkKey.code, pressed);
 	}
 
+	if (!keyboard)
+	{
+		return 0;
+	}
+
 	if (pressed)
 	{
-		keyboard.press_key(vkKey.code);
+		keyboard->press_key(vkKey.code);
 	}
 	else
 	{
-		keyboard.release_key(vkKey.code);
+		keyboard->release_key(vkKey.code);
 	}
 
 	return 0;
@@ -551,13 +583,19 @@ void moveMouse(float x, float y)
 	accumulatedX -= applicableX;
 	accumulatedY -= applicableY;
 
-	mouse.mouse_move_relative(applicableX, applicableY);
+	if (mouse)
+	{
+		mouse->mouse_move_relative(applicableX, applicableY);
+	}
 	// printf("%0.4f %0.4f\n", accumulatedX, accumulatedY);
 }
 
 void setMouseNorm(float x, float y)
 {
-	mouse.mouse_move_absolute(std::roundf(65535.0f * x), std::roundf(65535.0f * y));
+	if (mouse)
+	{
+		mouse->mouse_move_absolute(std::roundf(65535.0f * x), std::roundf(65535.0f * y));
+	}
 }
 
 bool WriteToConsole(const std::string &command)
@@ -8,6 +8,15 @@
 #include "JSMAssignment.hpp"
 #include "quatMaths.cpp"
 #include "Gamepad.h"
+#include "TickScheduler.h"
+#include "SlotTable.h"
+#include "InputTrace.h"
+#include "SyntheticWrapper.h"
+#include "SnapshotPointer.h"
+#include "SmoothingWindow.h"
+#if defined(__linux__)
+#include "HidrawWrapper.h"
+#endif
 
 #include <mutex>
 #include <deque>
@@ -77,6 +86,7 @@ JSMSetting<float> flick_time = JSMSetting<float>(SettingID::FLICK_TIME, 0.1f);
 JSMSetting<float> flick_time_exponent = JSMSetting<float>(SettingID::FLICK_TIME_EXPONENT, 0.0f);
 JSMSetting<float> gyro_smooth_time = JSMSetting<float>(SettingID::GYRO_SMOOTH_TIME, 0.125f);
 JSMSetting<float> gyro_smooth_threshold = JSMSetting<float>(SettingID::GYRO_SMOOTH_THRESHOLD, 0.0f);
+JSMSetting<SmoothingMode> gyro_smooth_mode = JSMSetting<SmoothingMode>(SettingID::GYRO_SMOOTH_MODE, SmoothingMode::WINDOW);
 JSMSetting<float> gyro_cutoff_speed = JSMSetting<float>(SettingID::GYRO_CUTOFF_SPEED, 0.0f);
 JSMSetting<float> gyro_cutoff_recovery = JSMSetting<float>(SettingID::GYRO_CUTOFF_RECOVERY, 0.0f);
 JSMSetting<float> stick_acceleration_rate = JSMSetting<float>(SettingID::STICK_ACCELERATION_RATE, 0.0f);
@@ -103,6 +113,10 @@ JSMSetting<float> hold_press_time = JSMSetting<float>(SettingID::HOLD_PRESS_TIME
 JSMVariable<float> sim_press_window = JSMVariable<float>(50.0f);
 JSMSetting<float> dbl_press_window = JSMSetting<float>(SettingID::DBL_PRESS_WINDOW, 150.0f);
 JSMVariable<float> tick_time = JSMSetting<float>(SettingID::TICK_TIME, 3);
+JSMVariable<int> poll_threads = JSMVariable<int>(0);
+TickScheduler tick_scheduler;
+JSMVariable<float> output_report_interval = JSMVariable<float>(10.f);
+JSMVariable<Switch> auto_tick = JSMVariable<Switch>(Switch::OFF);
 JSMSetting<Color> light_bar = JSMSetting<Color>(SettingID::LIGHT_BAR, 0xFFFFFF);
 JSMSetting<FloatXY> scroll_sens = JSMSetting<FloatXY>(SettingID::SCROLL_SENS, { 30.f, 30.f });
 JSMVariable<Switch> autoloadSwitch = JSMVariable<Switch>(Switch::ON);
@@ -146,9 +160,354 @@ float last_flick_and_rotation = 0.0;
 unique_ptr<PollingThread> autoLoadThread;
 unique_ptr<PollingThread> minimizeThread;
 bool devicesCalibrating = false;
-unordered_map<int, shared_ptr<JoyShock>> handle_to_joyshock;
+SlotTable<JoyShock> handle_to_joyshock; // Keyed by the backend's device handles
+mutex connection_lock;                   // Serializes the devices coming and going
+bool merge_joycons = true;               // Whether a new Joy-Con pairs with one of the other side
+InputTraceWriter input_recorder;
+unique_ptr<JslWrapper> hardware_jsl; // The device backend, set aside while a trace is replayed
 int triggerCalibrationStep = 0;
 
+// The values of a chorded setting: the base value under ButtonID::NONE, then each chord that has one
+template<typename T>
+using ChordedValues = vector<pair<ButtonID, T>>;
+
+// Registry of the modeshiftable settings. Each setting has one entry, in the table of the type it is resolved as:
+// enums as int and the gyro axis signs as float. An entry copies its setting through a function instantiated for
+// it, so a setting that doesn't convert to the type of its table fails to compile.
+template<typename T>
+struct ChordedSettingEntry
+{
+	SettingID id;
+	void (*copy)(ChordedValues<T> &values);
+};
+
+template<typename T, auto &setting>
+void CopyChordedSetting(ChordedValues<T> &values)
+{
+	values.emplace_back(ButtonID::NONE, static_cast<T>(*setting.get()));
+	setting.forEachChord([&values](ButtonID chord, const auto &value) {
+		values.emplace_back(chord, static_cast<T>(value));
+	});
+}
+
+constexpr ChordedSettingEntry<float> FLOAT_SETTINGS[] = {
+	{ SettingID::MIN_GYRO_THRESHOLD, &CopyChordedSetting<float, min_gyro_threshold> },
+	{ SettingID::MAX_GYRO_THRESHOLD, &CopyChordedSetting<float, max_gyro_threshold> },
+	{ SettingID::STICK_POWER, &CopyChordedSetting<float, stick_power> },
+	{ SettingID::REAL_WORLD_CALIBRATION, &CopyChordedSetting<float, real_world_calibration> },
+	{ SettingID::VIRTUAL_STICK_CALIBRATION, &CopyChordedSetting<float, virtual_stick_calibration> },
+	{ SettingID::IN_GAME_SENS, &CopyChordedSetting<float, in_game_sens> },
+	{ SettingID::TRIGGER_THRESHOLD, &CopyChordedSetting<float, trigger_threshold> },
+	{ SettingID::GYRO_AXIS_X, &CopyChordedSetting<float, gyro_x_sign> },
+	{ SettingID::GYRO_AXIS_Y, &CopyChordedSetting<float, gyro_y_sign> },
+	{ SettingID::FLICK_TIME, &CopyChordedSetting<float, flick_time> },
+	{ SettingID::FLICK_TIME_EXPONENT, &CopyChordedSetting<float, flick_time_exponent> },
+	{ SettingID::GYRO_SMOOTH_THRESHOLD, &CopyChordedSetting<float, gyro_smooth_threshold> },
+	{ SettingID::GYRO_SMOOTH_TIME, &CopyChordedSetting<float, gyro_smooth_time> },
+	{ SettingID::GYRO_CUTOFF_SPEED, &CopyChordedSetting<float, gyro_cutoff_speed> },
+	{ SettingID::GYRO_CUTOFF_RECOVERY, &CopyChordedSetting<float, gyro_cutoff_recovery> },
+	{ SettingID::STICK_ACCELERATION_RATE, &CopyChordedSetting<float, stick_acceleration_rate> },
+	{ SettingID::STICK_ACCELERATION_CAP, &CopyChordedSetting<float, stick_acceleration_cap> },
+	{ SettingID::LEFT_STICK_DEADZONE_INNER, &CopyChordedSetting<float, left_stick_deadzone_inner> },
+	{ SettingID::LEFT_STICK_DEADZONE_OUTER, &CopyChordedSetting<float, left_stick_deadzone_outer> },
+	{ SettingID::RIGHT_STICK_DEADZONE_INNER, &CopyChordedSetting<float, right_stick_deadzone_inner> },
+	{ SettingID::RIGHT_STICK_DEADZONE_OUTER, &CopyChordedSetting<float, right_stick_deadzone_outer> },
+	{ SettingID::MOTION_DEADZONE_INNER, &CopyChordedSetting<float, motion_deadzone_inner> },
+	{ SettingID::MOTION_DEADZONE_OUTER, &CopyChordedSetting<float, motion_deadzone_outer> },
+	{ SettingID::LEAN_THRESHOLD, &CopyChordedSetting<float, lean_threshold> },
+	{ SettingID::FLICK_DEADZONE_ANGLE, &CopyChordedSetting<float, flick_deadzone_angle> },
+	{ SettingID::TRACKBALL_DECAY, &CopyChordedSetting<float, trackball_decay> },
+	{ SettingID::MOUSE_RING_RADIUS, &CopyChordedSetting<float, mouse_ring_radius> },
+	{ SettingID::SCREEN_RESOLUTION_X, &CopyChordedSetting<float, screen_resolution_x> },
+	{ SettingID::SCREEN_RESOLUTION_Y, &CopyChordedSetting<float, screen_resolution_y> },
+	{ SettingID::ROTATE_SMOOTH_OVERRIDE, &CopyChordedSetting<float, rotate_smooth_override> },
+	{ SettingID::FLICK_SNAP_STRENGTH, &CopyChordedSetting<float, flick_snap_strength> },
+	{ SettingID::TRIGGER_SKIP_DELAY, &CopyChordedSetting<float, trigger_skip_delay> },
+	{ SettingID::TURBO_PERIOD, &CopyChordedSetting<float, turbo_period> },
+	{ SettingID::HOLD_PRESS_TIME, &CopyChordedSetting<float, hold_press_time> },
+	{ SettingID::TOUCH_STICK_RADIUS, &CopyChordedSetting<float, touch_stick_radius> },
+	{ SettingID::TOUCH_DEADZONE_INNER, &CopyChordedSetting<float, touch_deadzone_inner> },
+	{ SettingID::DBL_PRESS_WINDOW, &CopyChordedSetting<float, dbl_press_window> },
+	// SIM_PRESS_WINDOW is not chorded, it can be accessed as is.
+	{ SettingID::LEFT_STICK_UNDEADZONE_INNER, &CopyChordedSetting<float, left_stick_undeadzone_inner> },
+	{ SettingID::LEFT_STICK_UNDEADZONE_OUTER, &CopyChordedSetting<float, left_stick_undeadzone_outer> },
+	{ SettingID::LEFT_STICK_UNPOWER, &CopyChordedSetting<float, left_stick_unpower> },
+	{ SettingID::RIGHT_STICK_UNDEADZONE_INNER, &CopyChordedSetting<float, right_stick_undeadzone_inner> },
+	{ SettingID::RIGHT_STICK_UNDEADZONE_OUTER, &CopyChordedSetting<float, right_stick_undeadzone_outer> },
+	{ SettingID::RIGHT_STICK_UNPOWER, &CopyChordedSetting<float, right_stick_unpower> },
+	{ SettingID::LEFT_STICK_VIRTUAL_SCALE, &CopyChordedSetting<float, left_stick_virtual_scale> },
+	{ SettingID::RIGHT_STICK_VIRTUAL_SCALE, &CopyChordedSetting<float, right_stick_virtual_scale> },
+};
+
+constexpr ChordedSettingEntry<int> ENUM_SETTINGS[] = {
+	{ SettingID::MOUSE_X_FROM_GYRO_AXIS, &CopyChordedSetting<int, mouse_x_from_gyro> },
+	{ SettingID::MOUSE_Y_FROM_GYRO_AXIS, &CopyChordedSetting<int, mouse_y_from_gyro> },
+	{ SettingID::LEFT_STICK_MODE, &CopyChordedSetting<int, left_stick_mode> },
+	{ SettingID::RIGHT_STICK_MODE, &CopyChordedSetting<int, right_stick_mode> },
+	{ SettingID::MOTION_STICK_MODE, &CopyChordedSetting<int, motion_stick_mode> },
+	{ SettingID::LEFT_RING_MODE, &CopyChordedSetting<int, left_ring_mode> },
+	{ SettingID::RIGHT_RING_MODE, &CopyChordedSetting<int, right_ring_mode> },
+	{ SettingID::MOTION_RING_MODE, &CopyChordedSetting<int, motion_ring_mode> },
+	{ SettingID::JOYCON_GYRO_MASK, &CopyChordedSetting<int, joycon_gyro_mask> },
+	{ SettingID::JOYCON_MOTION_MASK, &CopyChordedSetting<int, joycon_motion_mask> },
+	{ SettingID::CONTROLLER_ORIENTATION, &CopyChordedSetting<int, controller_orientation> },
+	{ SettingID::GYRO_SPACE, &CopyChordedSetting<int, gyro_space> },
+	{ SettingID::GYRO_SMOOTH_MODE, &CopyChordedSetting<int, gyro_smooth_mode> },
+	{ SettingID::ZR_MODE, &CopyChordedSetting<int, zrMode> },
+	{ SettingID::ZL_MODE, &CopyChordedSetting<int, zlMode> },
+	{ SettingID::FLICK_SNAP_MODE, &CopyChordedSetting<int, flick_snap_mode> },
+	{ SettingID::TOUCHPAD_MODE, &CopyChordedSetting<int, touchpad_mode> },
+	{ SettingID::TOUCH_STICK_MODE, &CopyChordedSetting<int, touch_stick_mode> },
+	{ SettingID::TOUCH_RING_MODE, &CopyChordedSetting<int, touch_ring_mode> },
+	{ SettingID::TOUCHPAD_DUAL_STAGE_MODE, &CopyChordedSetting<int, touch_ds_mode> },
+	{ SettingID::RUMBLE, &CopyChordedSetting<int, rumble_enable> },
+	{ SettingID::ADAPTIVE_TRIGGER, &CopyChordedSetting<int, adaptive_trigger> },
+	{ SettingID::GYRO_OUTPUT, &CopyChordedSetting<int, gyro_output> },
+	{ SettingID::FLICK_STICK_OUTPUT, &CopyChordedSetting<int, flick_stick_output> },
+};
+
+constexpr ChordedSettingEntry<FloatXY> FLOAT_XY_SETTINGS[] = {
+	{ SettingID::MIN_GYRO_SENS, &CopyChordedSetting<FloatXY, min_gyro_sens> },
+	{ SettingID::MAX_GYRO_SENS, &CopyChordedSetting<FloatXY, max_gyro_sens> },
+	{ SettingID::STICK_SENS, &CopyChordedSetting<FloatXY, stick_sens> },
+	{ SettingID::TOUCHPAD_SENS, &CopyChordedSetting<FloatXY, touchpad_sens> },
+	{ SettingID::SCROLL_SENS, &CopyChordedSetting<FloatXY, scroll_sens> },
+};
+
+constexpr ChordedSettingEntry<AxisSignPair> AXIS_SIGN_SETTINGS[] = {
+	{ SettingID::LEFT_STICK_AXIS, &CopyChordedSetting<AxisSignPair, left_stick_axis> },
+	{ SettingID::RIGHT_STICK_AXIS, &CopyChordedSetting<AxisSignPair, right_stick_axis> },
+	{ SettingID::MOTION_STICK_AXIS, &CopyChordedSetting<AxisSignPair, motion_stick_axis> },
+	{ SettingID::TOUCH_STICK_AXIS, &CopyChordedSetting<AxisSignPair, touch_stick_axis> },
+};
+
+// GYRO_ON and GYRO_OFF are the same setting
+constexpr ChordedSettingEntry<GyroSettings> GYRO_SETTINGS[] = {
+	{ SettingID::GYRO_ON, &CopyChordedSetting<GyroSettings, gyro_settings> },
+	{ SettingID::GYRO_OFF, &CopyChordedSetting<GyroSettings, gyro_settings> },
+};
+
+constexpr ChordedSettingEntry<Color> COLOR_SETTINGS[] = {
+	{ SettingID::LIGHT_BAR, &CopyChordedSetting<Color, light_bar> },
+};
+
+constexpr ChordedSettingEntry<AdaptiveTriggerSetting> TRIGGER_EFFECT_SETTINGS[] = {
+	{ SettingID::LEFT_TRIGGER_EFFECT, &CopyChordedSetting<AdaptiveTriggerSetting, left_trigger_effect> },
+	{ SettingID::RIGHT_TRIGGER_EFFECT, &CopyChordedSetting<AdaptiveTriggerSetting, right_trigger_effect> },
+};
+
+template<typename... T, size_t... N>
+constexpr bool AreSettingsUnique(const ChordedSettingEntry<T> (&...tables)[N])
+{
+	array<int, NUM_SETTINGS> counts{};
+	auto count = [&counts](const auto &table) {
+		for (const auto &entry : table)
+		{
+			++counts[size_t(entry.id)];
+		}
+	};
+	(count(tables), ...);
+	for (int numEntries : counts)
+	{
+		if (numEntries > 1)
+			return false;
+	}
+	return true;
+}
+
+static_assert(AreSettingsUnique(FLOAT_SETTINGS, ENUM_SETTINGS, FLOAT_XY_SETTINGS, AXIS_SIGN_SETTINGS, GYRO_SETTINGS, COLOR_SETTINGS, TRIGGER_EFFECT_SETTINGS),
+  "A setting can only have one entry in the registry");
+
+// The index of the registry table of each setting, in the order the tables are given, or -1 if it has none
+template<typename... T, size_t... N>
+constexpr array<int, NUM_SETTINGS> SettingTables(const ChordedSettingEntry<T> (&...tables)[N])
+{
+	array<int, NUM_SETTINGS> tableOf{};
+	for (int &table : tableOf)
+	{
+		table = -1;
+	}
+	int index = 0;
+	auto mark = [&tableOf, &index](const auto &table) {
+		for (const auto &entry : table)
+		{
+			tableOf[size_t(entry.id)] = index;
+		}
+		++index;
+	};
+	(mark(tables), ...);
+	return tableOf;
+}
+
+// Same order as the values of SettingsSnapshot
+constexpr auto SETTING_TABLES = SettingTables(FLOAT_SETTINGS, ENUM_SETTINGS, FLOAT_XY_SETTINGS, AXIS_SIGN_SETTINGS, GYRO_SETTINGS, COLOR_SETTINGS, TRIGGER_EFFECT_SETTINGS);
+
+template<typename T, typename... Types>
+constexpr int IndexOfType(const tuple<Types...> *)
+{
+	int index = 0;
+	int found = -1;
+	((found = is_same_v<T, Types> ? index : found, ++index), ...);
+	return found;
+}
+
+// The stages of joyShockPollCallback that can be skipped, and whether the configuration lets them reach an output.
+// A stage is live if any of its modeshifts or chords could make it produce something.
+struct PollStages
+{
+	bool gyro = true; // Gyro space, smoothing, cutoff, trackball and sensitivity
+	bool leftStick = true;
+	bool rightStick = true;
+	bool motionStick = true;
+	bool lean = true;
+
+	// The motion stick and the lean buttons both read the gravity relative to the neutral orientation
+	bool motionGravity() const
+	{
+		return motionStick || lean;
+	}
+};
+
+// An immutable copy of every modeshiftable setting. It is built on the thread changing the settings once a command
+// or a whole file is applied, and replaces the previous one at once, so the poll thread never resolves a half
+// applied configuration nor reads a setting while it is being parsed.
+struct SettingsSnapshot
+{
+	template<typename T>
+	using Values = array<ChordedValues<T>, NUM_SETTINGS>;
+
+	tuple<Values<float>, Values<int>, Values<FloatXY>, Values<AxisSignPair>, Values<GyroSettings>, Values<Color>, Values<AdaptiveTriggerSetting>> values;
+	// Not modeshiftable, but the derived settings depend on them
+	float osMouseSpeed = 1.0f;
+	float tickTime = 3.0f;
+	PollStages stages;
+	// Every button mapping, by ButtonID. Shared by the controllers until the next snapshot.
+	shared_ptr<const vector<ButtonMappings>> mappings;
+	FloatXY gridSize;
+	unsigned int version = 0;
+};
+
+SnapshotPointer<SettingsSnapshot> settings_snapshot;
+atomic<unsigned int> settings_snapshot_version{ 0 }; // Lets the controllers check for a new snapshot without pinning it
+
+template<typename T, size_t N>
+void CopySettingTable(SettingsSnapshot &snapshot, const ChordedSettingEntry<T> (&entries)[N])
+{
+	auto &values = get<SettingsSnapshot::Values<T>>(snapshot.values);
+	for (const auto &entry : entries)
+	{
+		entry.copy(values[int(entry.id)]);
+	}
+}
+
+template<typename T, typename Predicate>
+bool AnyChordedValue(const SettingsSnapshot &snapshot, SettingID id, Predicate predicate)
+{
+	const auto &values = get<SettingsSnapshot::Values<T>>(snapshot.values)[int(id)];
+	return any_of(values.begin(), values.end(), [&predicate](const auto &value) { return predicate(value.second); });
+}
+
+// Work out which stages of the poll feed an output with this configuration, so that the others are skipped on
+// every tick. Buttons are in use when they have a mapping, or when a mapping or a setting uses them as a chord.
+PollStages FindLivePollStages(const SettingsSnapshot &snapshot)
+{
+	bitset<ButtonVariableMap<Mapping>::SIZE> usedButtons;
+	auto useButton = [&usedButtons](ButtonID id) {
+		if (id > ButtonID::NONE && size_t(id) < usedButtons.size())
+			usedButtons.set(size_t(id));
+	};
+	bool gyroOnBind = false;
+	for (const ButtonMappings &button : *snapshot.mappings)
+	{
+		for (const auto &mappings : { &button.chords, &button.simPresses })
+		{
+			for (const auto &mapping : *mappings)
+			{
+				useButton(mapping.first);
+				if (mapping.second != Mapping::NO_MAPPING)
+					useButton(button.id);
+				gyroOnBind |= mapping.second.hasGyroOnBind();
+			}
+		}
+	}
+	apply([&useButton](const auto &...values) {
+		auto useChords = [&useButton](const auto &settings) {
+			for (const auto &chordedValues : settings)
+				for (const auto &value : chordedValues)
+					useButton(value.first);
+		};
+		(useChords(values), ...);
+	}, snapshot.values);
+	for (const auto &value : get<SettingsSnapshot::Values<GyroSettings>>(snapshot.values)[int(SettingID::GYRO_ON)])
+	{
+		useButton(value.second.button);
+	}
+	auto anyUsed = [&usedButtons](initializer_list<ButtonID> ids) {
+		return any_of(ids.begin(), ids.end(), [&usedButtons](ButtonID id) { return usedButtons.test(size_t(id)); });
+	};
+	auto mouseStickMode = [](int mode) { return mode != int(StickMode::NO_MOUSE); };
+
+	PollStages stages;
+	// The gyro is off for good when GYRO_ON = NONE without a GYRO_ON binding, or when it has no sensitivity
+	bool gyroCanTurnOn = gyroOnBind || AnyChordedValue<GyroSettings>(snapshot, SettingID::GYRO_ON, [](const GyroSettings &gyro) {
+		return !gyro.always_off || gyro.button != ButtonID::NONE || gyro.ignore_mode != GyroIgnoreMode::BUTTON;
+	});
+	auto anySensitivity = [](const FloatXY &sens) { return sens.x() != 0.f || sens.y() != 0.f; };
+	stages.gyro = gyroCanTurnOn && (AnyChordedValue<FloatXY>(snapshot, SettingID::MIN_GYRO_SENS, anySensitivity) || AnyChordedValue<FloatXY>(snapshot, SettingID::MAX_GYRO_SENS, anySensitivity));
+	stages.leftStick = AnyChordedValue<int>(snapshot, SettingID::LEFT_STICK_MODE, mouseStickMode) ||
+	  anyUsed({ ButtonID::LUP, ButtonID::LDOWN, ButtonID::LLEFT, ButtonID::LRIGHT, ButtonID::LRING });
+	stages.rightStick = AnyChordedValue<int>(snapshot, SettingID::RIGHT_STICK_MODE, mouseStickMode) ||
+	  anyUsed({ ButtonID::RUP, ButtonID::RDOWN, ButtonID::RLEFT, ButtonID::RRIGHT, ButtonID::RRING });
+	stages.motionStick = AnyChordedValue<int>(snapshot, SettingID::MOTION_STICK_MODE, mouseStickMode) ||
+	  anyUsed({ ButtonID::MUP, ButtonID::MDOWN, ButtonID::MLEFT, ButtonID::MRIGHT, ButtonID::MRING });
+	stages.lean = anyUsed({ ButtonID::LEAN_LEFT, ButtonID::LEAN_RIGHT });
+	return stages;
+}
+
+// Hand the current settings over to the poll thread, if they changed since the last call. Call once the changes
+// are all applied.
+void PublishSettings()
+{
+	static mutex publishLock;
+	static bool published = false;
+	static unsigned int publishedVariablesVersion = 0;
+	static float publishedMouseSpeed = 1.0f;
+	lock_guard guard(publishLock);
+	unsigned int variablesVersion = _variablesVersion;
+	// The OS mouse speed is a plain value set by its own commands
+	if (published && publishedVariablesVersion == variablesVersion && publishedMouseSpeed == os_mouse_speed)
+	{
+		return;
+	}
+	auto snapshot = make_unique<SettingsSnapshot>();
+	snapshot->version = settings_snapshot_version + 1;
+	snapshot->osMouseSpeed = os_mouse_speed;
+	snapshot->tickTime = tick_time.get();
+	CopySettingTable(*snapshot, FLOAT_SETTINGS);
+	CopySettingTable(*snapshot, ENUM_SETTINGS);
+	CopySettingTable(*snapshot, FLOAT_XY_SETTINGS);
+	CopySettingTable(*snapshot, AXIS_SIGN_SETTINGS);
+	CopySettingTable(*snapshot, GYRO_SETTINGS);
+	CopySettingTable(*snapshot, COLOR_SETTINGS);
+	CopySettingTable(*snapshot, TRIGGER_EFFECT_SETTINGS);
+	auto buttonMappings = make_shared<vector<ButtonMappings>>();
+	buttonMappings->reserve(FIRST_TOUCH_BUTTON + grid_mappings.size());
+	for (const JSMButton &button : mappings)
+		buttonMappings->emplace_back(button);
+	buttonMappings->resize(FIRST_TOUCH_BUTTON); // ButtonID::SIZE isn't a button
+	for (const JSMButton &button : grid_mappings)
+		buttonMappings->emplace_back(button);
+	snapshot->mappings = move(buttonMappings);
+	snapshot->gridSize = grid_size.get();
+	snapshot->stages = FindLivePollStages(*snapshot);
+	unsigned int version = snapshot->version;
+	settings_snapshot.Publish(move(snapshot));
+	settings_snapshot_version = version;
+	publishedVariablesVersion = variablesVersion;
+	publishedMouseSpeed = os_mouse_speed;
+	published = true;
+}
+
 class TouchStick
 {
 	int _index = -1;
@@ -166,11 +525,11 @@ public:
 	TouchStick(int index, shared_ptr<DigitalButton::Context> common, int handle)
 	  : _index(index)
 	{
-		buttons.emplace(ButtonID::TUP, DigitalButton(common, mappings[int(ButtonID::TUP)]));
-		buttons.emplace(ButtonID::TDOWN, DigitalButton(common, mappings[int(ButtonID::TDOWN)]));
-		buttons.emplace(ButtonID::TLEFT, DigitalButton(common, mappings[int(ButtonID::TLEFT)]));
-		buttons.emplace(ButtonID::TRIGHT, DigitalButton(common, mappings[int(ButtonID::TRIGHT)]));
-		buttons.emplace(ButtonID::TRING, DigitalButton(common, mappings[int(ButtonID::TRING)]));
+		buttons.emplace(ButtonID::TUP, DigitalButton(common, ButtonID::TUP));
+		buttons.emplace(ButtonID::TDOWN, DigitalButton(common, ButtonID::TDOWN));
+		buttons.emplace(ButtonID::TLEFT, DigitalButton(common, ButtonID::TLEFT));
+		buttons.emplace(ButtonID::TRIGHT, DigitalButton(common, ButtonID::TRIGHT));
+		buttons.emplace(ButtonID::TRING, DigitalButton(common, ButtonID::TRING));
 	}
 
 	void handleTouchStickChange(shared_ptr<JoyShock> js, bool down, short movX, short movY, float delta_time);
@@ -331,20 +690,12 @@ struct TOUCH_POINT
 class JoyShock
 {
 private:
-	float _flickSamples[256];
-	int _frontSample = 0;
-
-	FloatXY _gyroSamples[256];
-	int _frontGyroSample = 0;
-
-	template<typename E1, typename E2>
-	static inline optional<E1> GetOptionalSetting(const JSMSetting<E2> &setting, ButtonID chord)
-	{
-		return setting.get(chord) ? optional<E1>(static_cast<E1>(*setting.get(chord))) : nullopt;
-	}
+	SmoothingWindow<1, 256> _flickSmoothing;
+	SmoothingWindow<2, 256> _gyroSmoothing;
+	ExponentialSmoothing<2> _gyroExponentialSmoothing;
+	SmoothingMode _gyroSmoothingMode = SmoothingMode::WINDOW;
 
 public:
-	const int MaxGyroSamples = 256;
 	const int NumSamples = 256;
 	int handle;
 	shared_ptr<MotionIf> motion;
@@ -360,6 +711,7 @@ public:
 	vector<TouchStick> touchpads;
 	chrono::steady_clock::time_point started_flick;
 	chrono::steady_clock::time_point time_now;
+	uint64_t last_imu_timestamp = 0;
 	bool is_flicking_left = false;
 	bool is_flicking_right = false;
 	bool is_flicking_motion = false;
@@ -378,6 +730,10 @@ public:
 	TOUCH_STATE prevTouchState;
 
 	int controller_split_type = 0;
+	// The other Joy-Con of a merged pair. The pair is processed as a single controller.
+	weak_ptr<JoyShock> partner;
+	// Set when the partner processed the pair since this Joy-Con's last callback
+	bool fused_tick_done = false;
 
 	float left_acceleration = 1.0;
 	float right_acceleration = 1.0;
@@ -395,6 +751,18 @@ public:
 
 	bool processed_gyro_stick = false;
 
+	// Whether a stick held its mouse or virtual stick output past its inner deadzone on the last poll. A stick
+	// held still sends identical reports, but its output must keep going on every tick.
+	bool stick_deflected = false;
+
+	// Last mic light mode sent to this controller, -1 until one is. Any controller's callback can send it.
+	atomic_int mic_light_sent = -1;
+
+	// Running average of the time between two polls of this controller, in milliseconds, or 0 until measured.
+	// The smoothing windows and the flick stick velocity follow it rather than TICK_TIME, which the controller
+	// may not poll at.
+	float poll_period = 0.f;
+
 	float lastMotionStickX = 0.0f;
 	float lastMotionStickY = 0.0f;
 
@@ -403,10 +771,7 @@ public:
 	float lastRX = 0.f;
 	float lastRY = 0.f;
 
-	float neutralQuatW = 1.0f;
-	float neutralQuatX = 0.0f;
-	float neutralQuatY = 0.0f;
-	float neutralQuatZ = 0.0f;
+	Quat neutralQuatInverse; // Only the inverse of the neutral orientation is used by the motion stick
 
 	bool set_neutral_quat = false;
 
@@ -446,7 +811,7 @@ public:
 		buttons.reserve(LAST_ANALOG_TRIGGER); // Don't include touch stick buttons
 		for (int i = 0; i <= LAST_ANALOG_TRIGGER; ++i)
 		{
-			buttons.push_back(DigitalButton(_context, mappings[i]));
+			buttons.push_back(DigitalButton(_context, ButtonID(i)));
 		}
 		right_scroll.init(buttons[int(ButtonID::RLEFT)], buttons[int(ButtonID::RRIGHT)]);
 		left_scroll.init(buttons[int(ButtonID::LLEFT)], buttons[int(ButtonID::LRIGHT)]);
@@ -467,13 +832,51 @@ public:
 		prevTouchState.t1Down = false;
 	}
 
+	// Point the context's functors at this JoyShock. Used when the other Joy-Con sharing the context goes away.
+	void TakeOverContext()
+	{
+		_context->_getMatchingSimBtn = bind(&JoyShock::GetMatchingSimBtn, this, placeholders::_1);
+		_context->_rumble = bind(&JoyShock::Rumble, this, placeholders::_1, placeholders::_2);
+		if (_context->_vigemController)
+		{
+			_context->_vigemController.reset(Gamepad::getNew(_context->_vigemController->getType(), bind(&JoyShock::handleViGEmNotification, this, placeholders::_1, placeholders::_2, placeholders::_3)));
+		}
+		// The remaining motion becomes the main one
+		_context->rightMainMotion = motion;
+		_context->leftMotion = nullptr;
+		partner.reset();
+		fused_tick_done = false;
+	}
+
+	// Whether some state progresses with time alone: holds, turbos, press windows, trigger modes and flicks
+	bool IsBusy() const
+	{
+		auto isActive = [](const DigitalButton &button) {
+			return button.getState() != BtnState::NoPress;
+		};
+		if (any_of(buttons.begin(), buttons.end(), isActive) || any_of(gridButtons.begin(), gridButtons.end(), isActive))
+		{
+			return true;
+		}
+		for (auto &touchpad : touchpads)
+		{
+			if (any_of(touchpad.buttons.begin(), touchpad.buttons.end(), [&](auto &pair) { return isActive(pair.second); }))
+			{
+				return true;
+			}
+		}
+		return stick_deflected || any_of(triggerState.begin(), triggerState.end(), [](DstState state) { return state != DstState::NoPress; }) ||
+		  (started_flick != chrono::steady_clock::time_point() && flick_percent_done < 1.f);
+	}
+
 	~JoyShock()
 	{
-		if (controller_split_type == JS_SPLIT_TYPE_LEFT)
+		// The partner Joy-Con may have taken over the context already
+		if (controller_split_type == JS_SPLIT_TYPE_LEFT && _context->leftMotion == motion)
 		{
 			_context->leftMotion = nullptr;
 		}
-		else
+		else if (_context->rightMainMotion == motion)
 		{
 			_context->rightMainMotion = nullptr;
 		}
@@ -528,400 +931,248 @@ public:
 		Rumble(smallMotor, largeMotor);
 	}
 
-	template<typename E>
-	E getSetting(SettingID index)
+	// The settings are resolved against the chord stack only when it or a variable changed since the last call
+	template<typename T>
+	T getSetting(SettingID index)
 	{
-		static_assert(is_enum<E>::value, "Parameter of JoyShock::getSetting<E> has to be an enum type");
-		// Look at active chord mappings starting with the latest activates chord
-		for (auto activeChord = _context->chordStack.begin(); activeChord != _context->chordStack.end(); activeChord++)
+		CheckSettingType<conditional_t<is_enum_v<T>, int, T>>(index);
+		const ResolvedSettings &settings = GetResolvedSettings();
+		if constexpr (!is_enum_v<T>)
 		{
-			optional<E> opt;
+			return get<SettingValues<T>>(settings.values)[int(index)];
+		}
+		else
+		{
+			int value = get<SettingValues<int>>(settings.values)[int(index)];
 			switch (index)
 			{
-			case SettingID::MOUSE_X_FROM_GYRO_AXIS:
-				opt = GetOptionalSetting<E>(mouse_x_from_gyro, *activeChord);
-				break;
-			case SettingID::MOUSE_Y_FROM_GYRO_AXIS:
-				opt = GetOptionalSetting<E>(mouse_y_from_gyro, *activeChord);
-				break;
 			case SettingID::LEFT_STICK_MODE:
-				opt = GetOptionalSetting<E>(left_stick_mode, *activeChord);
-				if (ignore_left_stick_mode && *activeChord == ButtonID::NONE)
-					opt = optional<E>(static_cast<E>(StickMode::INVALID));
-				else
-					ignore_left_stick_mode |= (opt && *activeChord != ButtonID::NONE);
+				value = CheckModeshiftedStickMode(ignore_left_stick_mode, settings.leftStickModeChorded, value);
 				break;
 			case SettingID::RIGHT_STICK_MODE:
-				opt = GetOptionalSetting<E>(right_stick_mode, *activeChord);
-				if (ignore_right_stick_mode && *activeChord == ButtonID::NONE)
-					opt = optional<E>(static_cast<E>(StickMode::INVALID));
-				else
-					ignore_right_stick_mode |= (opt && *activeChord != ButtonID::NONE);
+				value = CheckModeshiftedStickMode(ignore_right_stick_mode, settings.rightStickModeChorded, value);
 				break;
 			case SettingID::MOTION_STICK_MODE:
-				opt = GetOptionalSetting<E>(motion_stick_mode, *activeChord);
-				if (ignore_motion_stick_mode && *activeChord == ButtonID::NONE)
-					opt = optional<E>(static_cast<E>(StickMode::INVALID));
-				else
-					ignore_motion_stick_mode |= (opt && *activeChord != ButtonID::NONE);
-				break;
-			case SettingID::LEFT_RING_MODE:
-				opt = GetOptionalSetting<E>(left_ring_mode, *activeChord);
-				break;
-			case SettingID::RIGHT_RING_MODE:
-				opt = GetOptionalSetting<E>(right_ring_mode, *activeChord);
-				break;
-			case SettingID::MOTION_RING_MODE:
-				opt = GetOptionalSetting<E>(motion_ring_mode, *activeChord);
-				break;
-			case SettingID::JOYCON_GYRO_MASK:
-				opt = GetOptionalSetting<E>(joycon_gyro_mask, *activeChord);
-				break;
-			case SettingID::JOYCON_MOTION_MASK:
-				opt = GetOptionalSetting<E>(joycon_motion_mask, *activeChord);
+				value = CheckModeshiftedStickMode(ignore_motion_stick_mode, settings.motionStickModeChorded, value);
 				break;
 			case SettingID::CONTROLLER_ORIENTATION:
-				opt = GetOptionalSetting<E>(controller_orientation, *activeChord);
-				if (opt && int(*opt) == int(ControllerOrientation::JOYCON_SIDEWAYS))
+				// A pair of Joy-Cons is held forward
+				if (value == int(ControllerOrientation::JOYCON_SIDEWAYS))
 				{
-					if (controller_split_type == JS_SPLIT_TYPE_LEFT)
+					if (controller_split_type == JS_SPLIT_TYPE_LEFT && partner.expired())
 					{
-						opt = optional<E>(static_cast<E>(ControllerOrientation::LEFT));
+						value = int(ControllerOrientation::LEFT);
 					}
-					else if (controller_split_type == JS_SPLIT_TYPE_RIGHT)
+					else if (controller_split_type == JS_SPLIT_TYPE_RIGHT && partner.expired())
 					{
-						opt = optional<E>(static_cast<E>(ControllerOrientation::RIGHT));
+						value = int(ControllerOrientation::RIGHT);
 					}
 					else
 					{
-						opt = optional<E>(static_cast<E>(ControllerOrientation::FORWARD));
+						value = int(ControllerOrientation::FORWARD);
 					}
 				}
 				break;
-			case SettingID::GYRO_SPACE:
-				opt = GetOptionalSetting<E>(gyro_space, *activeChord);
-				break;
-			case SettingID::ZR_MODE:
-				opt = GetOptionalSetting<E>(zrMode, *activeChord);
-				break;
-			case SettingID::ZL_MODE:
-				opt = GetOptionalSetting<E>(zlMode, *activeChord);
-				break;
-			case SettingID::FLICK_SNAP_MODE:
-				opt = GetOptionalSetting<E>(flick_snap_mode, *activeChord);
-				break;
-			case SettingID::TOUCHPAD_MODE:
-				opt = GetOptionalSetting<E>(touchpad_mode, *activeChord);
-				break;
-			case SettingID::TOUCH_STICK_MODE:
-				opt = GetOptionalSetting<E>(touch_stick_mode, *activeChord);
-				break;
-			case SettingID::TOUCH_RING_MODE:
-				opt = GetOptionalSetting<E>(touch_stick_mode, *activeChord);
-				break;
-			case SettingID::TOUCHPAD_DUAL_STAGE_MODE:
-				opt = GetOptionalSetting<E>(touch_ds_mode, *activeChord);
-				break;
-			case SettingID::RUMBLE:
-				opt = GetOptionalSetting<E>(rumble_enable, *activeChord);
-				break;
-			case SettingID::ADAPTIVE_TRIGGER:
-				opt = GetOptionalSetting<E>(adaptive_trigger, *activeChord);
-				break;
-			case SettingID::GYRO_OUTPUT:
-				opt = GetOptionalSetting<E>(gyro_output, *activeChord);
-				break;
-			case SettingID::FLICK_STICK_OUTPUT:
-				opt = GetOptionalSetting<E>(flick_stick_output, *activeChord);
-				break;
 			}
-			if (opt)
-				return *opt;
+			return static_cast<T>(value);
 		}
-		stringstream ss;
-		ss << "Index " << index << " is not a valid enum setting";
-		throw invalid_argument(ss.str().c_str());
 	}
 
 	float getSetting(SettingID index)
 	{
-		// Look at active chord mappings starting with the latest activates chord
-		for (auto activeChord = _context->chordStack.begin(); activeChord != _context->chordStack.end(); activeChord++)
+		CheckSettingType<float>(index);
+		return get<SettingValues<float>>(GetResolvedSettings().values)[int(index)];
+	}
+
+	// Values computed from the settings, resolved along with them rather than on every poll
+	struct DerivedSettings
+	{
+		float mouseCalibration = 1.0f; // REAL_WORLD_CALIBRATION / os mouse speed / IN_GAME_SENS
+		float flickCalibration = 1.0f; // Radians of flick to mouse movement
+		FloatXY stickSens;             // STICK_SENS in mouse movement
+		float sinLeanThreshold = 0.0f;
+		int numGyroSmoothSamples = 1;
+		int maxFlickSmoothingSamples = 1;
+		float flickStickVelocityFactor = 1.0f; // Radians per tick to degrees per second
+		float period = 0.f; // The poll period in ms the three above were derived for
+		PollStages stages;
+	};
+
+	const DerivedSettings &getDerivedSettings()
+	{
+		return GetResolvedSettings().derived;
+	}
+
+	FloatXY getGridSize()
+	{
+		return GetResolvedSettings().gridSize;
+	}
+
+	// Hand the mappings of the current settings snapshot over to the digital buttons. Call with callback_lock held.
+	void RefreshMappings()
+	{
+		_context->mappings = GetResolvedSettings().mappings;
+	}
+
+private:
+	template<typename T>
+	using SettingValues = array<T, NUM_SETTINGS>;
+
+	// Every modeshiftable setting, indexed by SettingID in the array of the type of its registry table
+	struct ResolvedSettings
+	{
+		tuple<SettingValues<float>, SettingValues<int>, SettingValues<FloatXY>, SettingValues<AxisSignPair>, SettingValues<GyroSettings>, SettingValues<Color>, SettingValues<AdaptiveTriggerSetting>> values;
+		// Whether the stick modes come from a chord rather than the base setting
+		bool leftStickModeChorded = false;
+		bool rightStickModeChorded = false;
+		bool motionStickModeChorded = false;
+		shared_ptr<const vector<ButtonMappings>> mappings;
+		FloatXY gridSize;
+		DerivedSettings derived;
+		// What the values were resolved against
+		unsigned int snapshotVersion = 0;
+		unsigned int chordStackVersion = 0;
+		bool valid = false;
+	};
+
+	ResolvedSettings _settings;
+
+	// The values of a setting are only in the array of its type
+	template<typename T>
+	static void CheckSettingType(SettingID index)
+	{
+		constexpr int table = IndexOfType<SettingValues<T>>(static_cast<decltype(ResolvedSettings::values) *>(nullptr));
+		static_assert(table >= 0, "There is no setting of that type");
+		if (SETTING_TABLES[size_t(index)] != table)
 		{
-			optional<float> opt;
-			switch (index)
-			{
-			case SettingID::MIN_GYRO_THRESHOLD:
-				opt = min_gyro_threshold.get(*activeChord);
-				break;
-			case SettingID::MAX_GYRO_THRESHOLD:
-				opt = max_gyro_threshold.get(*activeChord);
-				break;
-			case SettingID::STICK_POWER:
-				opt = stick_power.get(*activeChord);
-				break;
-			case SettingID::REAL_WORLD_CALIBRATION:
-				opt = real_world_calibration.get(*activeChord);
-				break;
-			case SettingID::VIRTUAL_STICK_CALIBRATION:
-				opt = virtual_stick_calibration.get(*activeChord);
-				break;
-			case SettingID::IN_GAME_SENS:
-				opt = in_game_sens.get(*activeChord);
-				break;
-			case SettingID::TRIGGER_THRESHOLD:
-				opt = trigger_threshold.get(*activeChord);
-				if (opt && platform_controller_type == JS_TYPE_DS && getSetting<Switch>(SettingID::ADAPTIVE_TRIGGER) == Switch::ON)
-					opt = optional(max(0.f, *opt)); // hair trigger disabled on dual sense when adaptive triggers are active
-				break;
-			case SettingID::GYRO_AXIS_X:
-				opt = GetOptionalSetting<float>(gyro_x_sign, *activeChord);
-				break;
-			case SettingID::GYRO_AXIS_Y:
-				opt = GetOptionalSetting<float>(gyro_y_sign, *activeChord);
-				break;
-			case SettingID::FLICK_TIME:
-				opt = flick_time.get(*activeChord);
-				break;
-			case SettingID::FLICK_TIME_EXPONENT:
-				opt = flick_time_exponent.get(*activeChord);
-				break;
-			case SettingID::GYRO_SMOOTH_THRESHOLD:
-				opt = gyro_smooth_threshold.get(*activeChord);
-				break;
-			case SettingID::GYRO_SMOOTH_TIME:
-				opt = gyro_smooth_time.get(*activeChord);
-				break;
-			case SettingID::GYRO_CUTOFF_SPEED:
-				opt = gyro_cutoff_speed.get(*activeChord);
-				break;
-			case SettingID::GYRO_CUTOFF_RECOVERY:
-				opt = gyro_cutoff_recovery.get(*activeChord);
-				break;
-			case SettingID::STICK_ACCELERATION_RATE:
-				opt = stick_acceleration_rate.get(*activeChord);
-				break;
-			case SettingID::STICK_ACCELERATION_CAP:
-				opt = stick_acceleration_cap.get(*activeChord);
-				break;
-			case SettingID::LEFT_STICK_DEADZONE_INNER:
-				opt = left_stick_deadzone_inner.get(*activeChord);
-				break;
-			case SettingID::LEFT_STICK_DEADZONE_OUTER:
-				opt = left_stick_deadzone_outer.get(*activeChord);
-				break;
-			case SettingID::RIGHT_STICK_DEADZONE_INNER:
-				opt = right_stick_deadzone_inner.get(*activeChord);
-				break;
-			case SettingID::RIGHT_STICK_DEADZONE_OUTER:
-				opt = right_stick_deadzone_outer.get(*activeChord);
-				break;
-			case SettingID::MOTION_DEADZONE_INNER:
-				opt = motion_deadzone_inner.get(*activeChord);
-				break;
-			case SettingID::MOTION_DEADZONE_OUTER:
-				opt = motion_deadzone_outer.get(*activeChord);
-				break;
-			case SettingID::LEAN_THRESHOLD:
-				opt = lean_threshold.get(*activeChord);
-				break;
-			case SettingID::FLICK_DEADZONE_ANGLE:
-				opt = flick_deadzone_angle.get(*activeChord);
-				break;
-			case SettingID::TRACKBALL_DECAY:
-				opt = trackball_decay.get(*activeChord);
-				break;
-			case SettingID::MOUSE_RING_RADIUS:
-				opt = mouse_ring_radius.get(*activeChord);
-				break;
-			case SettingID::SCREEN_RESOLUTION_X:
-				opt = screen_resolution_x.get(*activeChord);
-				break;
-			case SettingID::SCREEN_RESOLUTION_Y:
-				opt = screen_resolution_y.get(*activeChord);
-				break;
-			case SettingID::ROTATE_SMOOTH_OVERRIDE:
-				opt = rotate_smooth_override.get(*activeChord);
-				break;
-			case SettingID::FLICK_SNAP_STRENGTH:
-				opt = flick_snap_strength.get(*activeChord);
-				break;
-			case SettingID::TRIGGER_SKIP_DELAY:
-				opt = trigger_skip_delay.get(*activeChord);
-				break;
-			case SettingID::TURBO_PERIOD:
-				opt = turbo_period.get(*activeChord);
-				break;
-			case SettingID::HOLD_PRESS_TIME:
-				opt = hold_press_time.get(*activeChord);
-				break;
-			case SettingID::TOUCH_STICK_RADIUS:
-				opt = touch_stick_radius.get(*activeChord);
-				break;
-			case SettingID::TOUCH_DEADZONE_INNER:
-				opt = touch_deadzone_inner.get(*activeChord);
-				break;
-			case SettingID::DBL_PRESS_WINDOW:
-				opt = dbl_press_window.get(*activeChord);
-				break;
-				// SIM_PRESS_WINDOW are not chorded, they can be accessed as is.
-			case SettingID::LEFT_STICK_UNDEADZONE_INNER:
-				opt = left_stick_undeadzone_inner.get(*activeChord);
-				break;
-			case SettingID::LEFT_STICK_UNDEADZONE_OUTER:
-				opt = left_stick_undeadzone_outer.get(*activeChord);
-				break;
-			case SettingID::LEFT_STICK_UNPOWER:
-				opt = left_stick_unpower.get(*activeChord);
-				break;
-			case SettingID::RIGHT_STICK_UNDEADZONE_INNER:
-				opt = right_stick_undeadzone_inner.get(*activeChord);
-				break;
-			case SettingID::RIGHT_STICK_UNDEADZONE_OUTER:
-				opt = right_stick_undeadzone_outer.get(*activeChord);
-				break;
-			case SettingID::RIGHT_STICK_UNPOWER:
-				opt = right_stick_unpower.get(*activeChord);
-				break;
-			case SettingID::LEFT_STICK_VIRTUAL_SCALE:
-				opt = left_stick_virtual_scale.get(*activeChord);
-				break;
-			case SettingID::RIGHT_STICK_VIRTUAL_SCALE:
-				opt = right_stick_virtual_scale.get(*activeChord);
-				break;
-			}
-			if (opt)
-				return *opt;
+			stringstream ss;
+			ss << "Index " << index << " is not a setting of that type";
+			throw invalid_argument(ss.str().c_str());
 		}
-
-		std::stringstream message;
-		message << "Index " << index << " is not a valid float setting";
-		throw std::out_of_range(message.str().c_str());
 	}
 
-	template<>
-	FloatXY getSetting<FloatXY>(SettingID index)
+	const ResolvedSettings &GetResolvedSettings()
 	{
-		// Look at active chord mappings starting with the latest activates chord
-		for (auto activeChord = _context->chordStack.begin(); activeChord != _context->chordStack.end(); activeChord++)
+		if (!_settings.valid || _settings.snapshotVersion != settings_snapshot_version || _settings.chordStackVersion != _context->chordStack.version())
 		{
-			optional<FloatXY> opt;
-			switch (index)
+			auto snapshot = settings_snapshot.Read();
+			if (snapshot)
 			{
-			case SettingID::MIN_GYRO_SENS:
-				opt = min_gyro_sens.get(*activeChord);
-				break;
-			case SettingID::MAX_GYRO_SENS:
-				opt = max_gyro_sens.get(*activeChord);
-				break;
-			case SettingID::STICK_SENS:
-				opt = stick_sens.get(*activeChord);
-				break;
-			case SettingID::TOUCHPAD_SENS:
-				opt = touchpad_sens.get(*activeChord);
-				break;
-			case SettingID::SCROLL_SENS:
-				opt = scroll_sens.get(*activeChord);
-				break;
+				_settings.snapshotVersion = snapshot->version;
+				_settings.chordStackVersion = _context->chordStack.version();
+				ResolveSettings(*snapshot);
+				_settings.valid = true;
 			}
-			if (opt)
-				return *opt;
-		} // Check next Chord
+		}
+		return _settings;
+	}
 
-		stringstream ss;
-		ss << "Index " << index << " is not a valid FloatXY setting";
-		throw invalid_argument(ss.str().c_str());
+	void ResolveSettings(const SettingsSnapshot &snapshot)
+	{
+		ResolveSettingTable(snapshot, FLOAT_SETTINGS);
+		ResolveSettingTable(snapshot, ENUM_SETTINGS);
+		ResolveSettingTable(snapshot, FLOAT_XY_SETTINGS);
+		ResolveSettingTable(snapshot, AXIS_SIGN_SETTINGS);
+		ResolveSettingTable(snapshot, GYRO_SETTINGS);
+		ResolveSettingTable(snapshot, COLOR_SETTINGS);
+		ResolveSettingTable(snapshot, TRIGGER_EFFECT_SETTINGS);
+		auto &floats = get<SettingValues<float>>(_settings.values);
+		if (platform_controller_type == JS_TYPE_DS && get<SettingValues<int>>(_settings.values)[int(SettingID::ADAPTIVE_TRIGGER)] == int(Switch::ON))
+		{
+			// hair trigger disabled on dual sense when adaptive triggers are active
+			floats[int(SettingID::TRIGGER_THRESHOLD)] = max(0.f, floats[int(SettingID::TRIGGER_THRESHOLD)]);
+		}
+		auto &enums = get<SettingsSnapshot::Values<int>>(snapshot.values);
+		_settings.leftStickModeChorded = FindChordedValue(enums[int(SettingID::LEFT_STICK_MODE)]).first != ButtonID::NONE;
+		_settings.rightStickModeChorded = FindChordedValue(enums[int(SettingID::RIGHT_STICK_MODE)]).first != ButtonID::NONE;
+		_settings.motionStickModeChorded = FindChordedValue(enums[int(SettingID::MOTION_STICK_MODE)]).first != ButtonID::NONE;
+		_settings.mappings = snapshot.mappings;
+		_settings.gridSize = snapshot.gridSize;
+		DeriveSettings(snapshot);
 	}
 
-	template<>
-	GyroSettings getSetting<GyroSettings>(SettingID index)
+	void DeriveSettings(const SettingsSnapshot &snapshot)
 	{
-		if (index == SettingID::GYRO_ON || index == SettingID::GYRO_OFF)
+		auto &floats = get<SettingValues<float>>(_settings.values);
+		auto &derived = _settings.derived;
+		float realWorldCalibration = floats[int(SettingID::REAL_WORLD_CALIBRATION)];
+		float inGameSens = floats[int(SettingID::IN_GAME_SENS)];
+		derived.mouseCalibration = realWorldCalibration / snapshot.osMouseSpeed / inGameSens;
+		// account for os mouse speed and convert from radians to degrees
+		derived.flickCalibration = derived.mouseCalibration * 180.0f / PI;
+		FloatXY stickSens = get<SettingValues<FloatXY>>(_settings.values)[int(SettingID::STICK_SENS)];
+		derived.stickSens = { stickSens.x() * derived.mouseCalibration, stickSens.y() * derived.mouseCalibration };
+		derived.sinLeanThreshold = sin(floats[int(SettingID::LEAN_THRESHOLD)] * PI / 180.f);
+		derived.stages = snapshot.stages;
+		DerivePeriodSettings(poll_period > 0.f ? poll_period : snapshot.tickTime);
+	}
+
+	void DerivePeriodSettings(float period)
+	{
+		auto &floats = get<SettingValues<float>>(_settings.values);
+		auto &derived = _settings.derived;
+		// convert gyro smooth time to number of samples, need at least 1 sample
+		derived.numGyroSmoothSamples = int(max(1.f, floats[int(SettingID::GYRO_SMOOTH_TIME)] * 1000.f / period));
+		derived.maxFlickSmoothingSamples = clamp((int)ceil(64.0f / period), 1, NumSamples); // target a max smoothing window size of 64ms
+		derived.flickStickVelocityFactor = 180.0f / (PI * 0.001f * period);
+		derived.period = period;
+	}
+
+public:
+	// Track the time between polls, and derive the settings that depend on it again once it drifted away
+	void MeasurePollPeriod(float deltaTime)
+	{
+		float ms = deltaTime * 1000.f;
+		if (ms <= 0.f || ms > 100.f)
 		{
-			// Look at active chord mappings starting with the latest activates chord
-			for (auto activeChord = _context->chordStack.begin(); activeChord != _context->chordStack.end(); activeChord++)
-			{
-				auto opt = gyro_settings.get(*activeChord);
-				if (opt)
-					return *opt;
-			}
+			// Reconnection, or the poll thread left the controller idle: no relation to the rate it polls at
+			return;
+		}
+		poll_period = poll_period > 0.f ? poll_period + (ms - poll_period) * 0.05f : ms;
+		const auto &settings = GetResolvedSettings();
+		if (settings.valid && abs(poll_period - settings.derived.period) > settings.derived.period * 0.1f)
+		{
+			DerivePeriodSettings(poll_period);
 		}
-		stringstream ss;
-		ss << "Index " << index << " is not a valid GyroSetting";
-		throw invalid_argument(ss.str().c_str());
 	}
 
-	template<>
-	Color getSetting<Color>(SettingID index)
+private:
+
+	// Modeshifting the stick mode ignores the base mode after the chord is released, until the stick returns to neutral
+	static int CheckModeshiftedStickMode(bool &ignoreStickMode, bool modeshifted, int mode)
 	{
-		if (index == SettingID::LIGHT_BAR)
+		if (modeshifted)
 		{
-			// Look at active chord mappings starting with the latest activates chord
-			for (auto activeChord = _context->chordStack.begin(); activeChord != _context->chordStack.end(); activeChord++)
-			{
-				auto opt = light_bar.get(*activeChord);
-				if (opt)
-					return *opt;
-			}
+			ignoreStickMode = true;
+			return mode;
 		}
-		stringstream ss;
-		ss << "Index " << index << " is not a valid Color";
-		throw invalid_argument(ss.str().c_str());
+		return ignoreStickMode ? int(StickMode::INVALID) : mode;
 	}
 
-	template<>
-	AdaptiveTriggerSetting getSetting<AdaptiveTriggerSetting>(SettingID index)
+	template<typename T, size_t N>
+	void ResolveSettingTable(const SettingsSnapshot &snapshot, const ChordedSettingEntry<T> (&entries)[N])
 	{
-		// Look at active chord mappings starting with the latest activates chord
-		for (auto activeChord = _context->chordStack.begin(); activeChord != _context->chordStack.end(); activeChord++)
+		auto &chordedValues = get<SettingsSnapshot::Values<T>>(snapshot.values);
+		auto &values = get<SettingValues<T>>(_settings.values);
+		for (const auto &entry : entries)
 		{
-			optional<AdaptiveTriggerSetting> opt;
-			switch (index)
-			{
-			case SettingID::LEFT_TRIGGER_EFFECT:
-				opt = left_trigger_effect.get(*activeChord);
-				if (opt)
-					return *opt;
-			case SettingID::RIGHT_TRIGGER_EFFECT:
-				opt = right_trigger_effect.get(*activeChord);
-				if (opt)
-					return *opt;
-			}
+			values[int(entry.id)] = FindChordedValue(chordedValues[int(entry.id)]).second;
 		}
-		stringstream ss;
-		ss << "Index " << index << " is not a valid AdaptiveTriggerSetting";
-		throw invalid_argument(ss.str().c_str());
 	}
 
-	template<>
-	AxisSignPair getSetting<AxisSignPair>(SettingID index)
+	// The chord is NONE when the value is the base setting
+	template<typename T>
+	const pair<ButtonID, T> &FindChordedValue(const ChordedValues<T> &values) const
 	{
 		// Look at active chord mappings starting with the latest activates chord
-		for (auto activeChord = _context->chordStack.begin(); activeChord != _context->chordStack.end(); activeChord++)
+		for (ButtonID chord : _context->chordStack)
 		{
-			optional<AxisSignPair> opt;
-			switch (index)
-			{
-			case SettingID::LEFT_STICK_AXIS:
-				opt = left_stick_axis.get(*activeChord);
-				break;
-			case SettingID::RIGHT_STICK_AXIS:
-				opt = right_stick_axis.get(*activeChord);
-				break;
-			case SettingID::MOTION_STICK_AXIS:
-				opt = motion_stick_axis.get(*activeChord);
-				break;
-			case SettingID::TOUCH_STICK_AXIS:
-				opt = touch_stick_axis.get(*activeChord);
-				break;
-			}
-			if (opt)
-				return *opt;
-		} // Check next Chord
-
-		stringstream ss;
-		ss << "Index " << index << " is not a valid AxisSignPair setting";
-		throw invalid_argument(ss.str().c_str());
+			auto value = find_if(values.begin(), values.end(), [chord](const auto &value) { return value.first == chord; });
+			if (value != values.end())
+				return *value;
+		}
+		// Chord stack should always include NONE which will provide a value in the loop above
+		throw runtime_error("ChordStack should always include ButtonID::NONE, for the chorded variable to return the base value.");
 	}
 
 public:
@@ -931,12 +1182,16 @@ public:
 		// POTENTIAL FLAW: The mapping you find may not necessarily be the one that got you in a
 		// Simultaneous state in the first place if there is a second SimPress going on where one
 		// of the buttons has a third SimMap with this one. I don't know if it's worth solving though...
-		for (int id = 0; id < mappings.size(); ++id)
+		auto &table = _context->mappings;
+		if (!table || size_t(index) >= table->size())
+		{
+			return nullptr;
+		}
+		for (auto &simPress : (*table)[size_t(index)].simPresses)
 		{
-			auto simMap = mappings[int(index)].getSimMap(ButtonID(id));
-			if (simMap && index != simMap->first && buttons[int(simMap->first)].getState() == buttons[int(index)].getState())
+			if (index != simPress.first && size_t(simPress.first) < buttons.size() && buttons[int(simPress.first)].getState() == buttons[int(index)].getState())
 			{
-				return &buttons[int(simMap->first)];
+				return &buttons[int(simPress.first)];
 			}
 		}
 		return nullptr;
@@ -944,19 +1199,11 @@ public:
 
 	void ResetSmoothSample()
 	{
-		_frontSample = 0;
-		for (int i = 0; i < NumSamples; i++)
-		{
-			_flickSamples[i] = 0.0;
-		}
+		_flickSmoothing.Reset();
 	}
 
 	float GetSmoothedStickRotation(float value, float bottomThreshold, float topThreshold, int maxSamples)
 	{
-		// which sample in the circular smoothing buffer do we want to write over?
-		_frontSample--;
-		if (_frontSample < 0)
-			_frontSample = NumSamples - 1;
 		// if this input is bigger than the top threshold, it'll all be consumed immediately; 0 gets put into the smoothing buffer. If it's below the bottomThreshold, it'll all be put in the smoothing buffer
 		float length = abs(value);
 		float immediateFactor;
@@ -978,27 +1225,15 @@ public:
 			immediateFactor = 1.0f;
 		}
 		float smoothFactor = 1.0f - immediateFactor;
-		// now we can push the smooth sample (or as much of it as we want smoothed)
-		float frontSample = _flickSamples[_frontSample] = value * smoothFactor;
-		// and now calculate smoothed result
-		float result = frontSample / maxSamples;
-		for (int i = 1; i < maxSamples; i++)
-		{
-			int rotatedIndex = (_frontSample + i) % NumSamples;
-			frontSample = _flickSamples[rotatedIndex];
-			result += frontSample / maxSamples;
-		}
+		// now we can push the smooth sample (or as much of it as we want smoothed) and get the smoothed result
+		float result = _flickSmoothing.Push({ value * smoothFactor }, maxSamples)[0];
 		// finally, add immediate portion
 		return result + value * immediateFactor;
 	}
 
-	void GetSmoothedGyro(float x, float y, float length, float bottomThreshold, float topThreshold, int maxSamples, float &outX, float &outY)
+	void GetSmoothedGyro(float x, float y, float length, float bottomThreshold, float topThreshold, int maxSamples, SmoothingMode mode, float &outX, float &outY)
 	{
 		// this is basically the same as we use for smoothing flick-stick rotations, but because this deals in vectors, it's a slightly different function. Not worth abstracting until it'll be used in more ways
-		// which item in the circular smoothing buffer will we write over?
-		_frontGyroSample--;
-		if (_frontGyroSample < 0)
-			_frontGyroSample = MaxGyroSamples - 1;
 		float immediateFactor;
 		if (topThreshold <= bottomThreshold)
 		{
@@ -1018,21 +1253,19 @@ public:
 			immediateFactor = 1.0f;
 		}
 		float smoothFactor = 1.0f - immediateFactor;
-		// now we can push the smooth sample (or as much of it as we want smoothed)
-		FloatXY frontSample = _gyroSamples[_frontGyroSample] = { x * smoothFactor, y * smoothFactor };
-		// and now calculate smoothed result
-		float xResult = frontSample.x() / maxSamples;
-		float yResult = frontSample.y() / maxSamples;
-		for (int i = 1; i < maxSamples; i++)
-		{
-			int rotatedIndex = (_frontGyroSample + i) % MaxGyroSamples;
-			frontSample = _gyroSamples[rotatedIndex];
-			xResult += frontSample.x() / maxSamples;
-			yResult += frontSample.y() / maxSamples;
+		if (mode != _gyroSmoothingMode)
+		{
+			// Start the other smoothing afresh rather than from whatever it was left with
+			_gyroSmoothing.Reset();
+			_gyroExponentialSmoothing.Reset();
+			_gyroSmoothingMode = mode;
 		}
+		// now we can push the smooth sample (or as much of it as we want smoothed) and get the smoothed result
+		array<float, 2> smoothSample = { x * smoothFactor, y * smoothFactor };
+		auto result = mode == SmoothingMode::EXPONENTIAL ? _gyroExponentialSmoothing.Push(smoothSample, maxSamples) : _gyroSmoothing.Push(smoothSample, maxSamples);
 		// finally, add immediate portion
-		outX = xResult + x * immediateFactor;
-		outY = yResult + y * immediateFactor;
+		outX = result[0] + x * immediateFactor;
+		outY = result[1] + y * immediateFactor;
 	}
 
 private:
@@ -1412,7 +1645,7 @@ public:
 		// Use chord stack to know if a button is pressed, because the state from the callback
 		// only holds half the information when it comes to a joycon pair.
 		// Also, NONE is always part of the stack (for chord handling) but NONE is never pressed.
-		return btn != ButtonID::NONE && find(_context->chordStack.begin(), _context->chordStack.end(), btn) != _context->chordStack.end();
+		return btn != ButtonID::NONE && _context->chordStack.contains(btn);
 	}
 
 	// return true if it hits the outer deadzone
@@ -1449,8 +1682,7 @@ public:
 
 		for (size_t i = gridButtons.size(); i < grid_mappings.size(); ++i)
 		{
-			JSMButton &map(grid_mappings[i]);
-			gridButtons.push_back(DigitalButton(_context, map));
+			gridButtons.push_back(DigitalButton(_context, grid_mappings[i]._id));
 		}
 	}
 };
@@ -1499,6 +1731,7 @@ static void resetAllMappings()
 	flick_time_exponent.Reset();
 	gyro_smooth_time.Reset();
 	gyro_smooth_threshold.Reset();
+	gyro_smooth_mode.Reset();
 	gyro_cutoff_speed.Reset();
 	gyro_cutoff_recovery.Reset();
 	stick_acceleration_rate.Reset();
@@ -1532,6 +1765,7 @@ static void resetAllMappings()
 	touch_ring_mode.Reset();
 	touchpad_sens.Reset();
 	tick_time.Reset();
+	auto_tick.Reset();
 	light_bar.Reset();
 	scroll_sens.Reset();
 	rumble_enable.Reset();
@@ -1559,9 +1793,80 @@ static void resetAllMappings()
 	last_flick_and_rotation = 0.0f;
 }
 
+// Create the JoyShock of a device unless it has one already. Caller must hold connection_lock.
+void addDevice(int handle)
+{
+	if (handle_to_joyshock.Get(handle))
+		return;
+	auto type = jsl->GetControllerSplitType(handle);
+	if (type == 0) // Split types start at 1, the device went away
+		return;
+	auto otherJoyCon = handle_to_joyshock.end();
+	if (merge_joycons && (type == JS_SPLIT_TYPE_LEFT || type == JS_SPLIT_TYPE_RIGHT))
+	{
+		// Look for a Joy-Con of the other side that isn't paired yet
+		otherJoyCon = find_if(handle_to_joyshock.begin(), handle_to_joyshock.end(), [type](auto &pair) {
+			if (pair.second->controller_split_type != (type == JS_SPLIT_TYPE_LEFT ? JS_SPLIT_TYPE_RIGHT : JS_SPLIT_TYPE_LEFT))
+				return false;
+			return none_of(handle_to_joyshock.begin(), handle_to_joyshock.end(), [&pair](auto &other) {
+				return other.first != pair.first && other.second->_context == pair.second->_context;
+			});
+		});
+	}
+	shared_ptr<JoyShock> js = nullptr;
+	if (otherJoyCon != handle_to_joyshock.end())
+	{
+		// The second JC points to the same common buttons as the other one.
+		auto &other = otherJoyCon->second;
+		lock_guard guard(other->_context->callback_lock);
+		js.reset(new JoyShock(handle, type, other->_context));
+		js->partner = other;
+		other->partner = js;
+		auto &left = type == JS_SPLIT_TYPE_LEFT ? js : other;
+		auto &right = type == JS_SPLIT_TYPE_LEFT ? other : js;
+		js->_context->leftMotion = left->motion;
+		js->_context->rightMainMotion = right->motion;
+	}
+	else
+	{
+		js.reset(new JoyShock(handle, type));
+	}
+	if (!handle_to_joyshock.InsertAt(handle, js))
+	{
+		CERR << "Device handle " << handle << " is already in use. The device will be ignored." << endl;
+	}
+}
+
+// Destroy the JoyShock of a device. Its Joy-Con partner keeps the shared context. Caller must hold connection_lock.
+void removeDevice(int handle)
+{
+	auto js = handle_to_joyshock.Get(handle);
+	if (!js || !handle_to_joyshock.Remove(handle))
+		return;
+	for (auto &pair : handle_to_joyshock)
+	{
+		if (pair.second->_context == js->_context)
+		{
+			lock_guard guard(js->_context->callback_lock);
+			pair.second->TakeOverContext();
+		}
+	}
+}
+
+// Destroy all the JoyShocks, when switching to a backend whose handles mean other devices
+void clearDevices()
+{
+	lock_guard guard(connection_lock);
+	handle_to_joyshock.Clear();
+}
+
+// Bring the JoyShocks up to date with the devices of the backend. The devices that stay connected keep their
+// state, unless they are Joy-Cons and the merging changes.
 void connectDevices(bool mergeJoycons = true)
 {
-	handle_to_joyshock.clear();
+	lock_guard guard(connection_lock);
+	bool remerge = mergeJoycons != merge_joycons;
+	merge_joycons = mergeJoycons;
 	int numConnected = jsl->ConnectDevices();
 	vector<int> deviceHandles(numConnected, 0);
 	if (numConnected > 0)
@@ -1572,28 +1877,25 @@ void connectDevices(bool mergeJoycons = true)
 		{
 			deviceHandles.resize(numConnected);
 		}
+	}
 
-		for (auto handle : deviceHandles) // Don't use foreach!
-		{
-			auto type = jsl->GetControllerSplitType(handle);
-			auto otherJoyCon = find_if(handle_to_joyshock.begin(), handle_to_joyshock.end(),
-			  [type](auto &pair) {
-				  return type == JS_SPLIT_TYPE_LEFT && pair.second->controller_split_type == JS_SPLIT_TYPE_RIGHT ||
-				    type == JS_SPLIT_TYPE_RIGHT && pair.second->controller_split_type == JS_SPLIT_TYPE_LEFT;
-			  });
-			shared_ptr<JoyShock> js = nullptr;
-			if (mergeJoycons && otherJoyCon != handle_to_joyshock.end())
-			{
-				// The second JC points to the same common buttons as the other one.
-				js.reset(new JoyShock(handle, type, otherJoyCon->second->_context));
-			}
-			else
-			{
-				js.reset(new JoyShock(handle, type));
-			}
-			handle_to_joyshock[handle] = js;
+	vector<int> removed;
+	for (auto &pair : handle_to_joyshock)
+	{
+		bool isJoycon = pair.second->controller_split_type == JS_SPLIT_TYPE_LEFT || pair.second->controller_split_type == JS_SPLIT_TYPE_RIGHT;
+		if ((remerge && isJoycon) || find(deviceHandles.begin(), deviceHandles.end(), pair.first) == deviceHandles.end())
+		{
+			removed.push_back(pair.first);
 		}
 	}
+	for (auto handle : removed)
+	{
+		removeDevice(handle);
+	}
+	for (auto handle : deviceHandles)
+	{
+		addDevice(handle);
+	}
 
 	if (numConnected == 1)
 	{
@@ -1632,6 +1934,7 @@ bool do_NO_GYRO_BUTTON()
 bool do_RESET_MAPPINGS(CmdRegistry *registry)
 {
 	COUT << "Resetting all mappings to defaults" << endl;
+	NotificationBatch batch;
 	resetAllMappings();
 	if (registry)
 	{
@@ -1645,16 +1948,47 @@ bool do_RESET_MAPPINGS(CmdRegistry *registry)
 	return true;
 }
 
+// Called by the backend after processing a device, to know whether it must be processed again without new input
+bool BusyCallback(int jcHandle)
+{
+	auto jc = handle_to_joyshock.Get(jcHandle);
+	return jc && jc->IsBusy();
+}
+
+// Called by the backend when a device is plugged in or unplugged. The other devices are left untouched.
+void ConnectionCallback(int jcHandle, bool isConnected)
+{
+	lock_guard guard(connection_lock);
+	if (isConnected)
+	{
+		addDevice(jcHandle);
+		COUT << "A device was connected. " << handle_to_joyshock.size() << " devices connected" << endl;
+	}
+	else
+	{
+		removeDevice(jcHandle);
+		COUT << "A device was disconnected. " << handle_to_joyshock.size() << " devices connected" << endl;
+	}
+}
+
 bool do_RECONNECT_CONTROLLERS(in_string arguments)
 {
 	bool mergeJoycons = arguments.empty() || (arguments.compare("MERGE") == 0);
 	if (mergeJoycons || arguments.rfind("SPLIT", 0) == 0)
 	{
 		COUT << "Reconnecting controllers: " << arguments << endl;
-		jsl->DisconnectAndDisposeAll();
+		if (hardware_jsl)
+		{
+			// Stop replaying
+			jsl->DisconnectAndDisposeAll();
+			jsl = move(hardware_jsl);
+			clearDevices();
+		}
 		connectDevices(mergeJoycons);
 		jsl->SetCallback(&joyShockPollCallback);
 		jsl->SetTouchCallback(&TouchCallback);
+		jsl->SetConnectionCallback(&ConnectionCallback);
+		jsl->SetBusyCallback(&BusyCallback);
 		return true;
 	}
 	return false;
@@ -1757,6 +2091,109 @@ bool do_SET_MOTION_STICK_NEUTRAL()
 	return true;
 }
 
+bool do_TICK_STATS(in_string argument)
+{
+	if (argument == "RESET")
+	{
+		tick_scheduler.Reset();
+		COUT << "Tick statistics cleared." << endl;
+		return true;
+	}
+	else if (!argument.empty())
+	{
+		return false;
+	}
+
+	auto stats = tick_scheduler.GetStats();
+	if (stats.numTicks == 0)
+	{
+		COUT << "No tick recorded yet." << endl;
+		return true;
+	}
+	if (auto_tick.get() == Switch::ON)
+	{
+		COUT << "Target period: AUTO, " << stats.numTicks << " ticks, " << stats.numOverruns << " overruns" << endl;
+	}
+	else
+	{
+		COUT << "Target period: " << tick_time.get() << "ms, " << stats.numTicks << " ticks, " << stats.numOverruns << " overruns" << endl;
+	}
+	// Formatted apart so the console keeps its number format
+	stringstream ss;
+	ss << fixed << setprecision(3);
+	ss << "Period: p50 " << stats.p50Period << "ms, p99 " << stats.p99Period << "ms, max " << stats.maxPeriod << "ms" << endl;
+	ss << "Jitter: p50 " << stats.p50Jitter << "ms, p99 " << stats.p99Jitter << "ms, max " << stats.maxJitter << "ms" << endl;
+	ss << "Work: p50 " << stats.p50Work << "ms, p99 " << stats.p99Work << "ms, max " << stats.maxWork << "ms" << endl;
+	ss << setprecision(1);
+	for (auto &pair : handle_to_joyshock)
+	{
+		float rate = jsl->GetPollRate(pair.first);
+		if (rate > 0.f)
+		{
+			ss << "Device " << pair.first << " reports at " << rate << "Hz" << endl;
+		}
+	}
+	COUT << ss.str();
+	return true;
+}
+
+bool do_RECORD_INPUT(in_string argument)
+{
+	if (input_recorder.IsOpen())
+	{
+		input_recorder.Close();
+		COUT << "Recorded " << input_recorder.GetNumFrames() << " frames." << endl;
+	}
+	if (argument.empty())
+	{
+		return true;
+	}
+	if (!input_recorder.Open(argument))
+	{
+		CERR << "Could not write to " << argument << endl;
+		return false;
+	}
+	COUT << "Recording the input of all devices to " << argument << ". Enter RECORD_INPUT alone to stop." << endl;
+	return true;
+}
+
+bool do_REPLAY_INPUT(in_string argument)
+{
+	string path = argument;
+	bool realTime = false;
+	static const string REALTIME = " REALTIME";
+	if (path.size() > REALTIME.size() && path.compare(path.size() - REALTIME.size(), REALTIME.size(), REALTIME) == 0)
+	{
+		realTime = true;
+		path.resize(path.size() - REALTIME.size());
+	}
+	if (path.empty())
+	{
+		return false;
+	}
+	string error;
+	auto trace = InputTrace::Load(path, error);
+	if (!trace)
+	{
+		CERR << error << endl;
+		return true;
+	}
+	COUT << "Replaying " << trace->GetNumFrames() << " frames of " << trace->GetHandles().size() << " devices" << (realTime ? " in real time" : "") << ". Enter RECONNECT_CONTROLLERS to go back to the controllers." << endl;
+	jsl->DisconnectAndDisposeAll();
+	if (!hardware_jsl)
+	{
+		hardware_jsl = move(jsl);
+	}
+	jsl.reset(NewTraceReplayer(move(trace), realTime));
+	clearDevices();
+	connectDevices(merge_joycons);
+	jsl->SetCallback(&joyShockPollCallback);
+	jsl->SetTouchCallback(&TouchCallback);
+	jsl->SetConnectionCallback(&ConnectionCallback);
+	jsl->SetBusyCallback(&BusyCallback);
+	return true;
+}
+
 bool do_SLEEP(in_string argument)
 {
 	// first, check for a parameter
@@ -1930,7 +2367,7 @@ bool processGyroStick(shared_ptr<JoyShock> jc, float stickX, float stickY, float
 	return stickLength > undeadzoneInner;
 }
 
-static float handleFlickStick(float calX, float calY, float lastCalX, float lastCalY, float stickLength, bool &isFlicking, shared_ptr<JoyShock> jc, float mouseCalibrationFactor, bool FLICK_ONLY, bool ROTATE_ONLY)
+static float handleFlickStick(float calX, float calY, float lastCalX, float lastCalY, float stickLength, bool &isFlicking, shared_ptr<JoyShock> jc, bool FLICK_ONLY, bool ROTATE_ONLY)
 {
 	GyroOutput flickStickOutput = jc->getSetting<GyroOutput>(SettingID::FLICK_STICK_OUTPUT);
 	bool isMouse = flickStickOutput == GyroOutput::MOUSE;
@@ -1979,7 +2416,7 @@ static float handleFlickStick(float calX, float calY, float lastCalX, float last
 					stickAngle = 0.0f;
 				}
 
-				jc->started_flick = chrono::steady_clock::now();
+				jc->started_flick = jc->time_now;
 				jc->delta_flick = stickAngle;
 				jc->flick_percent_done = 0.0f;
 				jc->ResetSmoothSample();
@@ -2000,9 +2437,9 @@ static float handleFlickStick(float calX, float calY, float lastCalX, float last
 					angleChange += 2.0f * PI;
 				angleChange -= PI;
 				jc->flick_rotation_counter += angleChange; // track all rotation for this flick
-				float flickSpeedConstant = isMouse ? jc->getSetting(SettingID::REAL_WORLD_CALIBRATION) * mouseCalibrationFactor / jc->getSetting(SettingID::IN_GAME_SENS) : 1.f;
+				float flickSpeedConstant = isMouse ? jc->getDerivedSettings().flickCalibration : 1.f;
 				float flickSpeed = -(angleChange * flickSpeedConstant);
-				int maxSmoothingSamples = min(jc->NumSamples, (int)ceil(64.0f / tick_time.get())); // target a max smoothing window size of 64ms
+				int maxSmoothingSamples = jc->getDerivedSettings().maxFlickSmoothingSamples; // target a max smoothing window size of 64ms
 				float stepSize = 0.01f;                                                            // and we only want full on smoothing when the stick change each time we poll it is approximately the minimum stick resolution
 				                                                                                   // the fact that we're using radians makes this really easy
 				auto rotate_smooth_override = jc->getSetting(SettingID::ROTATE_SMOOTH_OVERRIDE);
@@ -2018,7 +2455,7 @@ static float handleFlickStick(float calX, float calY, float lastCalX, float last
 				if (!isMouse)
 				{
 					// convert to a velocity
-					camSpeedX *= 180.0f / (PI * 0.001f * tick_time.get());
+					camSpeedX *= jc->getDerivedSettings().flickStickVelocityFactor;
 				}
 			}
 		}
@@ -2055,7 +2492,7 @@ static float handleFlickStick(float calX, float calY, float lastCalX, float last
 		newPercent = 1.0f - newPercent;
 		newPercent *= newPercent;
 		newPercent = 1.0f - newPercent;
-		float camSpeedChange = (newPercent - oldShapedPercent) * jc->delta_flick * jc->getSetting(SettingID::REAL_WORLD_CALIBRATION) * -mouseCalibrationFactor / jc->getSetting(SettingID::IN_GAME_SENS);
+		float camSpeedChange = (newPercent - oldShapedPercent) * jc->delta_flick * -jc->getDerivedSettings().flickCalibration;
 		camSpeedX += camSpeedChange;
 
 		return camSpeedX;
@@ -2096,7 +2533,7 @@ static float handleFlickStick(float calX, float calY, float lastCalX, float last
 
 void processStick(shared_ptr<JoyShock> jc, float stickX, float stickY, float lastX, float lastY, float innerDeadzone, float outerDeadzone,
   RingMode ringMode, StickMode stickMode, ButtonID ringId, ButtonID leftId, ButtonID rightId, ButtonID upId, ButtonID downId,
-  ControllerOrientation controllerOrientation, float mouseCalibrationFactor, float deltaTime, float &acceleration, FloatXY &lastAreaCal,
+  ControllerOrientation controllerOrientation, float deltaTime, float &acceleration, FloatXY &lastAreaCal,
   bool &isFlicking, bool &ignoreStickMode, bool &anyStickInput, bool &lockMouse, float &camSpeedX, float &camSpeedY, ScrollAxis *scroll, int touchpadIndex = -1)
 {
 	float temp;
@@ -2152,7 +2589,7 @@ void processStick(shared_ptr<JoyShock> jc, float stickX, float stickY, float las
 	}
 	else if (stickMode == StickMode::FLICK || flickOnly || rotateOnly)
 	{
-		camSpeedX += handleFlickStick(stickX, stickY, lastX, lastY, stickLength, isFlicking, jc, mouseCalibrationFactor, flickOnly, rotateOnly);
+		camSpeedX += handleFlickStick(stickX, stickY, lastX, lastY, stickLength, isFlicking, jc, flickOnly, rotateOnly);
 		anyStickInput = pegged;
 	}
 	else if (stickMode == StickMode::AIM)
@@ -2168,8 +2605,8 @@ void processStick(shared_ptr<JoyShock> jc, float stickX, float stickY, float las
 			anyStickInput = true;
 			float warpedStickLengthX = pow(stickLength, jc->getSetting(SettingID::STICK_POWER));
 			float warpedStickLengthY = warpedStickLengthX;
-			warpedStickLengthX *= jc->getSetting<FloatXY>(SettingID::STICK_SENS).first * jc->getSetting(SettingID::REAL_WORLD_CALIBRATION) / os_mouse_speed / jc->getSetting(SettingID::IN_GAME_SENS);
-			warpedStickLengthY *= jc->getSetting<FloatXY>(SettingID::STICK_SENS).second * jc->getSetting(SettingID::REAL_WORLD_CALIBRATION) / os_mouse_speed / jc->getSetting(SettingID::IN_GAME_SENS);
+			warpedStickLengthX *= jc->getDerivedSettings().stickSens.x();
+			warpedStickLengthY *= jc->getDerivedSettings().stickSens.y();
 			camSpeedX += stickX / stickLength * warpedStickLengthX * acceleration * deltaTime;
 			camSpeedY += stickY / stickLength * warpedStickLengthY * acceleration * deltaTime;
 			if (pegged)
@@ -2272,7 +2709,6 @@ void TouchStick::handleTouchStickChange(shared_ptr<JoyShock> js, bool down, shor
 	RingMode ringMode = js->getSetting<RingMode>(SettingID::TOUCH_RING_MODE);
 	StickMode stickMode = js->getSetting<StickMode>(SettingID::TOUCH_STICK_MODE);
 	ControllerOrientation controllerOrientation = js->getSetting<ControllerOrientation>(SettingID::CONTROLLER_ORIENTATION);
-	float mouseCalibrationFactor = 180.0f / PI / os_mouse_speed;
 
 	bool anyStickInput = false;
 	bool lockMouse = false;
@@ -2282,7 +2718,7 @@ void TouchStick::handleTouchStickChange(shared_ptr<JoyShock> js, bool down, shor
 
 	processStick(js, stickX * float(axisSign.first), stickY *float(axisSign.second), _currentLocation.x() * float(axisSign.first), _currentLocation.y() * float(axisSign.second), innerDeadzone, 0.f,
 	  ringMode, stickMode, ButtonID::TRING, ButtonID::TLEFT, ButtonID::TRIGHT, ButtonID::TUP, ButtonID::TDOWN,
-	  controllerOrientation, mouseCalibrationFactor, delta_time, touch_stick_acceleration, touch_last_cal,
+	  controllerOrientation, delta_time, touch_stick_acceleration, touch_last_cal,
 	  is_flicking_touch, ignore_motion_stick, anyStickInput, lockMouse, camSpeedX, camSpeedY, &js->touch_scroll_x, _index);
 
 	moveMouse(camSpeedX * float(js->getSetting<AxisSignPair>(SettingID::TOUCH_STICK_AXIS).first), -camSpeedY *float(js->getSetting<AxisSignPair>(SettingID::TOUCH_STICK_AXIS).second));
@@ -2340,12 +2776,13 @@ void TouchCallback(int jcHandle, TOUCH_STATE newState, TOUCH_STATE prevState, fl
 	//		previous.t1Down ? optional<FloatXY>({ previous.t1X, previous.t1Y }) : nullopt);
 	//}
 
-	shared_ptr<JoyShock> js = handle_to_joyshock[jcHandle];
+	shared_ptr<JoyShock> js = handle_to_joyshock.Get(jcHandle);
 	int tpSizeX, tpSizeY;
 	if (!js || jsl->GetTouchpadDimension(jcHandle, tpSizeX, tpSizeY) == false)
 		return;
 
 	lock_guard guard(js->_context->callback_lock);
+	js->RefreshMappings();
 
 	TOUCH_POINT point0, point1;
 
@@ -2367,39 +2804,34 @@ void TouchCallback(int jcHandle, TOUCH_STATE newState, TOUCH_STATE prevState, fl
 			return id >= ButtonID::T1;
 		};
 
-		for (auto currentlyActive = find_if(js->_context->chordStack.begin(), js->_context->chordStack.end(), IS_TOUCH_BUTTON);
-		     currentlyActive != js->_context->chordStack.end();
-		     currentlyActive = find_if(js->_context->chordStack.begin(), js->_context->chordStack.end(), IS_TOUCH_BUTTON))
-		{
-			js->_context->chordStack.erase(currentlyActive);
-		}
+		js->_context->chordStack.eraseIf(IS_TOUCH_BUTTON);
 	}
 	if (mode == TouchpadMode::GRID_AND_STICK)
 	{
 		// Handle grid
+		FloatXY gridSize = js->getGridSize();
 		int index0 = -1, index1 = -1;
 		if (point0.isDown())
 		{
-			float row = floorf(point0.posY * grid_size.get().y());
-			float col = floorf(point0.posX * grid_size.get().x());
+			float row = floorf(point0.posY * gridSize.y());
+			float col = floorf(point0.posX * gridSize.x());
 			//cout << "I should be in button " << row << " " << col << endl;
-			index0 = int(row * grid_size.get().x() + col);
+			index0 = int(row * gridSize.x() + col);
 		}
 
 		if (point1.isDown())
 		{
-			float row = floorf(point1.posY * grid_size.get().y());
-			float col = floorf(point1.posX * grid_size.get().x());
+			float row = floorf(point1.posY * gridSize.y());
+			float col = floorf(point1.posX * gridSize.x());
 			//cout << "I should be in button " << row << " " << col << endl;
-			index1 = int(row * grid_size.get().x() + col);
+			index1 = int(row * gridSize.x() + col);
 		}
 
-		for (size_t i = 0; i < grid_mappings.size(); ++i)
+		// JSM can get touch button callbacks before the grid buttons are setup at startup. There are none then.
+		for (size_t i = 0; i < js->gridButtons.size(); ++i)
 		{
 			auto optId = magic_enum::enum_cast<ButtonID>(FIRST_TOUCH_BUTTON + i);
-
-			// JSM can get touch button callbacks before the grid buttons are setup at startup. Just skip then.
-			if (optId && js->gridButtons.size() == grid_mappings.size())
+			if (optId)
 				js->handleButtonChange(*optId, i == index0 || i == index1);
 		}
 
@@ -2453,17 +2885,17 @@ void TouchCallback(int jcHandle, TOUCH_STATE newState, TOUCH_STATE prevState, fl
 	js->prevTouchState = newState;
 }
 
-void CalibrateTriggers(shared_ptr<JoyShock> jc)
+void CalibrateTriggers(shared_ptr<JoyShock> jc, const DeviceFrame &frame)
 {
-	if (jsl->GetButtons(jc->handle) & (1 << JSOFFSET_HOME))
+	if (frame.state.buttons & (1 << JSOFFSET_HOME))
 	{
 		COUT << "Abandonning calibration" << endl;
 		triggerCalibrationStep = 0;
 		return;
 	}
 
-	auto rpos = jsl->GetRightTrigger(jc->handle);
-	auto lpos = jsl->GetLeftTrigger(jc->handle);
+	auto rpos = frame.state.rTrigger;
+	auto lpos = frame.state.lTrigger;
 	switch (triggerCalibrationStep)
 	{
 	case 1:
@@ -2477,7 +2909,7 @@ void CalibrateTriggers(shared_ptr<JoyShock> jc)
 		triggerCalibrationStep++;
 		break;
 	case 2:
-		if (jsl->GetButtons(jc->handle) & (1 << JSOFFSET_DOWN))
+		if (frame.state.buttons & (1 << JSOFFSET_DOWN))
 		{
 			triggerCalibrationStep++;
 		}
@@ -2521,7 +2953,7 @@ void CalibrateTriggers(shared_ptr<JoyShock> jc)
 		triggerCalibrationStep++;
 		break;
 	case 7:
-		if (jsl->GetButtons(jc->handle) & (1 << JSOFFSET_S))
+		if (frame.state.buttons & (1 << JSOFFSET_S))
 		{
 			triggerCalibrationStep++;
 		}
@@ -2567,28 +2999,25 @@ void CalibrateTriggers(shared_ptr<JoyShock> jc)
 	jsl->SetTriggerEffect(jc->handle, jc->left_effect, jc->right_effect);
 }
 
-void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE lastState, IMU_STATE imuState, IMU_STATE lastImuState, float deltaTime)
+// What the IMU readings of a device come down to over a tick
+struct MotionReadings
 {
+	// Calibrated gyro, averaged over the tick
+	float gyroX = 0.f;
+	float gyroY = 0.f;
+	float gyroZ = 0.f;
+	float gravX = 0.f;
+	float gravY = 0.f;
+	float gravZ = 0.f;
+	// Time covered by the readings
+	float deltaTime = 0.f;
+};
 
-	shared_ptr<JoyShock> jc = handle_to_joyshock[jcHandle];
-	if (jc == nullptr)
-		return;
-	jc->_context->callback_lock.lock();
-
-	auto timeNow = chrono::steady_clock::now();
-	deltaTime = ((float)chrono::duration_cast<chrono::microseconds>(timeNow - jc->time_now).count()) / 1000000.0f;
-	jc->time_now = timeNow;
-
-	if (triggerCalibrationStep)
-	{
-		CalibrateTriggers(jc);
-		jc->_context->callback_lock.unlock();
-		return;
-	}
-
-	MotionIf &motion = *jc->motion;
-
-	IMU_STATE imu = jsl->GetIMUState(jc->handle);
+// Run the IMU readings a device sent since the last tick through its motion model. The input of the device is
+// recorded here too, as this is where its readings are fetched.
+static MotionReadings ReadMotion(JoyShock &jc, const DeviceFrame &frame, float deltaTime)
+{
+	MotionIf &motion = *jc.motion;
 
 	if (auto_calibrate_gyro.get() == Switch::ON)
 	{
@@ -2598,16 +3027,86 @@ void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE l
 	{
 		motion.SetAutoCalibration(false, 0.f, 0.f);
 	}
-	motion.ProcessMotion(imu.gyroX, imu.gyroY, imu.gyroZ, imu.accelX, imu.accelY, imu.accelZ, deltaTime);
 
-	float inGyroX, inGyroY, inGyroZ;
-	motion.GetCalibratedGyro(inGyroX, inGyroY, inGyroZ);
+	// Use the device's clock when it provides one, and the callback's clock otherwise.
+	MotionReadings readings;
+	readings.deltaTime = deltaTime;
+	array<ImuSample, 128> imuSamples;
+	int numImuSamples = jsl->GetIMUSamples(jc.handle, imuSamples.data(), int(imuSamples.size()));
+	input_recorder.Write(jc.handle, deltaTime, frame, imuSamples.data(), numImuSamples);
+	if (numImuSamples > 0)
+	{
+		// Run every sample received since the last tick through the motion model, and use the
+		// time-weighted average of the calibrated gyro over the tick.
+		float inGyroX, inGyroY, inGyroZ;
+		float sumGyroX = 0.f, sumGyroY = 0.f, sumGyroZ = 0.f, sumTime = 0.f;
+		bool knownIntervals = true;
+		for (int i = 0; i < numImuSamples; ++i)
+		{
+			const IMU_STATE &imu = imuSamples[i].imu;
+			float sampleTime = imuSamples[i].deltaTime;
+			if (sampleTime <= 0.f)
+			{
+				sampleTime = deltaTime / numImuSamples;
+				knownIntervals = false;
+			}
+			motion.ProcessMotion(imu.gyroX, imu.gyroY, imu.gyroZ, imu.accelX, imu.accelY, imu.accelZ, sampleTime);
+			motion.GetCalibratedGyro(inGyroX, inGyroY, inGyroZ);
+			sumGyroX += inGyroX * sampleTime;
+			sumGyroY += inGyroY * sampleTime;
+			sumGyroZ += inGyroZ * sampleTime;
+			sumTime += sampleTime;
+		}
+		if (sumTime > 0.f)
+		{
+			readings.gyroX = sumGyroX / sumTime;
+			readings.gyroY = sumGyroY / sumTime;
+			readings.gyroZ = sumGyroZ / sumTime;
+			if (knownIntervals)
+			{
+				readings.deltaTime = sumTime;
+			}
+		}
+		else
+		{
+			readings.gyroX = inGyroX;
+			readings.gyroY = inGyroY;
+			readings.gyroZ = inGyroZ;
+		}
+	}
+	else
+	{
+		const IMU_STATE &imu = frame.imu;
+		if (frame.timestamp != 0 && jc.last_imu_timestamp != 0 && frame.timestamp >= jc.last_imu_timestamp)
+		{
+			// No new reading means no time to integrate over
+			readings.deltaTime = (frame.timestamp - jc.last_imu_timestamp) / 1000000.f;
+		}
+		if (readings.deltaTime > 0.f)
+		{
+			motion.ProcessMotion(imu.gyroX, imu.gyroY, imu.gyroZ, imu.accelX, imu.accelY, imu.accelZ, readings.deltaTime);
+		}
+		motion.GetCalibratedGyro(readings.gyroX, readings.gyroY, readings.gyroZ);
+	}
+	if (frame.timestamp != 0)
+	{
+		jc.last_imu_timestamp = frame.timestamp;
+	}
 
-	float inGravX, inGravY, inGravZ;
-	motion.GetGravity(inGravX, inGravY, inGravZ);
+	motion.GetGravity(readings.gravX, readings.gravY, readings.gravZ);
+	return readings;
+}
 
-	float inQuatW, inQuatX, inQuatY, inQuatZ;
-	motion.GetOrientation(inQuatW, inQuatX, inQuatY, inQuatZ);
+// Turn the gyro readings into the velocity of the gyro output, in the gyro space, smoothed and cut off, with the
+// gyro buttons, the trackball and the sensitivity applied.
+static void processGyro(shared_ptr<JoyShock> jc, const MotionReadings &gyroReadings, const DeviceFrame &frame, const DeviceFrame &rightFrame, float deltaTime, float &gyroXVelocity, float &gyroYVelocity)
+{
+	float inGyroX = gyroReadings.gyroX;
+	float inGyroY = gyroReadings.gyroY;
+	float inGyroZ = gyroReadings.gyroZ;
+	float inGravX = gyroReadings.gravX;
+	float inGravY = gyroReadings.gravY;
+	float inGravZ = gyroReadings.gravZ;
 
 	//// These are for sanity checking sensor fusion against a simple complementary filter:
 	//float angle = sqrtf(inGyroX * inGyroX + inGyroY * inGyroY + inGyroZ * inGyroZ) * PI / 180.f * deltaTime;
@@ -2638,28 +3137,8 @@ void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE l
 	//	inGravvX, inGravY, inGravZ);
 
 	bool blockGyro = false;
-	bool lockMouse = false;
 	bool leftAny = false;
 	bool rightAny = false;
-	bool motionAny = false;
-
-	if (jc->set_neutral_quat)
-	{
-		// motion stick neutral should be calculated from the gravity vector
-		Vec gravDirection = Vec(inGravX, inGravY, inGravZ);
-		Vec normalizedGravDirection = gravDirection.Normalized();
-		float diffAngle = acosf(std::clamp(-gravDirection.y, -1.f, 1.f));
-		Vec neutralGravAxis = Vec(0.0f, -1.0f, 0.0f).Cross(normalizedGravDirection);
-		Quat neutralQuat = Quat(cosf(diffAngle * 0.5f), neutralGravAxis.x, neutralGravAxis.y, neutralGravAxis.z);
-		neutralQuat.Normalize();
-
-		jc->neutralQuatW = neutralQuat.w;
-		jc->neutralQuatX = neutralQuat.x;
-		jc->neutralQuatY = neutralQuat.y;
-		jc->neutralQuatZ = neutralQuat.z;
-		jc->set_neutral_quat = false;
-		COUT << "Neutral orientation for device " << jc->handle << " set..." << endl;
-	}
 
 	float gyroX = 0.0;
 	float gyroY = 0.0;
@@ -2821,12 +3300,8 @@ void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE l
 	}
 	float gyroLength = sqrt(gyroX * gyroX + gyroY * gyroY);
 	// do gyro smoothing
-	// convert gyro smooth time to number of samples
-	auto numGyroSamples = jc->getSetting(SettingID::GYRO_SMOOTH_TIME) * 1000.f / tick_time.get();
-	if (numGyroSamples < 1)
-		numGyroSamples = 1; // need at least 1 sample
 	auto threshold = jc->getSetting(SettingID::GYRO_SMOOTH_THRESHOLD);
-	jc->GetSmoothedGyro(gyroX, gyroY, gyroLength, threshold / 2.0f, threshold, int(numGyroSamples), gyroX, gyroY);
+	jc->GetSmoothedGyro(gyroX, gyroY, gyroLength, threshold / 2.0f, threshold, jc->getDerivedSettings().numGyroSmoothSamples, jc->getSetting<SmoothingMode>(SettingID::GYRO_SMOOTH_MODE), gyroX, gyroY);
 	//COUT << "%d Samples for threshold: %0.4f\n", numGyroSamples, gyro_smooth_threshold * maxSmoothingSamples);
 
 	// now, honour gyro_cutoff_speed
@@ -2866,8 +3341,8 @@ void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE l
 		break;
 	case GyroIgnoreMode::LEFT_STICK:
 		{
-			float leftX = jsl->GetLeftX(jc->handle);
-			float leftY = jsl->GetLeftY(jc->handle);
+			float leftX = frame.state.stickLX;
+			float leftY = frame.state.stickLY;
 			float leftLength = sqrtf(leftX * leftX + leftY * leftY);
 		    float deadzoneInner = jc->getSetting(SettingID::LEFT_STICK_DEADZONE_INNER);
 		    float deadzoneOuter = jc->getSetting(SettingID::LEFT_STICK_DEADZONE_OUTER);
@@ -2906,8 +3381,8 @@ void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE l
 		break;
 	case GyroIgnoreMode::RIGHT_STICK:
 	    {
-		    float rightX = jsl->GetRightX(jc->handle);
-		    float rightY = jsl->GetRightY(jc->handle);
+		    float rightX = rightFrame.state.stickRX;
+		    float rightY = rightFrame.state.stickRY;
 		    float rightLength = sqrtf(rightX * rightX + rightY * rightY);
 		    float deadzoneInner = jc->getSetting(SettingID::RIGHT_STICK_DEADZONE_INNER);
 		    float deadzoneOuter = jc->getSetting(SettingID::RIGHT_STICK_DEADZONE_OUTER);
@@ -3037,11 +3512,8 @@ void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE l
 		gyroY = 0;
 	}
 
-	float camSpeedX = 0.0f;
-	float camSpeedY = 0.0f;
-
-	float gyroXVelocity = gyroX * gyro_x_sign_to_use;
-	float gyroYVelocity = gyroY * gyro_y_sign_to_use;
+	gyroXVelocity = gyroX * gyro_x_sign_to_use;
+	gyroYVelocity = gyroY * gyro_y_sign_to_use;
 
 	std::pair<float, float> lowSensXY = jc->getSetting<FloatXY>(SettingID::MIN_GYRO_SENS);
 	std::pair<float, float> hiSensXY = jc->getSetting<FloatXY>(SettingID::MAX_GYRO_SENS);
@@ -3077,75 +3549,235 @@ void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE l
 
 	jc->gyroXVelocity = gyroXVelocity;
 	jc->gyroYVelocity = gyroYVelocity;
+}
 
-	jc->time_now = std::chrono::steady_clock::now();
+void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE lastState, IMU_STATE imuState, IMU_STATE lastImuState, float deltaTime)
+{
+
+	shared_ptr<JoyShock> jc = handle_to_joyshock.Get(jcHandle);
+	if (jc == nullptr)
+		return;
+	jc->_context->callback_lock.lock();
+
+	// Merged Joy-Cons are processed as a single controller, once per tick, with the state of the left one.
+	// Whichever half calls back first in a tick runs it, and the other one skips its next callback.
+	shared_ptr<JoyShock> rightJc = jc->partner.lock();
+	if (rightJc)
+	{
+		if (jc->fused_tick_done)
+		{
+			jc->fused_tick_done = false;
+			jc->_context->callback_lock.unlock();
+			return;
+		}
+		rightJc->fused_tick_done = true;
+		if (jc->controller_split_type == JS_SPLIT_TYPE_RIGHT)
+		{
+			swap(jc, rightJc);
+		}
+	}
+	int splitType = rightJc ? JS_SPLIT_TYPE_FULL : jc->controller_split_type;
+
+	if (jsl->HasSimulatedTime())
+	{
+		jc->time_now += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<float>(deltaTime));
+	}
+	else
+	{
+		auto timeNow = chrono::steady_clock::now();
+		deltaTime = ((float)chrono::duration_cast<chrono::microseconds>(timeNow - jc->time_now).count()) / 1000000.0f;
+		jc->time_now = timeNow;
+	}
+	jc->MeasurePollPeriod(deltaTime);
+
+	DeviceFrame frame;
+	jsl->GetFrame(jc->handle, frame);
+	DeviceFrame partnerFrame;
+	if (rightJc)
+	{
+		jsl->GetFrame(rightJc->handle, partnerFrame);
+	}
+	// Right stick, right trigger and face buttons
+	const DeviceFrame &rightFrame = rightJc ? partnerFrame : frame;
+
+	if (triggerCalibrationStep)
+	{
+		CalibrateTriggers(jc, frame);
+		jc->_context->callback_lock.unlock();
+		return;
+	}
+
+	// Only the stages that feed an output with the current configuration are run
+	PollStages stages = jc->getDerivedSettings().stages;
+	jc->RefreshMappings();
+
+	// Choose up front which device the gyro and the motion stick come from. A Joy-Con is ignored when its
+	// side is in the JOYCON_GYRO_MASK or JOYCON_MOTION_MASK.
+	int gyroMask = (int)jc->getSetting<JoyconMask>(SettingID::JOYCON_GYRO_MASK);
+	int motionMask = (int)jc->getSetting<JoyconMask>(SettingID::JOYCON_MOTION_MASK);
+	MotionReadings readings = ReadMotion(*jc, frame, deltaTime);
+	bool useGyro, useMotion;
+	MotionReadings gyroReadings = readings;
+	MotionReadings motionReadings = readings;
+	if (rightJc)
+	{
+		MotionReadings rightReadings = ReadMotion(*rightJc, partnerFrame, deltaTime);
+		bool leftGyro = (JS_SPLIT_TYPE_LEFT & gyroMask) == 0;
+		bool rightGyro = (JS_SPLIT_TYPE_RIGHT & gyroMask) == 0;
+		useGyro = leftGyro || rightGyro;
+		if (rightGyro)
+		{
+			gyroReadings = rightReadings;
+			if (leftGyro)
+			{
+				// Both gyros add up, as when each Joy-Con moved the mouse on its own
+				gyroReadings.gyroX += readings.gyroX;
+				gyroReadings.gyroY += readings.gyroY;
+				gyroReadings.gyroZ += readings.gyroZ;
+			}
+		}
+		bool leftMotion = (JS_SPLIT_TYPE_LEFT & motionMask) == 0;
+		bool rightMotion = (JS_SPLIT_TYPE_RIGHT & motionMask) == 0;
+		useMotion = leftMotion || rightMotion;
+		if (rightMotion)
+		{
+			motionReadings = rightReadings;
+			if (leftMotion)
+			{
+				motionReadings.gravX = (readings.gravX + rightReadings.gravX) * 0.5f;
+				motionReadings.gravY = (readings.gravY + rightReadings.gravY) * 0.5f;
+				motionReadings.gravZ = (readings.gravZ + rightReadings.gravZ) * 0.5f;
+			}
+		}
+	}
+	else
+	{
+		useGyro = splitType == JS_SPLIT_TYPE_FULL || (splitType & gyroMask) == 0;
+		useMotion = splitType == JS_SPLIT_TYPE_FULL || (splitType & motionMask) == 0;
+	}
+	float imuDeltaTime = gyroReadings.deltaTime;
+
+	bool lockMouse = false;
+	bool leftAny = false;
+	bool rightAny = false;
+	bool motionAny = false;
+
+	if (jc->set_neutral_quat)
+	{
+		// motion stick neutral should be calculated from the gravity vector
+		Vec gravDirection = Vec(motionReadings.gravX, motionReadings.gravY, motionReadings.gravZ);
+		Vec normalizedGravDirection = gravDirection.Normalized();
+		float diffAngle = acosf(std::clamp(-gravDirection.y, -1.f, 1.f));
+		Vec neutralGravAxis = Vec(0.0f, -1.0f, 0.0f).Cross(normalizedGravDirection);
+		Quat neutralQuat = Quat(cosf(diffAngle * 0.5f), neutralGravAxis.x, neutralGravAxis.y, neutralGravAxis.z);
+		neutralQuat.Normalize();
+
+		jc->neutralQuatInverse = neutralQuat.Inverse();
+		jc->set_neutral_quat = false;
+		COUT << "Neutral orientation for device " << jc->handle << " set..." << endl;
+	}
+
+	float gyroXVelocity = 0.f;
+	float gyroYVelocity = 0.f;
+	if (stages.gyro)
+	{
+		processGyro(jc, gyroReadings, frame, rightFrame, deltaTime, gyroXVelocity, gyroYVelocity);
+	}
+	else
+	{
+		jc->gyroXVelocity = 0.f;
+		jc->gyroYVelocity = 0.f;
+	}
+
+	float camSpeedX = 0.0f;
+	float camSpeedY = 0.0f;
+
+	if (!jsl->HasSimulatedTime())
+	{
+		jc->time_now = std::chrono::steady_clock::now();
+	}
 
 	// sticks!
 	jc->processed_gyro_stick = false;
+	jc->stick_deflected = false;
+	// Only the stick modes with a continuous output need polling while the stick is held still
+	auto isDeflected = [](float x, float y, float innerDeadzone, StickMode mode) {
+		return mode != StickMode::NO_MOUSE && mode != StickMode::INVALID && x * x + y * y > innerDeadzone * innerDeadzone;
+	};
 	ControllerOrientation controllerOrientation = jc->getSetting<ControllerOrientation>(SettingID::CONTROLLER_ORIENTATION);
-	// account for os mouse speed and convert from radians to degrees because gyro reports in degrees per second
-	float mouseCalibrationFactor = 180.0f / PI / os_mouse_speed;
-	if (jc->controller_split_type != JS_SPLIT_TYPE_RIGHT)
+	if (splitType != JS_SPLIT_TYPE_RIGHT)
 	{
 		// let's do these sticks... don't want to constantly send input, so we need to compare them to last time
 		auto axisSign = jc->getSetting<AxisSignPair>(SettingID::LEFT_STICK_AXIS);
-		float calX = jsl->GetLeftX(jc->handle) * float(axisSign.first);
-		float calY = jsl->GetLeftY(jc->handle) * float(axisSign.second);
+		float calX = frame.state.stickLX * float(axisSign.first);
+		float calY = frame.state.stickLY * float(axisSign.second);
 
-		processStick(jc, calX, calY, jc->lastLX, jc->lastLY, jc->getSetting(SettingID::LEFT_STICK_DEADZONE_INNER), jc->getSetting(SettingID::LEFT_STICK_DEADZONE_OUTER),
-		  jc->getSetting<RingMode>(SettingID::LEFT_RING_MODE), jc->getSetting<StickMode>(SettingID::LEFT_STICK_MODE),
-		  ButtonID::LRING, ButtonID::LLEFT, ButtonID::LRIGHT, ButtonID::LUP, ButtonID::LDOWN, controllerOrientation,
-		  mouseCalibrationFactor, deltaTime, jc->left_acceleration, jc->left_last_cal, jc->is_flicking_left, jc->ignore_left_stick_mode, leftAny, lockMouse, camSpeedX, camSpeedY, &jc->left_scroll);
+		if (stages.leftStick)
+		{
+			float innerDeadzone = jc->getSetting(SettingID::LEFT_STICK_DEADZONE_INNER);
+			StickMode stickMode = jc->getSetting<StickMode>(SettingID::LEFT_STICK_MODE);
+			processStick(jc, calX, calY, jc->lastLX, jc->lastLY, innerDeadzone, jc->getSetting(SettingID::LEFT_STICK_DEADZONE_OUTER),
+			  jc->getSetting<RingMode>(SettingID::LEFT_RING_MODE), stickMode,
+			  ButtonID::LRING, ButtonID::LLEFT, ButtonID::LRIGHT, ButtonID::LUP, ButtonID::LDOWN, controllerOrientation,
+			  deltaTime, jc->left_acceleration, jc->left_last_cal, jc->is_flicking_left, jc->ignore_left_stick_mode, leftAny, lockMouse, camSpeedX, camSpeedY, &jc->left_scroll);
+			jc->stick_deflected |= isDeflected(calX, calY, innerDeadzone, stickMode);
+		}
 
+		// Kept up to date even when the stick is unused, for it to resume cleanly once the configuration uses it
 		jc->lastLX = calX;
 		jc->lastLY = calY;
 	}
 
-	if (jc->controller_split_type != JS_SPLIT_TYPE_LEFT)
+	if (splitType != JS_SPLIT_TYPE_LEFT)
 	{
 		auto axisSign = jc->getSetting<AxisSignPair>(SettingID::RIGHT_STICK_AXIS);
-		float calX = jsl->GetRightX(jc->handle) * float(axisSign.first);
-		float calY = jsl->GetRightY(jc->handle) * float(axisSign.second);
+		float calX = rightFrame.state.stickRX * float(axisSign.first);
+		float calY = rightFrame.state.stickRY * float(axisSign.second);
 
-		processStick(jc, calX, calY, jc->lastRX, jc->lastRY, jc->getSetting(SettingID::RIGHT_STICK_DEADZONE_INNER), jc->getSetting(SettingID::RIGHT_STICK_DEADZONE_OUTER),
-		  jc->getSetting<RingMode>(SettingID::RIGHT_RING_MODE), jc->getSetting<StickMode>(SettingID::RIGHT_STICK_MODE),
-		  ButtonID::RRING, ButtonID::RLEFT, ButtonID::RRIGHT, ButtonID::RUP, ButtonID::RDOWN, controllerOrientation,
-		  mouseCalibrationFactor, deltaTime, jc->right_acceleration, jc->right_last_cal, jc->is_flicking_right, jc->ignore_right_stick_mode, rightAny, lockMouse, camSpeedX, camSpeedY, &jc->right_scroll);
+		if (stages.rightStick)
+		{
+			float innerDeadzone = jc->getSetting(SettingID::RIGHT_STICK_DEADZONE_INNER);
+			StickMode stickMode = jc->getSetting<StickMode>(SettingID::RIGHT_STICK_MODE);
+			processStick(jc, calX, calY, jc->lastRX, jc->lastRY, innerDeadzone, jc->getSetting(SettingID::RIGHT_STICK_DEADZONE_OUTER),
+			  jc->getSetting<RingMode>(SettingID::RIGHT_RING_MODE), stickMode,
+			  ButtonID::RRING, ButtonID::RLEFT, ButtonID::RRIGHT, ButtonID::RUP, ButtonID::RDOWN, controllerOrientation,
+			  deltaTime, jc->right_acceleration, jc->right_last_cal, jc->is_flicking_right, jc->ignore_right_stick_mode, rightAny, lockMouse, camSpeedX, camSpeedY, &jc->right_scroll);
+			jc->stick_deflected |= isDeflected(calX, calY, innerDeadzone, stickMode);
+		}
 
 		jc->lastRX = calX;
 		jc->lastRY = calY;
 	}
 
-	if (jc->controller_split_type == JS_SPLIT_TYPE_FULL ||
-	  (jc->controller_split_type & (int)jc->getSetting<JoyconMask>(SettingID::JOYCON_MOTION_MASK)) == 0)
+	if (useMotion && stages.motionGravity())
 	{
-		Quat neutralQuat = Quat(jc->neutralQuatW, jc->neutralQuatX, jc->neutralQuatY, jc->neutralQuatZ);
-		Vec grav = Vec(inGravX, inGravY, inGravZ) * neutralQuat.Inverse();
+		Vec grav = Vec(motionReadings.gravX, motionReadings.gravY, motionReadings.gravZ) * jc->neutralQuatInverse;
 
-		float lastCalX = jc->lastMotionStickX;
-		float lastCalY = jc->lastMotionStickY;
-		// use gravity vector deflection
-		auto axisSign = jc->getSetting<AxisSignPair>(SettingID::MOTION_STICK_AXIS);
-		float calX = grav.x * float(axisSign.first);
-		float calY = -grav.z * float(axisSign.second);
-		float gravLength2D = sqrtf(grav.x * grav.x + grav.z * grav.z);
-		float gravStickDeflection = atan2f(gravLength2D, -grav.y) / PI;
-		if (gravLength2D > 0)
+		if (stages.motionStick)
 		{
-			calX *= gravStickDeflection / gravLength2D;
-			calY *= gravStickDeflection / gravLength2D;
-		}
+			// use gravity vector deflection
+			auto axisSign = jc->getSetting<AxisSignPair>(SettingID::MOTION_STICK_AXIS);
+			float calX = grav.x * float(axisSign.first);
+			float calY = -grav.z * float(axisSign.second);
+			float gravLength2D = sqrtf(grav.x * grav.x + grav.z * grav.z);
+			float gravStickDeflection = atan2f(gravLength2D, -grav.y) / PI;
+			if (gravLength2D > 0)
+			{
+				calX *= gravStickDeflection / gravLength2D;
+				calY *= gravStickDeflection / gravLength2D;
+			}
 
-		processStick(jc, calX, calY, jc->lastMotionStickX, jc->lastMotionStickY, jc->getSetting(SettingID::MOTION_DEADZONE_INNER) / 180.f, jc->getSetting(SettingID::MOTION_DEADZONE_OUTER) / 180.f,
-		  jc->getSetting<RingMode>(SettingID::MOTION_RING_MODE), jc->getSetting<StickMode>(SettingID::MOTION_STICK_MODE),
-		  ButtonID::MRING, ButtonID::MLEFT, ButtonID::MRIGHT, ButtonID::MUP, ButtonID::MDOWN, controllerOrientation,
-		  mouseCalibrationFactor, deltaTime, jc->motion_stick_acceleration, jc->motion_last_cal, jc->is_flicking_motion, jc->ignore_motion_stick_mode, motionAny, lockMouse, camSpeedX, camSpeedY, nullptr);
+			processStick(jc, calX, calY, jc->lastMotionStickX, jc->lastMotionStickY, jc->getSetting(SettingID::MOTION_DEADZONE_INNER) / 180.f, jc->getSetting(SettingID::MOTION_DEADZONE_OUTER) / 180.f,
+			  jc->getSetting<RingMode>(SettingID::MOTION_RING_MODE), jc->getSetting<StickMode>(SettingID::MOTION_STICK_MODE),
+			  ButtonID::MRING, ButtonID::MLEFT, ButtonID::MRIGHT, ButtonID::MUP, ButtonID::MDOWN, controllerOrientation,
+			  deltaTime, jc->motion_stick_acceleration, jc->motion_last_cal, jc->is_flicking_motion, jc->ignore_motion_stick_mode, motionAny, lockMouse, camSpeedX, camSpeedY, nullptr);
 
-		jc->lastMotionStickX = calX;
-		jc->lastMotionStickY = calY;
+			jc->lastMotionStickX = calX;
+			jc->lastMotionStickY = calY;
+		}
 
 		float gravLength3D = grav.Length();
-		if (gravLength3D > 0)
+		if (stages.lean && gravLength3D > 0)
 		{
 			float gravSideDir;
 			switch (controllerOrientation)
@@ -3164,15 +3796,16 @@ void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE l
 				break;
 			}
 			float gravDirX = gravSideDir / gravLength3D;
-			float sinLeanThreshold = sin(jc->getSetting(SettingID::LEAN_THRESHOLD) * PI / 180.f);
+			float sinLeanThreshold = jc->getDerivedSettings().sinLeanThreshold;
 			jc->handleButtonChange(ButtonID::LEAN_LEFT, gravDirX < -sinLeanThreshold);
 			jc->handleButtonChange(ButtonID::LEAN_RIGHT, gravDirX > sinLeanThreshold);
 		}
 	}
 
-	int buttons = jsl->GetButtons(jc->handle);
+	int buttons = frame.state.buttons;
+	int rightButtons = rightFrame.state.buttons;
 	// button mappings
-	if (jc->controller_split_type != JS_SPLIT_TYPE_RIGHT)
+	if (splitType != JS_SPLIT_TYPE_RIGHT)
 	{
 		jc->handleButtonChange(ButtonID::UP, buttons & (1 << JSOFFSET_UP));
 		jc->handleButtonChange(ButtonID::DOWN, buttons & (1 << JSOFFSET_DOWN));
@@ -3183,10 +3816,10 @@ void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE l
 		// for backwards compatibility, we need need to account for the fact that SDL2 maps the touchpad button differently to SDL
 		jc->handleButtonChange(ButtonID::L3, buttons & (1 << JSOFFSET_LCLICK));
 
-		float lTrigger = jsl->GetLeftTrigger(jc->handle);
+		float lTrigger = frame.state.lTrigger;
 		jc->handleTriggerChange(ButtonID::ZL, ButtonID::ZLF, jc->getSetting<TriggerMode>(SettingID::ZL_MODE), lTrigger, jc->left_effect);
 
-		bool touch = jsl->GetTouchDown(jc->handle, false) || jsl->GetTouchDown(jc->handle, true);
+		bool touch = frame.touch.t0Down || frame.touch.t1Down;
 		switch (jc->platform_controller_type)
 		{
 		case JS_TYPE_DS:
@@ -3219,25 +3852,25 @@ void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE l
 		break;
 		}
 	}
-	else // split type IS right
+	if (splitType == JS_SPLIT_TYPE_RIGHT || rightJc)
 	{
 		// Right joycon bumpers
-		jc->handleButtonChange(ButtonID::RSL, buttons & (1 << JSOFFSET_SL));
-		jc->handleButtonChange(ButtonID::RSR, buttons & (1 << JSOFFSET_SR));
+		jc->handleButtonChange(ButtonID::RSL, rightButtons & (1 << JSOFFSET_SL));
+		jc->handleButtonChange(ButtonID::RSR, rightButtons & (1 << JSOFFSET_SR));
 	}
 
-	if (jc->controller_split_type != JS_SPLIT_TYPE_LEFT)
+	if (splitType != JS_SPLIT_TYPE_LEFT)
 	{
-		jc->handleButtonChange(ButtonID::E, buttons & (1 << JSOFFSET_E));
-		jc->handleButtonChange(ButtonID::S, buttons & (1 << JSOFFSET_S));
-		jc->handleButtonChange(ButtonID::N, buttons & (1 << JSOFFSET_N));
-		jc->handleButtonChange(ButtonID::W, buttons & (1 << JSOFFSET_W));
-		jc->handleButtonChange(ButtonID::R, buttons & (1 << JSOFFSET_R));
-		jc->handleButtonChange(ButtonID::PLUS, buttons & (1 << JSOFFSET_PLUS));
-		jc->handleButtonChange(ButtonID::HOME, buttons & (1 << JSOFFSET_HOME));
-		jc->handleButtonChange(ButtonID::R3, buttons & (1 << JSOFFSET_RCLICK));
+		jc->handleButtonChange(ButtonID::E, rightButtons & (1 << JSOFFSET_E));
+		jc->handleButtonChange(ButtonID::S, rightButtons & (1 << JSOFFSET_S));
+		jc->handleButtonChange(ButtonID::N, rightButtons & (1 << JSOFFSET_N));
+		jc->handleButtonChange(ButtonID::W, rightButtons & (1 << JSOFFSET_W));
+		jc->handleButtonChange(ButtonID::R, rightButtons & (1 << JSOFFSET_R));
+		jc->handleButtonChange(ButtonID::PLUS, rightButtons & (1 << JSOFFSET_PLUS));
+		jc->handleButtonChange(ButtonID::HOME, rightButtons & (1 << JSOFFSET_HOME));
+		jc->handleButtonChange(ButtonID::R3, rightButtons & (1 << JSOFFSET_RCLICK));
 
-		float rTrigger = jsl->GetRightTrigger(jc->handle);
+		float rTrigger = rightFrame.state.rTrigger;
 		jc->handleTriggerChange(ButtonID::ZR, ButtonID::ZRF, jc->getSetting<TriggerMode>(SettingID::ZR_MODE), rTrigger, jc->right_effect);
 	}
 
@@ -3259,9 +3892,14 @@ void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE l
 	                               [](const auto &pair) {
 		                               return pair.first == ButtonID::MIC;
 	                               }) != jc->_context->activeTogglesQueue.cend();
+	// The mic light reflects the toggle on all controllers
+	int micLight = currentMicToggleState ? 1 : 0;
 	for (auto controller : handle_to_joyshock)
 	{
-		jsl->SetMicLight(controller.first, currentMicToggleState ? 1 : 0);
+		if (controller.second->mic_light_sent.exchange(micLight) != micLight)
+		{
+			jsl->SetMicLight(controller.first, micLight);
+		}
 	}
 
 	GyroOutput gyroOutput = jc->getSetting<GyroOutput>(SettingID::GYRO_OUTPUT);
@@ -3278,13 +3916,11 @@ void joyShockPollCallback(int jcHandle, JOY_SHOCK_STATE state, JOY_SHOCK_STATE l
 	}
 
 	// optionally ignore the gyro of one of the joycons
-	if (!lockMouse && gyroOutput == GyroOutput::MOUSE &&
-	  (jc->controller_split_type == JS_SPLIT_TYPE_FULL ||
-	    (jc->controller_split_type & (int)jc->getSetting<JoyconMask>(SettingID::JOYCON_GYRO_MASK)) == 0))
+	if (!lockMouse && gyroOutput == GyroOutput::MOUSE && useGyro)
 	{
 		//COUT << "GX: %0.4f GY: %0.4f GZ: %0.4f\n", imuState.gyroX, imuState.gyroY, imuState.gyroZ);
-		float mouseCalibration = jc->getSetting(SettingID::REAL_WORLD_CALIBRATION) / os_mouse_speed / jc->getSetting(SettingID::IN_GAME_SENS);
-		shapedSensitivityMoveMouse(gyroXVelocity * mouseCalibration, gyroYVelocity * mouseCalibration, deltaTime, camSpeedX, -camSpeedY);
+		float mouseCalibration = jc->getDerivedSettings().mouseCalibration;
+		shapedSensitivityMoveMouse(gyroXVelocity * mouseCalibration, gyroYVelocity * mouseCalibration, imuDeltaTime, camSpeedX, -camSpeedY);
 	}
 
 	if (jc->_context->_vigemController)
@@ -3346,6 +3982,7 @@ bool AutoLoadPoll(void *param)
 				COUT_INFO << "loading \"AutoLoad\\" << noextconfig << ".txt\"." << endl;
 				loading_lock.lock();
 				registry->processLine(path + file);
+				PublishSettings();
 				loading_lock.unlock();
 				COUT_INFO << "[AUTOLOAD] Loading completed" << endl;
 				success = true;
@@ -3448,8 +4085,13 @@ void CleanUp()
 		tray->Hide();
 	}
 	HideConsole();
+	input_recorder.Close();
 	jsl->DisconnectAndDisposeAll();
-	handle_to_joyshock.clear(); // Destroy Vigem Gamepads
+	if (hardware_jsl)
+	{
+		hardware_jsl->DisconnectAndDisposeAll();
+	}
+	handle_to_joyshock.Clear(); // Destroy Vigem Gamepads
 	ReleaseConsole();
 }
 
@@ -3522,6 +4164,11 @@ float filterTickTime(float c, float next)
 	return max(1.f, min(100.f, round(next)));
 }
 
+int filterPollThreads(int c, int next)
+{
+	return clamp(next, 0, 8);
+}
+
 Mapping filterMapping(Mapping current, Mapping next)
 {
 	if (next.hasViGEmBtn())
@@ -3715,6 +4362,41 @@ void OnNewGridDimensions(CmdRegistry *registry, const FloatXY &newGridDims)
 	// Else numbers are the same, possibly just reconfigured
 }
 
+FloatXY filterGridSize(FloatXY current, FloatXY next)
+{
+	float floorX = floorf(next.x());
+	float floorY = floorf(next.y());
+	return floorX * floorY >= 1 && floorX * floorY <= 25 ? FloatXY{ floorX, floorY } : current;
+}
+
+// Tells which touch button commands a GRID_SIZE line leaves in the registry, for the lines after it in a file
+void StageGridDimensions(in_string arguments, const any &value, map<string, bool> &commands)
+{
+	FloatXY newGridDims;
+	if (value.has_value())
+	{
+		// An invalid size leaves the grid as it is
+		newGridDims = filterGridSize(FloatXY{ 0.f, 0.f }, any_cast<FloatXY>(value));
+	}
+	else if (arguments.find("DEFAULT") != string::npos)
+	{
+		newGridDims = grid_size._defVal;
+	}
+	else
+	{
+		return;
+	}
+	int numberOfButtons = int(newGridDims.first * newGridDims.second);
+	if (numberOfButtons == 0)
+	{
+		return;
+	}
+	for (int id = FIRST_TOUCH_BUTTON; id <= int(ButtonID::T25); ++id)
+	{
+		commands[string(magic_enum::enum_name(ButtonID(id)))] = id < FIRST_TOUCH_BUTTON + numberOfButtons;
+	}
+}
+
 void OnNewStickAxis(AxisMode newAxisMode, bool isVertical)
 {
 	if (isVertical)
@@ -3803,7 +4485,7 @@ public:
 
 	GyroButtonAssignment *SetListener()
 	{
-		_listenerId = _var.AddOnChangeListener(bind(&GyroButtonAssignment::DisplayNewValue, this, placeholders::_1));
+		_listenerId = _var.AddDisplayListener(bind(&GyroButtonAssignment::DisplayNewValue, this, placeholders::_1));
 		NONAME.push_back(NONAME[0] ^ 0x05);
 		NONAME.push_back(NONAME[1] ^ 14);
 		return this;
@@ -3929,7 +4611,48 @@ int main(int argc, char *argv[])
 	void *trayIconData = nullptr;
 	string module(argv[0]);
 #endif // _WIN32
-	jsl.reset(JslWrapper::getNew());
+	bool synthetic = false;
+	for (int i = 0; i < argc; ++i)
+	{
+#if _WIN32
+		string arg(&argv[i][0], &argv[i][wcslen(argv[i])]);
+#else
+		string arg(argv[i]);
+#endif
+		// Virtual controllers instead of hardware, see SyntheticWrapper.h
+		static const string SYNTHETIC = "--synthetic=";
+		if (arg.rfind(SYNTHETIC, 0) == 0)
+		{
+			string error;
+			jsl.reset(NewSyntheticWrapper(arg.substr(SYNTHETIC.size()), error));
+			if (!jsl)
+			{
+				CERR << error << endl;
+				return 1;
+			}
+			synthetic = true;
+		}
+#if defined(__linux__)
+		// DualShock 4 and DualSense read straight from hidraw, see HidrawWrapper.h
+		else if (arg == "--hidraw")
+		{
+			jsl.reset(NewHidrawWrapper());
+		}
+#endif
+	}
+	if (!jsl)
+	{
+		jsl.reset(JslWrapper::getNew());
+	}
+	try
+	{
+		// Synthetic controllers can run without output, e.g. for load tests on a machine without uinput
+		initVirtualOutput(synthetic);
+	}
+	catch (const runtime_error &)
+	{
+		return 1;
+	}
 	whitelister.reset(Whitelister::getNew(false));
 	currentWorkingDir = GetCWD();
 
@@ -3965,6 +4688,7 @@ int main(int argc, char *argv[])
 	joycon_motion_mask.SetFilter(&filterInvalidValue<JoyconMask, JoyconMask::INVALID>);
 	controller_orientation.SetFilter(&filterInvalidValue<ControllerOrientation, ControllerOrientation::INVALID>);
 	gyro_space.SetFilter(&filterInvalidValue<GyroSpace, GyroSpace::INVALID>);
+	gyro_smooth_mode.SetFilter(&filterInvalidValue<SmoothingMode, SmoothingMode::INVALID>);
 	zlMode.SetFilter(&filterTriggerMode);
 	zrMode.SetFilter(&filterTriggerMode);
 	flick_snap_mode.SetFilter(&filterInvalidValue<FlickSnapMode, FlickSnapMode::INVALID>);
@@ -4013,16 +4737,14 @@ int main(int argc, char *argv[])
 	dbl_press_window.SetFilter(&filterPositive);
 	hold_press_time.SetFilter(&filterHoldPressDelay);
 	tick_time.SetFilter(&filterTickTime);
+	poll_threads.SetFilter(&filterPollThreads);
+	output_report_interval.SetFilter(&filterPositive);
 	currentWorkingDir.SetFilter([](PathString current, PathString next) {
 		return SetCWD(string(next)) ? next : current;
 	});
 	autoloadSwitch.SetFilter(&filterInvalidValue<Switch, Switch::INVALID>)->AddOnChangeListener(bind(&UpdateThread, autoLoadThread.get(), placeholders::_1));
 	hide_minimized.SetFilter(&filterInvalidValue<Switch, Switch::INVALID>)->AddOnChangeListener(bind(&UpdateThread, minimizeThread.get(), placeholders::_1));
-	grid_size.SetFilter([](auto current, auto next) {
-		float floorX = floorf(next.x());
-		float floorY = floorf(next.y());
-		return floorX * floorY >= 1 && floorX * floorY <= 25 ? FloatXY{ floorX, floorY } : current;
-	});
+	grid_size.SetFilter(&filterGridSize);
 	grid_size.AddOnChangeListener(bind(&OnNewGridDimensions, &commandRegistry, placeholders::_1), true); // Call the listener now
 	touchpad_mode.SetFilter(&filterInvalidValue<TouchpadMode, TouchpadMode::INVALID>);
 	touch_stick_mode.SetFilter(&filterInvalidValue<StickMode, StickMode::INVALID>)->AddOnChangeListener(bind(&UpdateRingModeFromStickMode, &touch_ring_mode, ::placeholders::_1));
@@ -4146,6 +4868,8 @@ int main(int argc, char *argv[])
 	                      ->SetHelp("When the controller's angular velocity is below this threshold (in degrees per second), smoothing will be applied."));
 	commandRegistry.Add((new JSMAssignment<float>(gyro_smooth_time))
 	                      ->SetHelp("This length of the smoothing window in seconds. Smoothing is only applied below the GYRO_SMOOTH_THRESHOLD, with a smooth transition to full smoothing."));
+	commandRegistry.Add((new JSMAssignment<SmoothingMode>(gyro_smooth_mode))
+	                      ->SetHelp("How the gyro is smoothed over GYRO_SMOOTH_TIME. WINDOW averages it evenly over that time. EXPONENTIAL lets older movement fade out gradually instead."));
 	commandRegistry.Add((new JSMAssignment<float>(gyro_cutoff_speed))
 	                      ->SetHelp("Gyro deadzone. Gyro input will be ignored when below this angular velocity (in degrees per second). This should be a last-resort stability option."));
 	commandRegistry.Add((new JSMAssignment<float>(gyro_cutoff_recovery))
@@ -4177,6 +4901,9 @@ int main(int argc, char *argv[])
 	commandRegistry.Add((new JSMAssignment<float>(lean_threshold))
 	                      ->SetHelp("How far the controller must be leaned left or right to trigger a LEAN_LEFT or LEAN_RIGHT binding."));
 	commandRegistry.Add((new JSMMacro("CALCULATE_REAL_WORLD_CALIBRATION"))->SetMacro(bind(&do_CALCULATE_REAL_WORLD_CALIBRATION, placeholders::_2))->SetHelp("Get JoyShockMapper to recommend you a REAL_WORLD_CALIBRATION value after performing the calibration sequence. Visit GyroWiki for details:\nhttp://gyrowiki.jibbsmart.com/blog:joyshockmapper-guide#calibrating"));
+	commandRegistry.Add((new JSMMacro("TICK_STATS"))->SetMacro(bind(&do_TICK_STATS, placeholders::_2))->SetHelp("Display the actual polling period, its jitter and the processing time over the recent ticks, and the number of ticks that took longer than TICK_TIME. Enter TICK_STATS RESET to clear the statistics."));
+	commandRegistry.Add((new JSMMacro("RECORD_INPUT"))->SetMacro(bind(&do_RECORD_INPUT, placeholders::_2))->SetHelp("Record what all controllers send to the given binary file, until RECORD_INPUT is entered again without a file."));
+	commandRegistry.Add((new JSMMacro("REPLAY_INPUT"))->SetMacro(bind(&do_REPLAY_INPUT, placeholders::_2))->SetHelp("Play a file made by RECORD_INPUT back instead of reading the controllers, as fast as possible or at the recorded pace if REALTIME is added after the file. RECONNECT_CONTROLLERS goes back to the controllers."));
 	commandRegistry.Add((new JSMMacro("SLEEP"))->SetMacro(bind(&do_SLEEP, placeholders::_2))->SetHelp("Sleep for the given number of seconds, or one second if no number is given. Can't sleep more than 10 seconds per command."));
 	commandRegistry.Add((new JSMMacro("FINISH_GYRO_CALIBRATION"))->SetMacro(bind(&do_FINISH_GYRO_CALIBRATION))->SetHelp("Finish calibrating the gyro in all controllers."));
 	commandRegistry.Add((new JSMMacro("RESTART_GYRO_CALIBRATION"))->SetMacro(bind(&do_RESTART_GYRO_CALIBRATION))->SetHelp("Start calibrating the gyro in all controllers."));
@@ -4232,11 +4959,18 @@ int main(int argc, char *argv[])
 	                      ->SetHelp("Sets the amount of time in milliseconds within which the user needs to press a button twice before enabling the double press mappings. This setting does not support modeshift."));
 	commandRegistry.Add((new JSMAssignment<float>("TICK_TIME", tick_time))
 	                      ->SetHelp("Sets the time in milliseconds that JoyShockMaper waits before reading from each controller again."));
+	commandRegistry.Add((new JSMAssignment<Switch>("AUTO_TICK", auto_tick))
+	                      ->SetHelp("When ON, each controller is processed right after its reports arrive, at the rate measured for it. Ticks without new input are skipped, except to progress holds, turbos and other time based states, which still happen every TICK_TIME."));
+	commandRegistry.Add((new JSMAssignment<float>("OUTPUT_REPORT_INTERVAL", output_report_interval))
+	                      ->SetHelp("Sets the minimum time in milliseconds between two reports sending rumble, lights and trigger effects to a controller. Changes made in between are combined into the next report."));
+	commandRegistry.Add((new JSMAssignment<int>("POLL_THREADS", poll_threads))
+	                      ->SetHelp("Sets the number of threads processing controllers in parallel on each tick, between 0 and 8. 0 or 1 processes them one after the other."));
 	commandRegistry.Add((new JSMAssignment<PathString>("JSM_DIRECTORY", currentWorkingDir))
 	                      ->SetHelp("If AUTOLOAD doesn't work properly, set this value to the path to the directory holding the JoyShockMapper.exe file. Make sure a folder named \"AutoLoad\" exists there."));
 	commandRegistry.Add((new JSMAssignment<TouchpadMode>("TOUCHPAD_MODE", touchpad_mode))
 	                      ->SetHelp("Assign a mode to the touchpad. Valid values are GRID_AND_STICK or MOUSE."));
 	commandRegistry.Add((new JSMAssignment<FloatXY>("GRID_SIZE", grid_size))
+	                      ->SetRegistryChange(&StageGridDimensions)
 	                      ->SetHelp("When TOUCHPAD_MODE is set to GRID_AND_STICK, this variable sets the number of rows and columns in the grid. The product of the two numbers need to be between 1 and 25."));
 	commandRegistry.Add((new JSMAssignment<StickMode>(touch_stick_mode))
 	                      ->SetHelp("Set a mouse mode for the touchpad stick. Valid values are the following:\nNO_MOUSE, AIM, FLICK, FLICK_ONLY, ROTATE_ONLY, MOUSE_RING, MOUSE_AREA, OUTER_RING, INNER_RING"));
@@ -4339,15 +5073,19 @@ int main(int argc, char *argv[])
 
 	Mapping::_isCommandValid = bind(&CmdRegistry::isCommandValid, &commandRegistry, placeholders::_1);
 
+	PublishSettings();
 	connectDevices();
 	jsl->SetCallback(&joyShockPollCallback);
 	jsl->SetTouchCallback(&TouchCallback);
+	jsl->SetConnectionCallback(&ConnectionCallback);
+	jsl->SetBusyCallback(&BusyCallback);
 	tray.reset(TrayIcon::getNew(trayIconData, &beforeShowTrayMenu));
 	if (tray)
 	{
 		tray->Show();
 	}
 
+	loading_lock.lock();
 	do_RESET_MAPPINGS(&commandRegistry); // OnReset.txt
 	if (commandRegistry.loadConfigFile("OnStartup.txt"))
 	{
@@ -4373,6 +5111,8 @@ int main(int argc, char *argv[])
 			autoloadSwitch = Switch::OFF;
 		}
 	}
+	PublishSettings(); // OnReset.txt, OnStartup.txt and the file given as argument
+	loading_lock.unlock();
 
 	// The main loop is simple and reads like pseudocode
 	string enteredCommand;
@@ -4381,6 +5121,7 @@ int main(int argc, char *argv[])
 		getline(cin, enteredCommand);
 		loading_lock.lock();
 		commandRegistry.processLine(enteredCommand);
+		PublishSettings();
 		loading_lock.unlock();
 	}
 #ifdef _WIN32
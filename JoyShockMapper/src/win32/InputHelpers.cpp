@@ -177,6 +177,11 @@ void setMouseNorm(float x, float y)
 	SendInput(1, &input, sizeof(input));
 }
 
+void initVirtualOutput(bool optional)
+{
+	// SendInput needs no device
+}
+
 BOOL WriteToConsole(in_string command)
 {
 	static const INPUT_RECORD ESC_DOWN = { KEY_EVENT, { TRUE, 1, VK_ESCAPE, MapVirtualKey(VK_ESCAPE, MAPVK_VK_TO_VSC), VK_ESCAPE, 0 } };
@@ -0,0 +1,188 @@
+#include "CmdRegistry.h"
+#include "JoyShockMapper.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// What the platform provides to the registry: a quiet log, and a scratch configuration folder
+streambuf *Log::makeBuffer(Level level)
+{
+	return new NullBuffer();
+}
+
+string NONAME;
+
+static const string TEST_FOLDER = (filesystem::temp_directory_path() / "CmdRegistryTest/").string();
+
+const char *BASE_JSM_CONFIG_FOLDER()
+{
+	return TEST_FOLDER.c_str();
+}
+
+namespace
+{
+int failures = 0;
+
+#define CHECK(name, condition)                                                     \
+	if (!(condition))                                                              \
+	{                                                                              \
+		printf("FAILED %s: %s (line %d)\n", name, #condition, __LINE__);           \
+		++failures;                                                                \
+	}
+
+constexpr size_t MAX_CELLS = 25;
+
+// Reads "= <number>"
+bool ReadNumber(in_string arguments, float &number)
+{
+	stringstream ss(arguments);
+	char equal = '\0';
+	ss >> equal >> number;
+	return equal == '=' && !ss.fail();
+}
+
+// A grid of cells whose commands come and go with its size, like the touchpad grid buttons
+class Grid
+{
+public:
+	vector<float> cells;
+
+	Grid(CmdRegistry &registry)
+	  : _registry(registry)
+	{
+		Resize(2);
+		registry.Add((new JSMMacro("GRID_SIZE"))
+		               ->SetMacro(bind(&Grid::SetSize, this, placeholders::_2))
+		               ->SetRegistryChange(bind(&Grid::StageSize, placeholders::_1, placeholders::_3)));
+	}
+
+private:
+	CmdRegistry &_registry;
+
+	static string CellName(size_t index)
+	{
+		return "T" + to_string(index + 1);
+	}
+
+	bool SetSize(in_string arguments)
+	{
+		float size;
+		if (!ReadNumber(arguments, size) || size < 1 || size > MAX_CELLS)
+		{
+			return false;
+		}
+		Resize(size_t(size));
+		return true;
+	}
+
+	void Resize(size_t numberOfCells)
+	{
+		while (cells.size() > numberOfCells)
+		{
+			_registry.Remove(CellName(cells.size() - 1));
+			cells.pop_back();
+		}
+		while (cells.size() < numberOfCells)
+		{
+			size_t index = cells.size();
+			cells.push_back(0.f);
+			_registry.Add((new JSMMacro(CellName(index)))->SetMacro([this, index](JSMMacro *, in_string arguments) {
+				return ReadNumber(arguments, cells[index]);
+			}));
+		}
+	}
+
+	static void StageSize(in_string arguments, map<string, bool> &commands)
+	{
+		float size;
+		if (ReadNumber(arguments, size) && size >= 1 && size <= MAX_CELLS)
+		{
+			for (size_t i = 0; i < MAX_CELLS; ++i)
+			{
+				commands[CellName(i)] = i < size_t(size);
+			}
+		}
+	}
+};
+
+string WriteFile(const string &name, const string &contents)
+{
+	string path = TEST_FOLDER + name;
+	ofstream(path) << contents;
+	return path;
+}
+
+void TestRegistryChanges()
+{
+	CmdRegistry registry;
+	Grid grid(registry);
+	CHECK("grid", grid.cells.size() == 2 && !registry.hasCommand("T5"));
+
+	// T5 only exists once the grid grew
+	CHECK("grow", registry.loadConfigFile(WriteFile("grow.txt", "GRID_SIZE = 9\nT5 = 2.5\n")));
+	CHECK("grow", grid.cells.size() == 9 && grid.cells[4] == 2.5f);
+
+	// T5 is gone once the grid shrank: nothing is applied
+	CHECK("shrink", registry.loadConfigFile(WriteFile("shrink.txt", "GRID_SIZE = 4\nT5 = 1\n")));
+	CHECK("shrink", grid.cells.size() == 9 && grid.cells[4] == 2.5f);
+
+	// Unknown before the grid grows
+	CHECK("order", registry.loadConfigFile(WriteFile("order.txt", "GRID_SIZE = 2\nT5 = 1\nGRID_SIZE = 9\n")));
+	CHECK("order", grid.cells.size() == 9 && grid.cells[4] == 2.5f);
+
+	// Included files see the changes of the lines before them
+	WriteFile("cell.txt", "T7 = 4\n");
+	CHECK("include", registry.loadConfigFile(WriteFile("include.txt", "GRID_SIZE = 2\nGRID_SIZE = 8\n" + TEST_FOLDER + "cell.txt\n")));
+	CHECK("include", grid.cells.size() == 8 && grid.cells[6] == 4.f);
+}
+
+void TestStagedFiles()
+{
+	CmdRegistry registry;
+	Grid grid(registry);
+	registry.loadConfigFile(WriteFile("grow.txt", "GRID_SIZE = 9\n"));
+
+	// Loaded again as it was checked
+	string cell = WriteFile("cell.txt", "T5 = 1\n");
+	CHECK("reload", registry.loadConfigFile(cell));
+	grid.cells[4] = 0.f;
+	CHECK("reload", registry.loadConfigFile(cell));
+	CHECK("reload", grid.cells[4] == 1.f);
+
+	// Changes to the file are picked up
+	WriteFile("cell.txt", "T5 = 2\n");
+	CHECK("edit", registry.loadConfigFile(cell));
+	CHECK("edit", grid.cells[4] == 2.f);
+
+	// The file is checked again once its command is gone
+	CHECK("registry", registry.loadConfigFile(WriteFile("shrink.txt", "GRID_SIZE = 4\n")));
+	CHECK("registry", registry.loadConfigFile(cell));
+	CHECK("registry", grid.cells.size() == 4 && !registry.hasCommand("T5"));
+	CHECK("registry", registry.loadConfigFile(WriteFile("grow.txt", "GRID_SIZE = 9\n")));
+	CHECK("registry", registry.loadConfigFile(cell));
+	CHECK("registry", grid.cells[4] == 2.f);
+}
+} // namespace
+
+int main()
+{
+	filesystem::remove_all(TEST_FOLDER);
+	filesystem::create_directories(TEST_FOLDER);
+	TestRegistryChanges();
+	TestStagedFiles();
+	filesystem::remove_all(TEST_FOLDER);
+	if (failures > 0)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,355 @@
+#include "PlayStationReports.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace PlayStationReports;
+
+namespace
+{
+int failures = 0;
+
+#define CHECK(name, condition)                                                     \
+	if (!(condition))                                                              \
+	{                                                                              \
+		printf("FAILED %s: %s (line %d)\n", name, #condition, __LINE__);           \
+		++failures;                                                                \
+	}
+
+bool Near(float a, float b)
+{
+	return fabs(a - b) < 0.001f;
+}
+
+struct InputCase
+{
+	const char *name;
+	int controllerType;
+	Bus bus;
+	// Bytes to write over a neutral report, at offsets from the base of the layout
+	vector<pair<uint8_t, uint8_t>> bytes;
+	float stickLX;
+	float stickLY;
+	float lTrigger;
+	float gyroX;
+	float accelZ;
+	int buttons;
+	uint32_t sensorTimestamp;
+	bool t0Down;
+	int t0Id;
+	float t0X;
+	float t0Y;
+};
+
+// The left stick right and down, full left trigger, cross and d-pad right with PS, 10 deg/s of gyro X,
+// 1G on accel Z and a finger in the middle of the touchpad
+const InputCase INPUT_CASES[] = {
+	{ "DS4 USB", JS_TYPE_DS4, Bus::USB,
+	  { { 0, 255 }, { 1, 255 }, { 4, 0x22 }, { 6, 0x01 }, { 7, 255 }, { 9, 0x34 }, { 10, 0x12 }, { 12, 160 }, { 13, 0 }, { 22, 0x00 }, { 23, 0x20 },
+	    { 34, 0x05 }, { 35, 0xC0 }, { 36, 0x73 }, { 37, 0x1D } },
+	  1.f, -1.f, 1.f, 10.f, 1.f, 1 << JSOFFSET_RIGHT | 1 << JSOFFSET_S | 1 << JSOFFSET_PS, 0x1234, true, 5, 0.5f, 0.5f },
+	{ "DS4 Bluetooth", JS_TYPE_DS4, Bus::BLUETOOTH,
+	  { { 0, 255 }, { 1, 255 }, { 4, 0x22 }, { 6, 0x01 }, { 7, 255 }, { 9, 0x34 }, { 10, 0x12 }, { 12, 160 }, { 13, 0 }, { 22, 0x00 }, { 23, 0x20 },
+	    { 34, 0x05 }, { 35, 0xC0 }, { 36, 0x73 }, { 37, 0x1D } },
+	  1.f, -1.f, 1.f, 10.f, 1.f, 1 << JSOFFSET_RIGHT | 1 << JSOFFSET_S | 1 << JSOFFSET_PS, 0x1234, true, 5, 0.5f, 0.5f },
+	{ "DualSense USB", JS_TYPE_DS, Bus::USB,
+	  { { 0, 255 }, { 1, 255 }, { 4, 255 }, { 7, 0x22 }, { 9, 0x05 }, { 15, 160 }, { 16, 0 }, { 25, 0x00 }, { 26, 0x20 },
+	    { 27, 0x78 }, { 28, 0x56 }, { 29, 0x34 }, { 30, 0x12 }, { 32, 0x05 }, { 33, 0xC0 }, { 34, 0xC3 }, { 35, 0x21 } },
+	  1.f, -1.f, 1.f, 10.f, 1.f, 1 << JSOFFSET_RIGHT | 1 << JSOFFSET_S | 1 << JSOFFSET_PS | 1 << JSOFFSET_MIC, 0x12345678, true, 5, 0.5f, 0.5f },
+	{ "DualSense Bluetooth", JS_TYPE_DS, Bus::BLUETOOTH,
+	  { { 0, 255 }, { 1, 255 }, { 4, 255 }, { 7, 0x22 }, { 9, 0x05 }, { 15, 160 }, { 16, 0 }, { 25, 0x00 }, { 26, 0x20 },
+	    { 27, 0x78 }, { 28, 0x56 }, { 29, 0x34 }, { 30, 0x12 }, { 32, 0x05 }, { 33, 0xC0 }, { 34, 0xC3 }, { 35, 0x21 } },
+	  1.f, -1.f, 1.f, 10.f, 1.f, 1 << JSOFFSET_RIGHT | 1 << JSOFFSET_S | 1 << JSOFFSET_PS | 1 << JSOFFSET_MIC, 0x12345678, true, 5, 0.5f, 0.5f },
+};
+
+void Seal(const InputLayout &layout, uint8_t *data)
+{
+	if (layout.checksum)
+	{
+		uint32_t crc = BluetoothCrc(0xA1, data, layout.size - 4);
+		memcpy(data + layout.size - 4, &crc, 4); // little endian, like the controllers
+	}
+}
+
+// Sticks centered, d-pad released, no finger on the touchpad
+vector<uint8_t> NeutralReport(const InputLayout &layout)
+{
+	vector<uint8_t> data(layout.size, 0);
+	data[0] = layout.reportId;
+	for (auto &field : layout.axes)
+	{
+		if (field.encoding == Encoding::U8_CENTERED)
+		{
+			data[layout.base + field.offset] = 128;
+		}
+	}
+	data[layout.base + layout.hat] = 0x08;
+	data[layout.base + layout.touch] = 0x80;
+	data[layout.base + layout.touch + 4] = 0x80;
+	Seal(layout, data.data());
+	return data;
+}
+
+void TestInputReports()
+{
+	for (auto &test : INPUT_CASES)
+	{
+		const InputLayout *layout = FindInputLayout(test.controllerType, test.bus);
+		CHECK(test.name, layout != nullptr);
+		if (!layout)
+		{
+			continue;
+		}
+		vector<uint8_t> data = NeutralReport(*layout);
+		InputReport report;
+		CHECK(test.name, ParseInputReport(*layout, data.data(), data.size(), report));
+		CHECK(test.name, report.state.buttons == 0 && Near(report.state.stickLX, 0.f) && !report.touch.t0Down);
+
+		for (auto &byte : test.bytes)
+		{
+			data[layout->base + byte.first] = byte.second;
+		}
+		Seal(*layout, data.data());
+		CHECK(test.name, ParseInputReport(*layout, data.data(), data.size(), report));
+		CHECK(test.name, Near(report.state.stickLX, test.stickLX));
+		CHECK(test.name, Near(report.state.stickLY, test.stickLY));
+		CHECK(test.name, Near(report.state.lTrigger, test.lTrigger));
+		CHECK(test.name, Near(report.imu.gyroX, test.gyroX));
+		CHECK(test.name, Near(report.imu.accelZ, test.accelZ));
+		CHECK(test.name, report.state.buttons == test.buttons);
+		CHECK(test.name, report.sensorTimestamp == test.sensorTimestamp);
+		CHECK(test.name, report.touch.t0Down == test.t0Down && report.touch.t0Id == test.t0Id);
+		CHECK(test.name, Near(report.touch.t0X, test.t0X) && Near(report.touch.t0Y, test.t0Y));
+		CHECK(test.name, !report.touch.t1Down);
+
+		// A longer read holds the whole report
+		data.push_back(0xFF);
+		CHECK(test.name, ParseInputReport(*layout, data.data(), data.size(), report));
+		data.pop_back();
+
+		// Truncated
+		CHECK(test.name, !ParseInputReport(*layout, data.data(), data.size() - 1, report));
+		CHECK(test.name, !ParseInputReport(*layout, data.data(), 0, report));
+
+		// Another report
+		vector<uint8_t> other = data;
+		other = data;
+		other[0] ^= 0xFF;
+		CHECK(test.name, !ParseInputReport(*layout, other.data(), other.size(), report));
+
+		// Corrupted in transit
+		other = data;
+		other[layout->base] ^= 0x01;
+		CHECK(test.name, ParseInputReport(*layout, other.data(), other.size(), report) == !layout->checksum);
+		other = data;
+		other[layout->size - 1] ^= 0x01;
+		CHECK(test.name, ParseInputReport(*layout, other.data(), other.size(), report) == !layout->checksum);
+	}
+}
+
+// Whatever a device sends, a report parses to values in range or is rejected
+void TestGarbage()
+{
+	uint32_t seed = 12345;
+	auto random = [&seed]() {
+		seed = seed * 1103515245 + 12345;
+		return uint8_t(seed >> 16);
+	};
+	for (int controllerType : { JS_TYPE_DS4, JS_TYPE_DS })
+	{
+		for (Bus bus : { Bus::USB, Bus::BLUETOOTH })
+		{
+			const InputLayout *layout = FindInputLayout(controllerType, bus);
+			CHECK("garbage", layout != nullptr);
+			if (!layout)
+			{
+				continue;
+			}
+			for (int i = 0; i < 1000; ++i)
+			{
+				vector<uint8_t> data(layout->size);
+				for (auto &byte : data)
+				{
+					byte = random();
+				}
+				data[0] = layout->reportId;
+				InputReport report;
+				bool parsed = ParseInputReport(*layout, data.data(), data.size(), report);
+				CHECK("garbage", parsed == !layout->checksum);
+				if (parsed)
+				{
+					CHECK("garbage", fabs(report.state.stickLX) <= 1.f && fabs(report.state.stickRY) <= 1.f);
+					CHECK("garbage", report.state.lTrigger >= 0.f && report.state.lTrigger <= 1.f);
+					CHECK("garbage", report.touch.t0X >= 0.f && report.touch.t0X <= 1.f && report.touch.t1Y >= 0.f && report.touch.t1Y <= 1.f);
+				}
+			}
+		}
+	}
+}
+
+struct OutputCase
+{
+	const char *name;
+	int controllerType;
+	Bus bus;
+	size_t size; // 0 if the controller takes no report
+	// Expected bytes, from the start of the report
+	vector<pair<uint8_t, uint8_t>> bytes;
+};
+
+const OutputCase OUTPUT_CASES[] = {
+	{ "DS4 USB output", JS_TYPE_DS4, Bus::USB, 32,
+	  { { 0, 0x05 }, { 1, 0x03 }, { 4, 0x40 }, { 5, 0x80 }, { 6, 0x11 }, { 7, 0x22 }, { 8, 0x33 } } },
+	{ "DS4 Bluetooth output", JS_TYPE_DS4, Bus::BLUETOOTH, 78,
+	  { { 0, 0x11 }, { 1, 0xC0 }, { 3, 0x03 }, { 6, 0x40 }, { 7, 0x80 }, { 8, 0x11 }, { 9, 0x22 }, { 10, 0x33 } } },
+	{ "DualSense USB output", JS_TYPE_DS, Bus::USB, 63,
+	  { { 0, 0x02 }, { 1, 0x0F }, { 2, 0x15 }, { 3, 0x40 }, { 4, 0x80 }, { 9, 0x01 }, { 11, 0x05 }, { 22, 0x05 }, { 44, 0x0A }, { 45, 0x11 }, { 46, 0x22 }, { 47, 0x33 } } },
+	{ "DualSense Bluetooth output", JS_TYPE_DS, Bus::BLUETOOTH, 78,
+	  { { 0, 0x31 }, { 1, 0x70 }, { 2, 0x10 }, { 3, 0x0F }, { 4, 0x15 }, { 5, 0x40 }, { 6, 0x80 }, { 11, 0x01 }, { 13, 0x05 }, { 24, 0x05 }, { 46, 0x0A }, { 47, 0x11 }, { 48, 0x22 }, { 49, 0x33 } } },
+	{ "Joy-Con output", JS_TYPE_JOYCON_LEFT, Bus::BLUETOOTH, 0, {} },
+};
+
+void TestOutputReports()
+{
+	Output output;
+	output.smallRumble = 0x40;
+	output.bigRumble = 0x80;
+	output.hasLightColour = true;
+	output.lightColour = 0x112233;
+	output.playerNumber = 2;
+	output.micLight = 1;
+	output.leftTriggerEffect.mode = AdaptiveTriggerMode::OFF;
+	output.rightTriggerEffect.mode = AdaptiveTriggerMode::OFF;
+	for (auto &test : OUTPUT_CASES)
+	{
+		uint8_t buffer[MAX_OUTPUT_SIZE];
+		memset(buffer, 0xAA, sizeof(buffer));
+		size_t size = BuildOutputReport(test.controllerType, test.bus, output, 7, buffer);
+		CHECK(test.name, size == test.size);
+		if (size == 0 || size != test.size)
+		{
+			continue;
+		}
+		for (auto &byte : test.bytes)
+		{
+			CHECK(test.name, buffer[byte.first] == byte.second);
+		}
+		if (test.bus == Bus::BLUETOOTH)
+		{
+			uint32_t crc = BluetoothCrc(0xA2, buffer, size - 4);
+			CHECK(test.name, memcmp(buffer + size - 4, &crc, 4) == 0);
+		}
+	}
+
+	// Without a colour, the light bar is left alone
+	output.hasLightColour = false;
+	uint8_t buffer[MAX_OUTPUT_SIZE];
+	BuildOutputReport(JS_TYPE_DS4, Bus::USB, output, 0, buffer);
+	CHECK("DS4 output without colour", buffer[1] == 0x01 && buffer[6] == 0 && buffer[7] == 0 && buffer[8] == 0);
+	BuildOutputReport(JS_TYPE_DS, Bus::USB, output, 0, buffer);
+	CHECK("DualSense output without colour", (buffer[2] & 0x04) == 0 && buffer[45] == 0);
+}
+
+void TestCrc()
+{
+	// CRC-32 of the HID header followed by "123456789"
+	const uint8_t data[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+	CHECK("CRC", BluetoothCrc(0xA1, data, sizeof(data)) == 0x88ED2411);
+	CHECK("CRC", BluetoothCrc(0xA2, data, sizeof(data)) == 0x63DA9F12);
+}
+void WriteS16(vector<uint8_t> &data, int offset, int16_t value)
+{
+	data[offset] = uint8_t(value);
+	data[offset + 1] = uint8_t(uint16_t(value) >> 8);
+}
+
+// Gyro biases of 10, 20 and 30 with ranges of +-8000 at +-500 deg/s, and accelerometers centered on 100
+vector<uint8_t> CalibrationReport(int controllerType, Bus bus)
+{
+	bool ds4Usb = controllerType == JS_TYPE_DS4 && bus == Bus::USB;
+	vector<uint8_t> data(CALIBRATION_REPORT_SIZE, 0);
+	data[0] = CalibrationReportId(controllerType, bus);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		WriteS16(data, 1 + 2 * axis, int16_t(10 * (axis + 1)));
+		WriteS16(data, ds4Usb ? 7 + 2 * axis : 7 + 4 * axis, 8000);
+		WriteS16(data, ds4Usb ? 13 + 2 * axis : 9 + 4 * axis, -8000);
+		WriteS16(data, 23 + 4 * axis, 8192 + 100);
+		WriteS16(data, 25 + 4 * axis, -8192 + 100);
+	}
+	WriteS16(data, 19, 500);
+	WriteS16(data, 21, 500);
+	if (bus == Bus::BLUETOOTH)
+	{
+		uint32_t crc = BluetoothCrc(0xA3, data.data(), data.size() - 4);
+		memcpy(data.data() + data.size() - 4, &crc, 4);
+	}
+	return data;
+}
+
+void TestCalibration()
+{
+	for (auto &test : INPUT_CASES)
+	{
+		const InputLayout *layout = FindInputLayout(test.controllerType, test.bus);
+		vector<uint8_t> data = CalibrationReport(test.controllerType, test.bus);
+		ImuCalibration calibration;
+		CHECK(test.name, ParseCalibration(test.controllerType, test.bus, data.data(), data.size(), calibration));
+		CHECK(test.name, Near(calibration.bias[GYRO_X - GYRO_X], 10.f) && Near(calibration.bias[ACCEL_Z - GYRO_X], 100.f));
+		CHECK(test.name, Near(calibration.scale[GYRO_Z - GYRO_X], GYRO_SCALE) && Near(calibration.scale[ACCEL_X - GYRO_X], ACCEL_SCALE));
+
+		// 10 deg/s and 1G once the bias is removed
+		vector<uint8_t> input = NeutralReport(*layout);
+		int gyroX = 0, accelZ = 0;
+		for (auto &field : layout->axes)
+		{
+			if (field.axis == GYRO_X)
+				gyroX = layout->base + field.offset;
+			else if (field.axis == ACCEL_Z)
+				accelZ = layout->base + field.offset;
+		}
+		WriteS16(input, gyroX, 160 + 10);
+		WriteS16(input, accelZ, 8192 + 100);
+		Seal(*layout, input.data());
+		InputReport report;
+		CHECK(test.name, ParseInputReport(*layout, input.data(), input.size(), report, &calibration));
+		CHECK(test.name, Near(report.imu.gyroX, 10.f) && Near(report.imu.accelZ, 1.f));
+
+		// A corrupt or garbage report leaves the calibration alone
+		ImuCalibration untouched;
+		vector<uint8_t> other = data;
+		WriteS16(other, 19, 0);
+		WriteS16(other, 21, 0);
+		CHECK(test.name, !ParseCalibration(test.controllerType, test.bus, other.data(), other.size(), untouched));
+		other = data;
+		WriteS16(other, 23, 100);
+		WriteS16(other, 25, 100);
+		CHECK(test.name, !ParseCalibration(test.controllerType, test.bus, other.data(), other.size(), untouched));
+		other = data;
+		other[0] ^= 0xFF;
+		CHECK(test.name, !ParseCalibration(test.controllerType, test.bus, other.data(), other.size(), untouched));
+		CHECK(test.name, !ParseCalibration(test.controllerType, test.bus, data.data(), 20, untouched));
+		CHECK(test.name, Near(untouched.bias[0], 0.f) && Near(untouched.scale[0], GYRO_SCALE));
+	}
+}
+} // namespace
+
+int main()
+{
+	TestCrc();
+	TestInputReports();
+	TestGarbage();
+	TestOutputReports();
+	TestCalibration();
+	if (failures > 0)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}